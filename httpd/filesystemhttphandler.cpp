@@ -17,6 +17,7 @@
 #include "util/ioutils.h"
 #include <QtDebug>
 #include "format/timeformats.h"
+#include "httpcompression.h"
 
 static QSet<QString> _methods { "GET", "HEAD" };
 
@@ -112,12 +113,54 @@ void FilesystemHttpHandler::sendLocalResource(
   QString filename(file->fileName());
   if (!handleCacheHeadersAndSend304(file, req, res)) {
     setMimeTypeByName(filename, res);
+    if (sendPrecompressedResource(req, res, file))
+      return;
     res.setContentLength(file->size());
     if (req.method() != HttpRequest::HEAD)
       IOUtils::copy(res.output(), file);
   }
 }
 
+bool FilesystemHttpHandler::sendPrecompressedResource(
+    HttpRequest req, HttpResponse res, QFile *file) {
+  if (!HttpCompression::isEnabled())
+    return false;
+  bool acceptsGzip = HttpCompression::acceptsGzip(
+        req.header(QStringLiteral("Accept-Encoding")));
+  QDateTime lastModified = lastModifiedOf(file);
+  // a sibling .gz file, if not older, is used regardless of content type
+  QFile gzFile(file->fileName()+".gz");
+  if (gzFile.open(QIODevice::ReadOnly)
+      && lastModifiedOf(&gzFile) >= lastModified) {
+    // caches must know that body depends on Accept-Encoding, even if the
+    // client does not accept gzip and even if Vary already lists Origin
+    res.addVaryToken(QStringLiteral("Accept-Encoding"));
+    if (!acceptsGzip)
+      return false;
+    res.setHeader(QStringLiteral("Content-Encoding"), QStringLiteral("gzip"));
+    res.setContentLength(gzFile.size());
+    if (req.method() != HttpRequest::HEAD)
+      IOUtils::copy(res.output(), &gzFile);
+    return true;
+  }
+  if (file->size() < HttpCompression::minimumSize()
+      || !HttpCompression::isCompressibleContentType(
+        res.header(QStringLiteral("Content-Type"),
+                   QStringLiteral("text/plain")))
+      || !acceptsGzip) {
+    return false; // Vary will be set by HttpResponse, if needed
+  }
+  QByteArray data = HttpCompression::cachedGzip(*file, lastModified);
+  if (data.isNull())
+    return false; // will be compressed on the fly by HttpResponse, if needed
+  res.setHeader(QStringLiteral("Content-Encoding"), QStringLiteral("gzip"));
+  res.addVaryToken(QStringLiteral("Accept-Encoding"));
+  res.setContentLength(data.size());
+  if (req.method() != HttpRequest::HEAD)
+    res.output()->write(data);
+  return true;
+}
+
 void FilesystemHttpHandler::setMimeTypeByName(QString name, HttpResponse res) {
   // LATER check if performance can be enhanced (regexp)
   typedef QPair<QRegExp,QString> QRegExpQString;
@@ -135,17 +178,18 @@ void FilesystemHttpHandler::setMimeTypeByName(QString name, HttpResponse res) {
 
 static QDateTime startTimeUTC(QDateTime::currentDateTimeUtc());
 
+QDateTime FilesystemHttpHandler::lastModifiedOf(QFile *file) {
+  QString filename(file->fileName());
+  if (filename.startsWith("qrc:") || filename.startsWith(":"))
+    return startTimeUTC;
+  return QFileInfo(*file).lastModified().toUTC();
+}
+
 // LATER handle ETag / If-None-Match
 bool FilesystemHttpHandler::handleCacheHeadersAndSend304(
     QFile *file, HttpRequest req, HttpResponse res) {
   if (file) {
-    QString filename(file->fileName());
-    QFileInfo info(*file);
-    QDateTime lastModified;
-    if (filename.startsWith("qrc:") || filename.startsWith(":"))
-      lastModified = startTimeUTC;
-    else
-      lastModified = info.lastModified().toUTC();
+    QDateTime lastModified = lastModifiedOf(file);
     if (lastModified.isValid())
       res.setHeader("Last-Modified", TimeFormats::toRfc2822DateTime(
                       lastModified));
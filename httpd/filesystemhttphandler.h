@@ -84,6 +84,15 @@ protected:
   /** @return true iff 304 was sent */
   bool handleCacheHeadersAndSend304(QFile *file, HttpRequest req,
                                     HttpResponse res);
+  /** Send gzip-encoded variant of file if the client accepts it, either from a
+   * sibling .gz file or from HttpCompression cache.
+   * Content type must already be set.
+   * Accept-Encoding is added to Vary header, keeping tokens already listed.
+   * @return true iff the response was sent */
+  bool sendPrecompressedResource(HttpRequest req, HttpResponse res,
+                                 QFile *file);
+  /** Modification time, or server start time for Qt resources. */
+  static QDateTime lastModifiedOf(QFile *file);
 };
 
 #endif // FILESYSTEMHTTPHANDLER_H
@@ -0,0 +1,184 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "httpcompression.h"
+#include "thread/readmostlyatomicvalue.h"
+#include <QFile>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <climits>
+#include <zlib.h>
+
+namespace {
+
+class Config {
+public:
+  bool _enabled = true;
+  QStringList _contentTypes { "text/*", "application/javascript",
+                              "application/json", "application/xml",
+                              "image/svg+xml" };
+  qint64 _minimumSize = 1024;
+  int _level = 6;
+  qint64 _cacheMaxBytes = 16*1024*1024;
+};
+
+class CacheEntry {
+public:
+  QDateTime _lastModified;
+  QByteArray _data;
+};
+
+}
+
+static ReadMostlyAtomicValue<Config> _config;
+static QMutex _cacheMutex;
+static QCache<QString,CacheEntry> _cache(16*1024*1024);
+
+bool HttpCompression::acceptsGzip(QString acceptEncoding) {
+  bool star = false;
+  foreach (const QString &item, acceptEncoding.split(',')) {
+    int semicolon = item.indexOf(';');
+    QString coding = item.left(semicolon).trimmed();
+    double q = 1.0;
+    if (semicolon >= 0) {
+      QString param = item.mid(semicolon+1).trimmed();
+      if (param.startsWith(QStringLiteral("q="), Qt::CaseInsensitive))
+        q = param.mid(2).toDouble();
+    }
+    if (!coding.compare(QStringLiteral("gzip"), Qt::CaseInsensitive)
+        || !coding.compare(QStringLiteral("x-gzip"), Qt::CaseInsensitive))
+      return q > 0;
+    if (coding == QStringLiteral("*"))
+      star = q > 0;
+  }
+  return star;
+}
+
+bool HttpCompression::isEnabled() {
+  return _config.data()._enabled;
+}
+
+void HttpCompression::setEnabled(bool enabled) {
+  Config &config = _config.lockData();
+  config._enabled = enabled;
+  _config.unlockData();
+}
+
+QStringList HttpCompression::compressibleContentTypes() {
+  return _config.data()._contentTypes;
+}
+
+void HttpCompression::setCompressibleContentTypes(QStringList contentTypes) {
+  Config &config = _config.lockData();
+  config._contentTypes = contentTypes;
+  _config.unlockData();
+}
+
+bool HttpCompression::isCompressibleContentType(QString contentType) {
+  int semicolon = contentType.indexOf(';');
+  if (semicolon >= 0)
+    contentType = contentType.left(semicolon);
+  contentType = contentType.trimmed();
+  foreach (const QString &candidate, _config.data()._contentTypes) {
+    if (candidate.endsWith(QStringLiteral("/*"))) {
+      if (contentType.startsWith(candidate.left(candidate.size()-1),
+                                 Qt::CaseInsensitive))
+        return true;
+    } else if (!contentType.compare(candidate, Qt::CaseInsensitive))
+      return true;
+  }
+  return false;
+}
+
+qint64 HttpCompression::minimumSize() {
+  return _config.data()._minimumSize;
+}
+
+void HttpCompression::setMinimumSize(qint64 bytes) {
+  Config &config = _config.lockData();
+  config._minimumSize = bytes;
+  _config.unlockData();
+}
+
+int HttpCompression::level() {
+  return _config.data()._level;
+}
+
+void HttpCompression::setLevel(int level) {
+  Config &config = _config.lockData();
+  config._level = qBound(1, level, 9);
+  _config.unlockData();
+}
+
+QByteArray HttpCompression::gzip(const QByteArray &data, int level) {
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  // 15+16 window bits: 32k window with gzip header and trailer
+  if (deflateInit2(&zs, level < 0 ? HttpCompression::level() : level,
+                   Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return QByteArray();
+  QByteArray output;
+  output.resize(int(deflateBound(&zs, uLong(data.size()))));
+  zs.next_in = (Bytef*)data.constData();
+  zs.avail_in = uInt(data.size());
+  zs.next_out = (Bytef*)output.data();
+  zs.avail_out = uInt(output.size());
+  int rc = deflate(&zs, Z_FINISH);
+  output.resize(int(zs.total_out));
+  deflateEnd(&zs);
+  return rc == Z_STREAM_END ? output : QByteArray();
+}
+
+QByteArray HttpCompression::cachedGzip(const QFile &file,
+                                       QDateTime lastModified) {
+  QString key = file.fileName();
+  qint64 maxBytes = cacheMaxBytes();
+  if (maxBytes <= 0 || file.size() > maxBytes)
+    return QByteArray();
+  QMutexLocker ml(&_cacheMutex);
+  CacheEntry *entry = _cache.object(key);
+  if (entry && entry->_lastModified == lastModified)
+    return entry->_data;
+  ml.unlock();
+  // compressing without lock, concurrent misses may compress twice
+  QFile input(key);
+  if (!input.open(QIODevice::ReadOnly))
+    return QByteArray();
+  QByteArray data = gzip(input.readAll());
+  if (data.isNull())
+    return data;
+  ml.relock();
+  _cache.setMaxCost(int(qMin(maxBytes, qint64(INT_MAX))));
+  _cache.insert(key, new CacheEntry{ lastModified, data }, data.size());
+  return data;
+}
+
+qint64 HttpCompression::cacheMaxBytes() {
+  return _config.data()._cacheMaxBytes;
+}
+
+void HttpCompression::setCacheMaxBytes(qint64 bytes) {
+  Config &config = _config.lockData();
+  config._cacheMaxBytes = bytes;
+  _config.unlockData();
+  if (bytes <= 0)
+    clearCache();
+}
+
+void HttpCompression::clearCache() {
+  QMutexLocker ml(&_cacheMutex);
+  _cache.clear();
+}
@@ -0,0 +1,77 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HTTPCOMPRESSION_H
+#define HTTPCOMPRESSION_H
+
+#include "libp6core_global.h"
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QDateTime>
+
+class QFile;
+
+/** Gzip compression of HTTP responses: content negotiation, global
+ * configuration and memory cache of precompressed static resources.
+ *
+ * HttpResponse compresses on the fly when the client accepts gzip, the
+ * content type is compressible and the body is not known to be smaller than
+ * minimumSize(). FilesystemHttpHandler sends sibling .gz files or cached
+ * compressed content for static resources instead.
+ *
+ * Brotli is not supported since zlib is the only compression library
+ * libpumpkin depends on.
+ *
+ * Every method is thread-safe, configuration being read without lock. */
+class LIBPUMPKINSHARED_EXPORT HttpCompression {
+  HttpCompression() = delete;
+
+public:
+  /** Return true iff an Accept-Encoding header value accepts gzip, with a
+   * non-zero quality, either explicitly or through "*". */
+  static bool acceptsGzip(QString acceptEncoding);
+  /** Default: true */
+  static bool isEnabled();
+  static void setEnabled(bool enabled);
+  /** Content types worth compressing, parameters (e.g. ";charset=UTF-8") are
+   * ignored. An item ending with "/*" matches a whole type.
+   * Default: text/*, application/javascript, application/json,
+   * application/xml, image/svg+xml */
+  static QStringList compressibleContentTypes();
+  static void setCompressibleContentTypes(QStringList contentTypes);
+  static bool isCompressibleContentType(QString contentType);
+  /** Bodies known to be smaller than this size are not compressed.
+   * Default: 1024 */
+  static qint64 minimumSize();
+  static void setMinimumSize(qint64 bytes);
+  /** zlib compression level, from 1 (fastest) to 9 (smallest). Default: 6 */
+  static int level();
+  static void setLevel(int level);
+  /** Compress data at once using gzip format.
+   * @param level compression level, -1 means level() */
+  static QByteArray gzip(const QByteArray &data, int level = -1);
+  /** Gzip-compressed content of a static file, from a memory cache keyed by
+   * file name and modification time.
+   * Does not read from file itself but opens its own handle.
+   * @return null QByteArray if the file cannot be read or is too large to be
+   *   cached */
+  static QByteArray cachedGzip(const QFile &file, QDateTime lastModified);
+  /** Maximum total size of cached compressed content. 0 disables the cache.
+   * Default: 16 MiB */
+  static qint64 cacheMaxBytes();
+  static void setCacheMaxBytes(qint64 bytes);
+  static void clearCache();
+};
+
+#endif // HTTPCOMPRESSION_H
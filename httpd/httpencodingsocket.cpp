@@ -0,0 +1,180 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "httpencodingsocket.h"
+#include <zlib.h>
+
+// size of zlib output steps and threshold for writing to actual socket
+#define ENCODING_CHUNK_SIZE 16384
+// zlib counts input bytes as uInt
+#define MAX_DEFLATE_INPUT (1 << 30)
+// above this amount of data in socket buffer, writers wait for the client
+#define OUTPUT_HIGH_WATERMARK (1024*1024)
+#define OUTPUT_WRITE_WAIT 10000
+
+HttpEncodingSocket::HttpEncodingSocket(QAbstractSocket *output,
+                                       QObject *parent)
+  : DummySocket(parent), _output(output), _zstream(0), _chunked(false),
+    _finished(false) {
+  setOpenMode(QIODevice::WriteOnly);
+}
+
+HttpEncodingSocket::~HttpEncodingSocket() {
+  if (_zstream) {
+    deflateEnd(_zstream);
+    delete _zstream;
+  }
+}
+
+bool HttpEncodingSocket::enableGzip(int level) {
+  if (_zstream || _finished)
+    return false;
+  _zstream = new z_stream;
+  _zstream->zalloc = Z_NULL;
+  _zstream->zfree = Z_NULL;
+  _zstream->opaque = Z_NULL;
+  // 15+16 window bits: 32k window with gzip header and trailer
+  if (deflateInit2(_zstream, level, Z_DEFLATED, 15+16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete _zstream;
+    _zstream = 0;
+    return false;
+  }
+  _buffer.reserve(2*ENCODING_CHUNK_SIZE);
+  return true;
+}
+
+void HttpEncodingSocket::enableChunking() {
+  if (_finished)
+    return;
+  _chunked = true;
+  _chunkBuffer.reserve(2*ENCODING_CHUNK_SIZE);
+}
+
+qint64 HttpEncodingSocket::writeData(const char *data, qint64 len) {
+  if (_finished) {
+    setErrorString("HttpEncodingSocket: cannot write after finish()");
+    return -1;
+  }
+  if (!_zstream)
+    return writeBody(data, len) ? len : -1;
+  for (qint64 done = 0; done < len; ) {
+    uInt step = uInt(qMin(len-done, qint64(MAX_DEFLATE_INPUT)));
+    _zstream->next_in = (Bytef*)data+done;
+    _zstream->avail_in = step;
+    if (!deflateAndWrite(Z_NO_FLUSH))
+      return -1;
+    done += step;
+  }
+  return len;
+}
+
+bool HttpEncodingSocket::deflateAndWrite(int flush) {
+  int rc;
+  do {
+    int size = _buffer.size();
+    _buffer.resize(size+ENCODING_CHUNK_SIZE);
+    _zstream->next_out = (Bytef*)_buffer.data()+size;
+    _zstream->avail_out = ENCODING_CHUNK_SIZE;
+    rc = deflate(_zstream, flush);
+    _buffer.resize(size+ENCODING_CHUNK_SIZE-int(_zstream->avail_out));
+    if (rc == Z_STREAM_ERROR) {
+      setErrorString("HttpEncodingSocket: zlib stream error");
+      return false;
+    }
+  } while (_zstream->avail_out == 0
+           || (flush == Z_FINISH && rc != Z_STREAM_END));
+  if (_buffer.size() >= ENCODING_CHUNK_SIZE || flush != Z_NO_FLUSH) {
+    if (!writeBody(_buffer.constData(), _buffer.size()))
+      return false;
+    _buffer.resize(0); // keeps capacity
+  }
+  return true;
+}
+
+bool HttpEncodingSocket::writeBody(const char *data, qint64 len) {
+  if (_chunked) {
+    if (_chunkBuffer.isEmpty() && len >= ENCODING_CHUNK_SIZE) {
+      if (!writeChunk(data, len)) // large enough, avoid copying
+        return false;
+    } else {
+      _chunkBuffer.append(data, int(len));
+      if (_chunkBuffer.size() >= ENCODING_CHUNK_SIZE) {
+        if (!writeChunk(_chunkBuffer.constData(), _chunkBuffer.size()))
+          return false;
+        _chunkBuffer.resize(0); // keeps capacity
+      }
+    }
+  } else if (_output->write(data, len) != len) {
+    return false;
+  }
+  // keep memory bounded when the client reads slower than the handler writes
+  while (_output->bytesToWrite() > OUTPUT_HIGH_WATERMARK
+         && _output->waitForBytesWritten(OUTPUT_WRITE_WAIT))
+    ;
+  return true;
+}
+
+bool HttpEncodingSocket::writeChunk(const char *data, qint64 len) {
+  if (len <= 0) // an empty chunk would be the last one
+    return true;
+  QByteArray header = QByteArray::number(len, 16)+"\r\n";
+  if (_output->write(header) < 0 || _output->write(data, len) != len
+      || _output->write("\r\n", 2) != 2) {
+    setErrorString("HttpEncodingSocket: cannot write chunk: "
+                   +_output->errorString());
+    return false;
+  }
+  _output->flush();
+  return true;
+}
+
+void HttpEncodingSocket::flushPending() {
+  if (_finished)
+    return;
+  if (_zstream) {
+    _zstream->next_in = Z_NULL;
+    _zstream->avail_in = 0;
+    deflateAndWrite(Z_SYNC_FLUSH);
+  }
+  if (_chunked) {
+    writeChunk(_chunkBuffer.constData(), _chunkBuffer.size());
+    _chunkBuffer.resize(0);
+  }
+  _output->flush();
+}
+
+void HttpEncodingSocket::finish(QByteArray trailers) {
+  if (_finished)
+    return;
+  if (_zstream) {
+    _zstream->next_in = Z_NULL;
+    _zstream->avail_in = 0;
+    deflateAndWrite(Z_FINISH);
+  }
+  if (_chunked) {
+    writeChunk(_chunkBuffer.constData(), _chunkBuffer.size());
+    _chunkBuffer.resize(0);
+    _output->write("0\r\n"+trailers+"\r\n");
+  }
+  _output->flush();
+  _finished = true;
+}
+
+qint64 HttpEncodingSocket::bytesToWrite() const {
+  return _buffer.size()+_chunkBuffer.size()+_output->bytesToWrite();
+}
+
+bool HttpEncodingSocket::waitForBytesWritten(int msecs) {
+  return _output->waitForBytesWritten(msecs);
+}
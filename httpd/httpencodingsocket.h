@@ -0,0 +1,65 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HTTPENCODINGSOCKET_H
+#define HTTPENCODINGSOCKET_H
+
+#include "io/dummysocket.h"
+
+struct z_stream_s;
+
+/** Socket facade given to HttpHandlers as response output when the body
+ * must be encoded (e.g. compressed) before being written to the actual
+ * socket.
+ * Only writing is supported, any other operation behaves like DummySocket.
+ * @see HttpResponse::output() */
+class LIBPUMPKINSHARED_EXPORT HttpEncodingSocket : public DummySocket {
+  Q_OBJECT
+  Q_DISABLE_COPY(HttpEncodingSocket)
+  QAbstractSocket *_output;
+  z_stream_s *_zstream; // 0 unless gzip is enabled
+  QByteArray _buffer, _chunkBuffer;
+  bool _chunked, _finished;
+
+public:
+  explicit HttpEncodingSocket(QAbstractSocket *output, QObject *parent = 0);
+  ~HttpEncodingSocket();
+  /** Compress body using gzip. Must be called before first write.
+   * @return false if zlib could not be initialized */
+  bool enableGzip(int level);
+  /** Frame body with HTTP/1.1 chunked transfer coding, after compression if
+   * any. Must be called before first write.
+   * Small writes are coalesced into larger chunks. */
+  void enableChunking();
+  /** Send data written so far to the client without waiting for more, as a
+   * chunk if chunking is enabled. Lowers compression ratio if gzip is
+   * enabled, therefore should not be called too often. */
+  void flushPending();
+  /** Write any pending data and encoding trailer to the actual socket.
+   * Further writes will fail.
+   * @param trailers "Name: value\r\n" lines, ignored unless chunking is
+   *   enabled */
+  void finish(QByteArray trailers = QByteArray());
+  qint64 bytesToWrite() const override;
+  bool waitForBytesWritten(int msecs) override;
+
+protected:
+  qint64 writeData(const char *data, qint64 len) override;
+
+private:
+  bool deflateAndWrite(int flush);
+  bool writeBody(const char *data, qint64 len);
+  bool writeChunk(const char *data, qint64 len);
+};
+
+#endif // HTTPENCODINGSOCKET_H
@@ -30,6 +30,25 @@ HttpHandler::HttpHandler(QString name, QObject *parent)
   }
 }
 
+QList<HttpHandler::StaticRoute> HttpHandler::staticRoutes() const {
+  QMutexLocker ml(&_staticRoutesMutex);
+  return _staticRoutes;
+}
+
+void HttpHandler::setStaticRoutes(QList<StaticRoute> staticRoutes) {
+  QMutexLocker ml(&_staticRoutesMutex);
+  _staticRoutes = staticRoutes;
+  ml.unlock();
+  emit staticRoutesChanged();
+}
+
+void HttpHandler::addStaticRoute(QString pathPrefix, int methods) {
+  QMutexLocker ml(&_staticRoutesMutex);
+  _staticRoutes.append(StaticRoute(pathPrefix, methods));
+  ml.unlock();
+  emit staticRoutesChanged();
+}
+
 QString HttpHandler::name() const {
   if (!_name.isEmpty())
       return _name;
@@ -19,6 +19,7 @@
 #include "util/paramsprovidermerger.h"
 #include <QObject>
 #include <QRegularExpression>
+#include <QMutex>
 
 /** HttpHandler is responsible for handling every HTTP request the server
  * receives.
@@ -35,8 +36,24 @@ class LIBPUMPKINSHARED_EXPORT HttpHandler : public QObject {
   Q_OBJECT
   Q_DISABLE_COPY(HttpHandler)
   // LATER give handlers their own threads and make server and handler threads exchange signals
+public:
+  /** Path prefix and methods (bitwise or of HttpRequest::HttpRequestMethod)
+   * for which a handler accepts requests without acceptRequest() being
+   * called. An empty prefix matches any path. */
+  class StaticRoute {
+  public:
+    QString _pathPrefix;
+    int _methods;
+    StaticRoute(QString pathPrefix = QString(),
+                int methods = HttpRequest::ANY)
+      : _pathPrefix(pathPrefix), _methods(methods) { }
+  };
+
+private:
   QString _name;
   QList<QRegularExpression> _corsOrigins;
+  mutable QMutex _staticRoutesMutex;
+  QList<StaticRoute> _staticRoutes;
 
 public:
   HttpHandler(QString name, QObject *parent = 0);
@@ -51,8 +68,19 @@ public:
   void setCorsOrigins(QList<QRegularExpression> corsDomains) {
     _corsOrigins = corsDomains; }
   /** Return true iff the handler accept to handle the request.
-   * Thread-safe (called by several HttpWorker threads at the same time). */
+   * Thread-safe (called by several HttpWorker threads at the same time).
+   * Not called by HttpServer if the handler has static routes. */
   virtual bool acceptRequest(HttpRequest req) = 0;
+  /** Static routes, which HttpServer compiles into a prefix tree rather than
+   * calling acceptRequest() for every request.
+   * A handler with no static route (the default, including built-in
+   * handlers) is matched through acceptRequest(). Declaring static routes is
+   * opt-in, e.g. handler->addStaticRoute(handler->urlPathPrefix()), and is
+   * only correct if they accept the same requests than acceptRequest(). */
+  QList<StaticRoute> staticRoutes() const;
+  void setStaticRoutes(QList<StaticRoute> staticRoutes);
+  void addStaticRoute(QString pathPrefix, int methods = HttpRequest::ANY);
+  void clearStaticRoutes() { setStaticRoutes(QList<StaticRoute>()); }
   /** Handle the request.
    * Thread-safe (called by several HttpWorker threads at the same time).
    * @param processingContext is shared accross the whole processing of the
@@ -75,6 +103,10 @@ public:
   bool handlePreflight(HttpRequest req, HttpResponse res,
                        ParamsProviderMerger *processingContext,
                        QSet<QString> methods);
+
+signals:
+  /** Emitted when static routes change, whatever the calling thread is. */
+  void staticRoutesChanged();
 };
 
 #endif // HTTPHANDLER_H
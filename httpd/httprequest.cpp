@@ -18,23 +18,77 @@
 #include <QSharedData>
 #include <QHostAddress>
 #include <QHash>
+#include <QVector>
 #include "util/radixtree.h"
 #include "util/containerutils.h"
 #include "format/stringutils.h"
 
+// slots of well-known headers perfect hash table
+#define WELL_KNOWN_HEADERS_SLOTS 32
+// beginning of a too long line kept for diagnostics
+#define TOO_LONG_LINE_PEEK_SIZE 256
+
 class HttpRequestData : public QSharedData {
 public:
+  class HeaderRef {
+  public:
+    int _nameBegin, _nameLength, _valueBegin, _valueLength;
+  };
   QAbstractSocket *_input;
   HttpRequest::HttpRequestMethod _method;
-  QMultiHash<QString,QString> _headers;
+  // request line and header lines, headers being offsets within it
+  QByteArray _head;
+  bool _requestLineRead, _headComplete;
+  int _requestLineLength, _uriBegin, _uriLength, _lastLineBegin;
+  QVector<HeaderRef> _headerRefs;
+  // index in _headerRefs of last occurrence of every well-known header
+  qint16 _wellKnownHeaders[WELL_KNOWN_HEADERS_SLOTS];
+  mutable QMultiHash<QString,QString> _headers;
+  bool _headersHashBuilt, _cookiesParsed;
   QHash<QString,QString> _cookies, _paramsCache;
   QUrl _url;
   QUrlQuery _query;
   QStringList _clientAdresses;
   explicit HttpRequestData(QAbstractSocket *input) : _input(input),
-    _method(HttpRequest::NONE) { }
+    _method(HttpRequest::NONE), _requestLineRead(false),
+    _headComplete(false), _requestLineLength(0), _uriBegin(0), _uriLength(0),
+    _lastLineBegin(0), _headersHashBuilt(false), _cookiesParsed(false) {
+    _head.reserve(4096);
+    _headerRefs.reserve(32);
+    for (int i = 0; i < WELL_KNOWN_HEADERS_SLOTS; ++i)
+      _wellKnownHeaders[i] = -1;
+  }
+};
+
+static inline char lowerAscii(char c) {
+  return (c >= 'A' && c <= 'Z') ? char(c+('a'-'A')) : c;
+}
+
+// perfect hash of lower case header name, collision-free for these names
+// (computed by brute force search among small coefficients)
+static const char *_wellKnownHeaderNames[WELL_KNOWN_HEADERS_SLOTS] = {
+  "Pragma", 0, "Referer", 0, "Connection", "If-None-Match",
+  "If-Modified-Since", "Authorization", "Content-Length", 0, "Range", "Cookie",
+  "X-Requested-With", "Content-Encoding", 0, 0, 0, 0, "Accept", "Upgrade",
+  "Accept-Charset", "Accept-Language", "Expect", "X-Forwarded-For", "Origin",
+  "Host", "Accept-Encoding", 0, "Content-Type", "Cache-Control", "User-Agent",
+  "Transfer-Encoding",
 };
 
+static inline int wellKnownHeaderSlot(const char *name, int length) {
+  if (length <= 0)
+    return -1;
+  uint hash = uint(length) + uint(uchar(lowerAscii(name[0])))*9
+      + uint(uchar(lowerAscii(name[length-1])))*5
+      + uint(uchar(lowerAscii(name[length/2])))*19;
+  int slot = int(hash % WELL_KNOWN_HEADERS_SLOTS);
+  const char *candidate = _wellKnownHeaderNames[slot];
+  if (!candidate || int(qstrlen(candidate)) != length
+      || qstrnicmp(candidate, name, uint(length)))
+    return -1;
+  return slot;
+}
+
 HttpRequest::HttpRequest(QAbstractSocket *input)
   : d(new HttpRequestData(input)) {
 }
@@ -77,31 +131,189 @@ HttpRequest::HttpRequestMethod HttpRequest::methodFromText(QString name) {
   return _methodFromText.value(name, NONE);
 }
 
-bool HttpRequest::parseAndAddHeader(QString rawHeader) {
-  if (!d)
-    return false;
-  int i = rawHeader.indexOf(':');
-  if (i == -1)
+// same as methodFromText() without building a QString
+static inline HttpRequest::HttpRequestMethod methodFromBytes(
+    const char *s, int length) {
+  switch (length) {
+  case 3:
+    if (!qstrncmp(s, "GET", 3))
+      return HttpRequest::GET;
+    if (!qstrncmp(s, "PUT", 3))
+      return HttpRequest::PUT;
+    break;
+  case 4:
+    if (!qstrncmp(s, "POST", 4))
+      return HttpRequest::POST;
+    if (!qstrncmp(s, "HEAD", 4))
+      return HttpRequest::HEAD;
+    break;
+  case 6:
+    if (!qstrncmp(s, "DELETE", 6))
+      return HttpRequest::DELETE;
+    break;
+  case 7:
+    if (!qstrncmp(s, "OPTIONS", 7))
+      return HttpRequest::OPTIONS;
+    break;
+  }
+  return HttpRequest::NONE;
+}
+
+static inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+HttpRequest::HeadStatus HttpRequest::readHead(int maxLineSize) {
+  if (!d || !d->_input)
+    return BadRequestLine;
+  while (!d->_headComplete) {
+    if (!d->_input->canReadLine()) {
+      if (d->_input->bytesAvailable() > maxLineSize) {
+        // the line is not read, only peek at its beginning so that
+        // rawRequestLine() and lastHeadLine() can tell what it is
+        d->_lastLineBegin = d->_head.size();
+        d->_head.append(d->_input->peek(TOO_LONG_LINE_PEEK_SIZE));
+        return d->_requestLineRead ? HeaderLineTooLong : RequestLineTooLong;
+      }
+      return HeadIncomplete;
+    }
+    // read the line directly at the end of the request buffer
+    int begin = d->_head.size();
+    d->_lastLineBegin = begin;
+    qint64 room = qMin(d->_input->bytesAvailable(), qint64(maxLineSize)+2);
+    d->_head.resize(begin+int(room)+1);
+    qint64 n = d->_input->readLine(d->_head.data()+begin, room+1);
+    if (n < 0)
+      n = 0;
+    d->_head.resize(begin+int(n));
+    int end = begin+int(n);
+    const char *p = d->_head.constData();
+    while (end > begin && isBlank(p[end-1]))
+      --end;
+    if (end-begin > maxLineSize)
+      return d->_requestLineRead ? HeaderLineTooLong : RequestLineTooLong;
+    if (!d->_requestLineRead) {
+      d->_requestLineRead = true;
+      d->_requestLineLength = end;
+      // method SP uri SP protocol, with any number of blanks
+      int tokens[3][2], count = 0, i = begin;
+      while (i < end) {
+        while (i < end && isBlank(p[i]))
+          ++i;
+        if (i >= end)
+          break;
+        if (count == 3)
+          return BadRequestLine;
+        tokens[count][0] = i;
+        while (i < end && !isBlank(p[i]))
+          ++i;
+        tokens[count++][1] = i;
+      }
+      if (count != 3)
+        return BadRequestLine;
+      d->_method = methodFromBytes(p+tokens[0][0], tokens[0][1]-tokens[0][0]);
+      d->_uriBegin = tokens[1][0];
+      d->_uriLength = tokens[1][1]-tokens[1][0];
+      if (tokens[2][1]-tokens[2][0] < 5 || qstrncmp(p+tokens[2][0], "HTTP/", 5))
+        return BadRequestProtocol;
+      continue;
+    }
+    if (end == begin) {
+      d->_headComplete = true;
+      break;
+    }
+    // LATER: handle multi line headers
+    if (!parseHeaderLine(begin, end))
+      return BadHeaderLine;
+  }
+  return HeadComplete;
+}
+
+bool HttpRequest::parseHeaderLine(int begin, int end) {
+  const char *p = d->_head.constData();
+  int colon = begin;
+  while (colon < end && p[colon] != ':')
+    ++colon;
+  if (colon == end)
     return false;
+  int nameBegin = begin, nameEnd = colon, valueBegin = colon+1, valueEnd = end;
   // MAYDO remove special chars from keys and values?
-  // TODO support multi-line headers
-  QString key = StringUtils::normalizeRfc841HeaderCase(
-              rawHeader.left(i).trimmed());
-  QString value = rawHeader.right(rawHeader.size()-i-1).trimmed();
-  //qDebug() << "header:" << rawHeader << key << value;
-  d->_headers.insert(key, value);
-  if (key.compare("Cookie", Qt::CaseInsensitive) == 0)
-    parseAndAddCookie(value);
+  while (nameBegin < nameEnd && isBlank(p[nameBegin]))
+    ++nameBegin;
+  while (nameEnd > nameBegin && isBlank(p[nameEnd-1]))
+    --nameEnd;
+  while (valueBegin < valueEnd && isBlank(p[valueBegin]))
+    ++valueBegin;
+  while (valueEnd > valueBegin && isBlank(p[valueEnd-1]))
+    --valueEnd;
+  if (nameEnd == nameBegin)
+    return false;
+  int index = d->_headerRefs.size();
+  d->_headerRefs.append({ nameBegin, nameEnd-nameBegin, valueBegin,
+                          valueEnd-valueBegin });
+  int slot = wellKnownHeaderSlot(p+nameBegin, nameEnd-nameBegin);
+  if (slot >= 0)
+    d->_wellKnownHeaders[slot] = qint16(qMin(index, 32767));
+  d->_headersHashBuilt = false;
+  d->_cookiesParsed = false;
   return true;
 }
 
+bool HttpRequest::parseAndAddHeader(QString rawHeader) {
+  if (!d)
+    return false;
+  int begin = d->_head.size();
+  d->_head.append(rawHeader.toUtf8());
+  return parseHeaderLine(begin, d->_head.size());
+}
+
+QByteArray HttpRequest::rawUri() const {
+  return d ? d->_head.mid(d->_uriBegin, d->_uriLength) : QByteArray();
+}
+
+QByteArray HttpRequest::lastHeadLine() const {
+  return d ? d->_head.mid(d->_lastLineBegin).trimmed() : QByteArray();
+}
+
+QByteArray HttpRequest::rawRequestLine() const {
+  if (!d)
+    return QByteArray();
+  return d->_requestLineRead ? d->_head.left(d->_requestLineLength)
+                             : d->_head;
+}
+
+int HttpRequest::lastHeaderIndex(const char *name, int length) const {
+  int slot = wellKnownHeaderSlot(name, length);
+  if (slot >= 0 && d->_headerRefs.size() <= 32767)
+    return d->_wellKnownHeaders[slot];
+  const char *p = d->_head.constData();
+  for (int i = d->_headerRefs.size()-1; i >= 0; --i) {
+    const HttpRequestData::HeaderRef &ref = d->_headerRefs[i];
+    if (ref._nameLength == length && !qstrnicmp(p+ref._nameBegin, name,
+                                                uint(length)))
+      return i;
+  }
+  return -1;
+}
+
 // TODO use QRegularExpression instead, but not without regression/unit testing
 static const QRegExp cookieHeaderValue(
       "\\s*;?\\s*(" RFC2616_TOKEN_OCTET_RE "*)\\s*=\\s*(("
       RFC6265_COOKIE_OCTET_RE "*|\"" RFC6265_COOKIE_OCTET_RE
       "+\"))\\s*;?\\s*");
 
-void HttpRequest::parseAndAddCookie(QString rawHeaderValue) {
+void HttpRequest::parseCookies() const {
+  if (d->_cookiesParsed)
+    return;
+  d->_cookiesParsed = true;
+  d->_cookies.clear();
+  QStringList values = headers(QStringLiteral("Cookie"));
+  // headers() returns last occurrence first, parse in header order
+  for (int i = values.size()-1; i >= 0; --i)
+    parseAndAddCookie(values[i]);
+}
+
+void HttpRequest::parseAndAddCookie(QString rawHeaderValue) const {
   // LATER use QNetworkCookie::parseCookies
   // LATER ensure that utf8 is supported as specified in RFC6265
   if (!d)
@@ -161,9 +373,10 @@ HttpRequest::operator QString() const {
   QString s;
   QTextStream ts(&s, QIODevice::WriteOnly);
   ts << "HttpRequest{ " << methodName() << ", " << url().toString() << ", { ";
-  foreach (QString key, d->_headers.keys()) {
+  QMultiHash<QString,QString> headers = this->headers();
+  foreach (QString key, headers.uniqueKeys()) {
     ts << key << ":{ ";
-    foreach (QString value, d->_headers.values(key)) {
+    foreach (QString value, headers.values(key)) {
       ts << value << " ";
     }
     ts << "} ";
@@ -201,25 +414,54 @@ HttpRequest::HttpRequestMethod HttpRequest::method() const {
 }
 
 QString HttpRequest::header(QString name, QString defaultValue) const {
-  // LATER handle case insensitivity in header names
   if (!d)
     return defaultValue;
-  const QString v = d->_headers.value(name);
-  return v.isNull() ? defaultValue : v;
+  QByteArray key = name.toLatin1();
+  int i = lastHeaderIndex(key.constData(), key.size());
+  if (i < 0)
+    return defaultValue;
+  const HttpRequestData::HeaderRef &ref = d->_headerRefs[i];
+  // converting only values that are actually read
+  return QString::fromUtf8(d->_head.constData()+ref._valueBegin,
+                           ref._valueLength);
 }
 
 QStringList HttpRequest::headers(QString name) const {
-  // LATER handle case insensitivity in header names
-  return d ? d->_headers.values(name) : QStringList();
+  QStringList values;
+  if (!d)
+    return values;
+  QByteArray key = name.toLatin1();
+  const char *p = d->_head.constData();
+  for (int i = d->_headerRefs.size()-1; i >= 0; --i) {
+    const HttpRequestData::HeaderRef &ref = d->_headerRefs[i];
+    if (ref._nameLength == key.size()
+        && !qstrnicmp(p+ref._nameBegin, key.constData(), uint(key.size())))
+      values.append(QString::fromUtf8(p+ref._valueBegin, ref._valueLength));
+  }
+  return values;
 }
 
 QMultiHash<QString, QString> HttpRequest::headers() const {
-  return d ? d->_headers : QMultiHash<QString,QString>();
+  if (!d)
+    return QMultiHash<QString,QString>();
+  if (!d->_headersHashBuilt) {
+    d->_headers.clear();
+    const char *p = d->_head.constData();
+    foreach (const HttpRequestData::HeaderRef &ref, d->_headerRefs)
+      d->_headers.insert(StringUtils::normalizeRfc841HeaderCase(
+                           QString::fromLatin1(p+ref._nameBegin,
+                                               ref._nameLength)),
+                         QString::fromUtf8(p+ref._valueBegin,
+                                           ref._valueLength));
+    d->_headersHashBuilt = true;
+  }
+  return d->_headers;
 }
 
 QString HttpRequest::cookie(QString name, QString defaultValue) const {
   if (!d)
     return defaultValue;
+  parseCookies();
   const QString v = d->_cookies.value(name);
   return v.isNull() ? defaultValue : v;
 }
@@ -227,6 +469,7 @@ QString HttpRequest::cookie(QString name, QString defaultValue) const {
 QString HttpRequest::base64Cookie(QString name, QString defaultValue) const {
   if (!d)
     return defaultValue;
+  parseCookies();
   const QString v = d->_cookies.value(name);
   return v.isNull() ? defaultValue
                     : QString::fromUtf8(QByteArray::fromBase64(v.toLatin1()));
@@ -236,6 +479,7 @@ QByteArray HttpRequest::base64BinaryCookie(QString name,
                                            QByteArray defaultValue) const {
   if (!d)
     return defaultValue;
+  parseCookies();
   const QString v = d->_cookies.value(name);
   return v.isNull() ? defaultValue
                     : QByteArray::fromBase64(cookie(name).toLatin1());
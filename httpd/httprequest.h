@@ -35,6 +35,9 @@ class LIBPUMPKINSHARED_EXPORT HttpRequest {
 public:
   enum HttpRequestMethod { NONE = 0, HEAD = 1, GET = 2, POST = 4, PUT = 8,
                            DELETE = 16, OPTIONS = 32, ANY = 0x7fff} ;
+  enum HeadStatus { HeadIncomplete = 0, HeadComplete, RequestLineTooLong,
+                    BadRequestLine, BadRequestProtocol, HeaderLineTooLong,
+                    BadHeaderLine };
 
 private:
   QExplicitlySharedDataPointer<HttpRequestData> d;
@@ -55,13 +58,29 @@ public:
   /** @return enum from protocol and human readable string, e.g. "GET"
    * @param name case sensitive, must be upper case */
   static HttpRequestMethod methodFromText(QString name);
+  /** Read request line and headers from input(), as far as complete lines
+   * are available, and parse them in place: lines are appended to a single
+   * request buffer and headers are only stored as offsets within it.
+   * Sets method() when request line is read.
+   * Must be called again when more data is available, until it returns
+   * something else than HeadIncomplete. */
+  HeadStatus readHead(int maxLineSize);
+  /** Request URI as found in request line, once parsed by readHead(). */
+  QByteArray rawUri() const;
+  /** Request line, or what was read of it, for diagnostics. */
+  QByteArray rawRequestLine() const;
+  /** Last line read by readHead(), for diagnostics. */
+  QByteArray lastHeadLine() const;
   bool parseAndAddHeader(QString rawHeader);
   /** Value associated to a request header.
+   * Header names are case insensitive.
    * If the header is found several time, last value is returned. */
   QString header(QString name, QString defaultValue = QString()) const;
-  /** Values associated to a request header, last occurrence first. */
+  /** Values associated to a request header, last occurrence first.
+   * Header names are case insensitive. */
   QStringList headers(QString name) const;
-  /** Full header hash */
+  /** Full header hash, with normalized header names case.
+   * Built on first call, prefer header() and headers(name). */
   QMultiHash<QString,QString> headers() const;
   /* Value of a given cookie, as is. */
   QString cookie(QString name, QString defaultValue = QString()) const;
@@ -102,7 +121,10 @@ public:
   // LATER handle sessions
 
 private:
-  inline void parseAndAddCookie(QString rawHeaderValue);
+  inline void parseAndAddCookie(QString rawHeaderValue) const;
+  inline void parseCookies() const;
+  inline bool parseHeaderLine(int begin, int end);
+  inline int lastHeaderIndex(const char *name, int length) const;
   inline void cacheAllParams() const;
 };
 
@@ -12,7 +12,6 @@
  * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "httpresponse.h"
-#include <QTextStream>
 #include "httpcommon.h"
 #include <QRegExp>
 #include "log/log.h"
@@ -20,18 +19,162 @@
 #include <QMultiHash>
 #include "format/timeformats.h"
 #include "io/dummysocket.h"
+#include "httpencodingsocket.h"
+#include "httpcompression.h"
+#include <QVector>
+#include <QHash>
+#include <QLocale>
+#include <climits>
+
+namespace {
+
+class WellKnownHeader {
+public:
+  QString _name;
+  QByteArray _encoded; // "Name: "
+};
+
+}
+
+// header names whose serialized form is pre-encoded, the two first ones have
+// a default value and are referenced by index below
+static const WellKnownHeader _wellKnownHeaders[] {
+  { "Content-Type", "Content-Type: " },
+  { "Date", "Date: " },
+  { "Content-Length", "Content-Length: " },
+  { "Set-Cookie", "Set-Cookie: " },
+  { "Location", "Location: " },
+  { "Cache-Control", "Cache-Control: " },
+  { "Last-Modified", "Last-Modified: " },
+  { "Content-Encoding", "Content-Encoding: " },
+  { "Transfer-Encoding", "Transfer-Encoding: " },
+  { "ETag", "ETag: " },
+  { "Expires", "Expires: " },
+  { "WWW-Authenticate", "WWW-Authenticate: " },
+  { "Access-Control-Allow-Origin", "Access-Control-Allow-Origin: " },
+  { "Access-Control-Allow-Methods", "Access-Control-Allow-Methods: " },
+  { "Access-Control-Allow-Headers", "Access-Control-Allow-Headers: " },
+  { "Vary", "Vary: " },
+};
+static const int _contentTypeHeader = 0, _dateHeader = 1;
+static const int _wellKnownHeadersCount =
+    sizeof _wellKnownHeaders / sizeof _wellKnownHeaders[0];
+
+static int wellKnownHeaderIndex(const QString &name) {
+  for (int i = 0; i < _wellKnownHeadersCount; ++i) {
+    const QString &candidate = _wellKnownHeaders[i]._name;
+    if (candidate.size() == name.size()
+        && !candidate.compare(name, Qt::CaseInsensitive))
+      return i;
+  }
+  return -1;
+}
 
 class HttpResponseData : public QSharedData {
 public:
+  class Header {
+  public:
+    QString _name, _value;
+    int _wellKnown; // index in _wellKnownHeaders or -1
+  };
   QAbstractSocket *_output;
+  HttpEncodingSocket *_encoder; // 0 when body is written as is
   int _status;
-  bool _headersSent, _disableBodyOutput;
-  QMultiHash<QString,QString> _headers;
+  bool _headersSent, _disableBodyOutput, _chunkedAllowed, _chunked;
+  QVector<Header> _headers; // in insertion order
+  QString _acceptEncoding;
+  QByteArray _trailers;
   explicit HttpResponseData(QAbstractSocket *output)
-    : _output(output), _status(200), _headersSent(false),
-      _disableBodyOutput(false) { }
+    : _output(output), _encoder(0), _status(200), _headersSent(false),
+      _disableBodyOutput(false), _chunkedAllowed(false), _chunked(false) { }
+  ~HttpResponseData() { delete _encoder; }
+  void removeHeaders(const QString &name, int wellKnown) {
+    for (int i = _headers.size()-1; i >= 0; --i) {
+      const Header &h = _headers[i];
+      if (wellKnown >= 0 ? h._wellKnown == wellKnown
+                         : h._name.compare(name, Qt::CaseInsensitive) == 0)
+        _headers.remove(i);
+    }
+  }
+  /** Add token to Vary header, appending it to existing value if any. */
+  void addVaryToken(const QString &token) {
+    static const int vary = wellKnownHeaderIndex(QStringLiteral("Vary"));
+    int last = -1;
+    for (int i = 0; i < _headers.size(); ++i) {
+      if (_headers[i]._wellKnown != vary)
+        continue;
+      last = i;
+      foreach (const QString &item, _headers[i]._value.split(',')) {
+        QString t = item.trimmed();
+        if (t == "*" || !t.compare(token, Qt::CaseInsensitive))
+          return; // already listed
+      }
+    }
+    if (last < 0)
+      _headers.append({ QStringLiteral("Vary"), token, vary });
+    else if (_headers[last]._value.trimmed().isEmpty())
+      _headers[last]._value = token;
+    else
+      _headers[last]._value += ", "+token;
+  }
+  int lastHeaderIndex(const QString &name) const {
+    int wellKnown = wellKnownHeaderIndex(name);
+    for (int i = _headers.size()-1; i >= 0; --i) {
+      const Header &h = _headers[i];
+      if (wellKnown >= 0 ? h._wellKnown == wellKnown
+                         : h._name.compare(name, Qt::CaseInsensitive) == 0)
+        return i;
+    }
+    return -1;
+  }
+};
+
+namespace {
+
+struct DateHeaderCache {
+  qint64 _second = LLONG_MIN;
+  QByteArray _line;
+};
+
+}
+
+/** "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n", computed once per second */
+static const QByteArray &dateHeaderLine() {
+  static thread_local DateHeaderCache cache;
+  qint64 second = QDateTime::currentMSecsSinceEpoch()/1000;
+  if (second != cache._second) {
+    cache._line = _wellKnownHeaders[_dateHeader]._encoded
+        + QLocale::c().toString(QDateTime::fromMSecsSinceEpoch(
+                                  second*1000, Qt::UTC),
+                                QStringLiteral("ddd, dd MMM yyyy hh:mm:ss"))
+          .toLatin1()
+        + " GMT\r\n";
+    cache._second = second;
+  }
+  return cache._line;
+}
+
+static const int _preEncodedStatuses[] {
+  200, 201, 202, 300, 301, 302, 303, 304, 305, 306, 307, 308, 400, 401, 402,
+  403, 404, 405, 408, 413, 414, 415, 418, 500, 501
 };
 
+/** "HTTP/1.1 200 Ok\r\n" */
+static QByteArray statusLine(int status) {
+  static const QHash<int,QByteArray> lines = []() {
+    QHash<int,QByteArray> lines;
+    for (int status : _preEncodedStatuses)
+      lines.insert(status, "HTTP/1.1 "+QByteArray::number(status)+" "
+                   +HttpResponse::statusAsString(status).toLatin1()+"\r\n");
+    return lines;
+  }();
+  QByteArray line = lines.value(status);
+  if (line.isNull())
+    line = "HTTP/1.1 "+QByteArray::number(status)+" "
+        +HttpResponse::statusAsString(status).toLatin1()+"\r\n";
+  return line;
+}
+
 HttpResponse::HttpResponse(QAbstractSocket *output)
   : d(new HttpResponseData(output)) {
 }
@@ -56,26 +199,122 @@ void HttpResponse::disableBodyOutput() {
     d->_disableBodyOutput = true;
 }
 
+void HttpResponse::setAcceptedEncodings(QString acceptEncoding) {
+  if (d)
+    d->_acceptEncoding = acceptEncoding;
+}
+
+void HttpResponse::setChunkedEncodingAllowed(bool allowed) {
+  if (d)
+    d->_chunkedAllowed = allowed;
+}
+
+bool HttpResponse::isChunked() const {
+  return d && d->_chunked;
+}
+
+void HttpResponse::addTrailer(QString name, QString value) {
+  if (!d)
+    return;
+  if (d->_headersSent && !d->_chunked) {
+    Log::debug() << "HttpResponse: ignoring trailer since response is not "
+                    "chunked: " << name;
+    return;
+  }
+  d->_trailers.append(name.toLatin1()).append(": ").append(value.toUtf8())
+      .append("\r\n");
+}
+
+bool HttpResponse::negotiateCompression() {
+  QString contentType = header(QStringLiteral("Content-Type"),
+                               QStringLiteral("text/plain;charset=UTF-8"));
+  if (!HttpCompression::isEnabled()
+      || !HttpCompression::isCompressibleContentType(contentType))
+    return false;
+  // caches must know that body depends on Accept-Encoding, even if Vary
+  // already lists other headers, e.g. Origin for CORS
+  d->addVaryToken(QStringLiteral("Accept-Encoding"));
+  if ((d->_status >= 100 && d->_status < 200) || d->_status == 204
+      || d->_status == 304
+      || !header(QStringLiteral("Content-Encoding")).isNull()
+      || !HttpCompression::acceptsGzip(d->_acceptEncoding))
+    return false;
+  bool ok;
+  qint64 length = header(QStringLiteral("Content-Length")).toLongLong(&ok);
+  if (ok && length < HttpCompression::minimumSize())
+    return false;
+  // compressed length is unknown, body ends when the connection is closed
+  d->removeHeaders(QStringLiteral("Content-Length"),
+                   wellKnownHeaderIndex(QStringLiteral("Content-Length")));
+  addHeader(QStringLiteral("Content-Encoding"), QStringLiteral("gzip"));
+  return true;
+}
+
 QAbstractSocket *HttpResponse::output() {
   if (!d)
     return DummySocket::singletonInstance();
   if (!d->_headersSent) {
-    QTextStream ts(d->_output);
-    ts << "HTTP/1.1 " << d->_status << " " << statusAsString(d->_status)
-       << "\r\n";
+    bool compress = negotiateCompression();
+    // stream body using chunks unless its length is known in advance
+    d->_chunked = d->_chunkedAllowed
+        && d->_status >= 200 && d->_status != 204 && d->_status != 304
+        && header(QStringLiteral("Content-Length")).isNull()
+        && header(QStringLiteral("Transfer-Encoding")).isNull();
+    if (d->_chunked)
+      addHeader(QStringLiteral("Transfer-Encoding"), QStringLiteral("chunked"));
+    // whole header block is written at once, the socket write buffer then
+    // sends it along with the beginning of the body
+    QByteArray block = statusLine(d->_status);
+    block.reserve(512);
+    bool hasContentType = false, hasDate = false;
     // LATER sanitize well-known headers (Content-Type...) values
     // LATER handle multi-line headers and special chars
-    foreach (QString name, QSet<QString>(d->_headers.keys().begin(),
-                                         d->_headers.keys().end()))
-      foreach (QString value, d->_headers.values(name))
-        ts << name << ": " << value << "\r\n";
-    if (header(QStringLiteral("Content-Type")).isEmpty())
-      ts << "Content-Type: text/plain;charset=UTF-8\r\n";
-    ts << "Connection: close\r\n";
-    ts << "\r\n";
+    foreach (const HttpResponseData::Header &h, d->_headers) {
+      if (h._wellKnown >= 0) {
+        block.append(_wellKnownHeaders[h._wellKnown]._encoded);
+        hasContentType |= h._wellKnown == _contentTypeHeader;
+        hasDate |= h._wellKnown == _dateHeader;
+      } else {
+        block.append(h._name.toLatin1()).append(": ");
+      }
+      block.append(h._value.toUtf8()).append("\r\n");
+    }
+    if (!hasContentType)
+      block.append("Content-Type: text/plain;charset=UTF-8\r\n");
+    if (!hasDate)
+      block.append(dateHeaderLine());
+    block.append("Connection: close\r\n\r\n");
+    d->_output->write(block);
     d->_headersSent = true;
+    if ((compress || d->_chunked) && !d->_disableBodyOutput) {
+      d->_encoder = new HttpEncodingSocket(d->_output);
+      if (compress && !d->_encoder->enableGzip(HttpCompression::level()))
+        Log::error() << "HttpResponse: cannot initialize gzip compression";
+      if (d->_chunked)
+        d->_encoder->enableChunking();
+    }
   }
-  return d->_disableBodyOutput ? DummySocket::singletonInstance() : d->_output;
+  if (d->_disableBodyOutput)
+    return DummySocket::singletonInstance();
+  return d->_encoder ? d->_encoder : d->_output;
+}
+
+void HttpResponse::finish() {
+  if (!d)
+    return;
+  output(); // ensures that headers were sent
+  if (d->_encoder)
+    d->_encoder->finish(d->_trailers);
+  d->_output->flush();
+}
+
+void HttpResponse::flush() {
+  if (!d)
+    return;
+  output(); // ensures that headers were sent
+  if (d->_encoder)
+    d->_encoder->flushPending();
+  d->_output->flush();
 }
 
 void HttpResponse::setStatus(int status) {
@@ -90,17 +329,24 @@ int HttpResponse::status() const {
 }
 
 void HttpResponse::setHeader(QString name, QString value) {
-  // LATER handle case insensitivity in header names
   if (d && !d->_headersSent) {
-    d->_headers.replace(name, value);
+    int wellKnown = wellKnownHeaderIndex(name);
+    d->removeHeaders(name, wellKnown);
+    d->_headers.append({ name, value, wellKnown });
   } else
     Log::warning() << "HttpResponse: cannot set header after writing data";
 }
 
 void HttpResponse::addHeader(QString name, QString value) {
-  // LATER handle case insensitivity in header names
   if (d && !d->_headersSent) {
-    d->_headers.insert(name, value);
+    d->_headers.append({ name, value, wellKnownHeaderIndex(name) });
+  } else
+    Log::warning() << "HttpResponse: cannot set header after writing data";
+}
+
+void HttpResponse::addVaryToken(QString token) {
+  if (d && !d->_headersSent) {
+    d->addVaryToken(token);
   } else
     Log::warning() << "HttpResponse: cannot set header after writing data";
 }
@@ -170,20 +416,30 @@ void HttpResponse::setCookie(QString name, QString value,
 }
 
 QString HttpResponse::header(QString name, QString defaultValue) const {
-  // LATER handle case insensitivity in header names
   if (!d)
     return defaultValue;
-  const QString v = d->_headers.value(name);
-  return v.isNull() ? defaultValue : v;
+  int i = d->lastHeaderIndex(name);
+  return i < 0 ? defaultValue : d->_headers[i]._value;
 }
 
 QStringList HttpResponse::headers(QString name) const {
-  // LATER handle case insensitivity in header names
-  return d ? d->_headers.values(name) : QStringList();
+  QStringList values;
+  if (!d)
+    return values;
+  for (int i = d->_headers.size()-1; i >= 0; --i) {
+    const HttpResponseData::Header &h = d->_headers[i];
+    if (h._name.compare(name, Qt::CaseInsensitive) == 0)
+      values.append(h._value);
+  }
+  return values;
 }
 
 QMultiHash<QString,QString> HttpResponse::headers() const {
-  return d ? d->_headers : QMultiHash<QString,QString>();
+  QMultiHash<QString,QString> headers;
+  if (d)
+    foreach (const HttpResponseData::Header &h, d->_headers)
+      headers.insert(h._name, h._value);
+  return headers;
 }
 
 QString HttpResponse::statusAsString(int status) {
@@ -99,8 +99,36 @@ public:
   ~HttpResponse();
   HttpResponse &operator=(const HttpResponse &other);
   /** Get the output to write content; calling this method triggers sending
-    * the response status and headers. */
+    * the response status and headers.
+    * When the body is compressed, the returned socket is a facade that
+    * encodes data before writing it to the actual client socket. */
   QAbstractSocket *output();
+  /** Terminate the response: send headers if not yet done and write any
+   * pending encoded data. Called by HttpWorker after the handler returns. */
+  void finish();
+  /** Send what was written to output() so far to the client without waiting
+   * for more data, e.g. to lower time to first byte of a long page.
+   * Not needed for large bodies, which are sent by chunks anyway. */
+  void flush();
+  /** Allow chunked transfer encoding (i.e. client is HTTP/1.1).
+   * Called by HttpWorker before the handler is called.
+   * When allowed, any response whose Content-Length is not set before
+   * output() is called is streamed using chunks, which lets handlers write
+   * arbitrarily large bodies without knowing their length in advance. */
+  void setChunkedEncodingAllowed(bool allowed);
+  /** True iff body is sent using chunked transfer encoding.
+   * Only meaningful once output() was called. */
+  bool isChunked() const;
+  /** Append a trailer (a header sent after the body), e.g. a checksum
+   * computed while streaming the body.
+   * Trailers are only sent with chunked transfer encoding and are otherwise
+   * ignored. */
+  void addTrailer(QString name, QString value);
+  /** Set request's Accept-Encoding header value, to enable transparent gzip
+   * compression of the body when the client supports it.
+   * Called by HttpWorker before the handler is called.
+   * @see HttpCompression */
+  void setAcceptedEncodings(QString acceptEncoding);
   /** Further calls to output() will return a dummy socket to disable sending
    * data to the client. This method is only intended to be called by HttpWorker
    * when processing a HEAD request, to disable naive HttpHandlers from sending
@@ -120,17 +148,22 @@ public:
   /** Current http status, as set by last setStatus() call */
   int status() const;
   /** Replace any header of this name by one header with this value.
+   * Header names are case insensitive.
    * Must be called before output(). */
   void setHeader(QString name, QString value);
   /** Append a header regardless one already exists with the same name.
    * Must be called before output(). */
   void addHeader(QString name, QString value);
+  /** Add a token to Vary header, e.g. "Accept-Encoding", keeping tokens that
+   * are already listed, e.g. "Origin" for CORS.
+   * Must be called before output(). */
+  void addVaryToken(QString token);
   /** Value associated to a response header.
    * If the header is found several time, last value is returned. */
   QString header(QString name, QString defaultValue = QString()) const;
   /** Values associated to a response header, last occurrence first. */
   QStringList headers(QString name) const;
-  /** Full header hash */
+  /** Full header hash, with names as they were set */
   QMultiHash<QString,QString> headers() const;
   /** Redirect to another URL, by default using a temporary redirect (302).
    * Must be called before output(). */
@@ -259,6 +292,8 @@ public:
 private:
   void setCookie(QString name, QString value, QDateTime expires, QString path,
                  QString domain, bool secure, bool httponly);
+  /** Decide whether body will be gzipped, and set headers accordingly. */
+  bool negotiateCompression();
 };
 
 #endif // HTTPRESPONSE_H
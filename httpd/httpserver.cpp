@@ -17,16 +17,87 @@
 #include "log/log.h"
 #include <unistd.h>
 #include "pipelinehttphandler.h"
+#include "thread/workerpool.h"
+#include <QTcpSocket>
+#include "util/radixtree.h"
+#include <QMap>
+#include <algorithm>
+
+/** Immutable snapshot of handlers, used by chooseHandler() without lock. */
+class HttpRoutingTable {
+public:
+  class Entry {
+  public:
+    int _index; // handler rank in HttpServer::_handlers
+    HttpHandler *_handler;
+    int _methods;
+    bool operator<(const Entry &that) const { return _index < that._index; }
+  };
+  // every prefix is associated with entries of all prefixes that are its
+  // own prefixes, so that longest prefix match gives every candidate
+  RadixTree<QVector<Entry>> _prefixes;
+  QVector<Entry> _catchAll; // static routes with empty prefix
+  QVector<Entry> _dynamic; // handlers without static routes
+  explicit HttpRoutingTable(QList<HttpHandler*> handlers);
+  HttpHandler *chooseHandler(HttpRequest req) const;
+};
+
+HttpRoutingTable::HttpRoutingTable(QList<HttpHandler*> handlers) {
+  QMap<QString,QVector<Entry>> byPrefix;
+  for (int i = 0; i < handlers.size(); ++i) {
+    HttpHandler *handler = handlers[i];
+    QList<HttpHandler::StaticRoute> routes = handler->staticRoutes();
+    if (routes.isEmpty()) {
+      _dynamic.append({ i, handler, HttpRequest::ANY });
+      continue;
+    }
+    foreach (const HttpHandler::StaticRoute &route, routes) {
+      if (route._pathPrefix.isEmpty())
+        _catchAll.append({ i, handler, route._methods });
+      else
+        byPrefix[route._pathPrefix].append({ i, handler, route._methods });
+    }
+  }
+  std::sort(_catchAll.begin(), _catchAll.end());
+  for (auto it = byPrefix.constBegin(); it != byPrefix.constEnd(); ++it) {
+    QVector<Entry> entries = _catchAll;
+    // QMap is sorted, hence shorter prefixes of a key come before it
+    for (auto jt = byPrefix.constBegin(); jt != it; ++jt)
+      if (it.key().startsWith(jt.key()))
+        entries += jt.value();
+    entries += it.value();
+    std::stable_sort(entries.begin(), entries.end());
+    _prefixes.insert(it.key(), entries, true);
+  }
+}
+
+HttpHandler *HttpRoutingTable::chooseHandler(HttpRequest req) const {
+  QByteArray path = req.url().path().toUtf8();
+  const QVector<Entry> candidates = _prefixes.value(path.constData(),
+                                                    _catchAll);
+  int method = req.method(), i = 0;
+  foreach (const Entry &candidate, candidates) {
+    if (!(candidate._methods & method))
+      continue;
+    // dynamic handlers registered before the static match still have priority
+    for (; i < _dynamic.size() && _dynamic[i]._index < candidate._index; ++i)
+      if (_dynamic[i]._handler->acceptRequest(req))
+        return _dynamic[i]._handler;
+    return candidate._handler;
+  }
+  for (; i < _dynamic.size(); ++i)
+    if (_dynamic[i]._handler->acceptRequest(req))
+      return _dynamic[i]._handler;
+  return 0;
+}
 
 HttpServer::HttpServer(int workersPoolSize, int maxQueuedSockets,
                        QObject *parent)
-  : QTcpServer(parent), _defaultHandler(0), _maxQueuedSockets(maxQueuedSockets),
-    _thread(new QThread()) {
-  _thread->setObjectName("HttpServer");
-  connect(this, &HttpServer::destroyed, _thread, &QThread::quit);
-  connect(_thread, &QThread::finished, _thread, &QThread::deleteLater);
-  _thread->start();
-  _defaultHandler = new PipelineHttpHandler(this);
+  : QTcpServer(parent),
+    _routing(new HttpRoutingTable(QList<HttpHandler*>())), _defaultHandler(0),
+    _maxQueuedSockets(maxQueuedSockets), _thread(new QThread()), _pool(0),
+    _inFlight(0) {
+  startThread();
   for (int i = 0; i < workersPoolSize; ++i) {
     HttpWorker *worker = new HttpWorker(this);
     // cannot make workers become children, and cannot rely on _workersPool to
@@ -38,13 +109,36 @@ HttpServer::HttpServer(int workersPoolSize, int maxQueuedSockets,
   moveToThread(_thread);
 }
 
+HttpServer::HttpServer(WorkerPool *pool, int maxQueuedSockets, QObject *parent)
+  : QTcpServer(parent),
+    _routing(new HttpRoutingTable(QList<HttpHandler*>())), _defaultHandler(0),
+    _maxQueuedSockets(maxQueuedSockets), _thread(new QThread()), _pool(pool),
+    _inFlight(0) {
+  startThread();
+  moveToThread(_thread);
+}
+
+void HttpServer::startThread() {
+  _thread->setObjectName("HttpServer");
+  connect(this, &HttpServer::destroyed, _thread, &QThread::quit);
+  connect(_thread, &QThread::finished, _thread, &QThread::deleteLater);
+  _thread->start();
+  _defaultHandler = new PipelineHttpHandler(this);
+}
+
 HttpServer::~HttpServer() {
+  // pool tasks use this, therefore wait for them
+  QMutexLocker ml(&_inFlightMutex);
+  while (_inFlight)
+    _inFlightCondition.wait(&_inFlightMutex);
 }
 
 void HttpServer::incomingConnection(qintptr socketDescriptor)  {
   //qDebug()<< "HttpServer::incomingConnection" << socketDescriptor
   //        << QThread::currentThread();
-  if (_workersPool.size() > 0) {
+  if (_pool) {
+    submitConnection(socketDescriptor);
+  } else if (_workersPool.size() > 0) {
     HttpWorker *worker = _workersPool.takeFirst();
     connect(worker, &HttpWorker::connectionHandled,
             this, &HttpServer::connectionHandled);
@@ -62,6 +156,37 @@ void HttpServer::incomingConnection(qintptr socketDescriptor)  {
   }
 }
 
+void HttpServer::submitConnection(qintptr socketDescriptor) {
+  QMutexLocker ml(&_inFlightMutex);
+  if (_inFlight >= _pool->size()+_maxQueuedSockets) {
+    ml.unlock();
+    Log::error() << "too many connections waiting for WorkerPool "
+                 << _pool->name() << ", throwing incoming connection away";
+    ::close(socketDescriptor);
+    return;
+  }
+  ++_inFlight;
+  ml.unlock();
+  bool submitted = _pool->submit([this, socketDescriptor]() {
+    {
+      QTcpSocket socket;
+      if (socket.setSocketDescriptor(socketDescriptor))
+        HttpWorker::serveConnection(this, &socket);
+      else
+        ::close(socketDescriptor);
+    }
+    QMutexLocker ml(&_inFlightMutex);
+    --_inFlight;
+    _inFlightCondition.wakeAll();
+  });
+  if (!submitted) {
+    ::close(socketDescriptor);
+    ml.relock();
+    --_inFlight;
+    _inFlightCondition.wakeAll();
+  }
+}
+
 void HttpServer::connectionHandled(HttpWorker *worker) {
   if (_queuedSockets.isEmpty()) {
     _workersPool.append(worker);
@@ -79,6 +204,9 @@ void HttpServer::appendHandler(HttpHandler *handler) {
   // cannot make handlers become children, hence connecting
   // server's destroyed() to handlers' deleteLater()
   connect(this, &HttpServer::destroyed, handler, &HttpHandler::deleteLater);
+  connect(handler, &HttpHandler::staticRoutesChanged,
+          this, &HttpServer::handlerRoutesChanged, Qt::DirectConnection);
+  rebuildRoutingTable();
 }
 
 void HttpServer::prependHandler(HttpHandler *handler) {
@@ -87,15 +215,26 @@ void HttpServer::prependHandler(HttpHandler *handler) {
   // cannot make handlers become children, hence connecting
   // server's destroyed() to handlers' deleteLater()
   connect(this, &HttpServer::destroyed, handler, &HttpHandler::deleteLater);
+  connect(handler, &HttpHandler::staticRoutesChanged,
+          this, &HttpServer::handlerRoutesChanged, Qt::DirectConnection);
+  rebuildRoutingTable();
 }
 
-HttpHandler *HttpServer::chooseHandler(HttpRequest req) {
+void HttpServer::handlerRoutesChanged() {
   QMutexLocker ml(&_handlersMutex);
-  foreach (HttpHandler *h, _handlers) {
-    if (h->acceptRequest(req))
-      return h;
-  }
-  return _defaultHandler;
+  rebuildRoutingTable();
+}
+
+// must be called with _handlersMutex locked
+void HttpServer::rebuildRoutingTable() {
+  std::atomic_store(&_routing, std::shared_ptr<HttpRoutingTable>(
+                      new HttpRoutingTable(_handlers)));
+}
+
+HttpHandler *HttpServer::chooseHandler(HttpRequest req) {
+  std::shared_ptr<HttpRoutingTable> routing = std::atomic_load(&_routing);
+  HttpHandler *handler = routing->chooseHandler(req);
+  return handler ? handler : _defaultHandler;
 }
 
 bool HttpServer::listen(QHostAddress address, quint16 port) {
@@ -19,22 +19,39 @@
 #include "httphandler.h"
 #include <QMutex>
 #include <QThread>
+#include <QWaitCondition>
+#include <memory>
 
 class HttpWorker;
+class WorkerPool;
+class HttpRoutingTable;
 
 class LIBPUMPKINSHARED_EXPORT HttpServer : public QTcpServer {
   Q_OBJECT
   QMutex _handlersMutex;
   QList<HttpHandler *> _handlers;
+  std::shared_ptr<HttpRoutingTable> _routing;
   HttpHandler *_defaultHandler;
   QList<HttpWorker*> _workersPool;
   QList<int> _queuedSockets;
   int _maxQueuedSockets;
   QThread *_thread;
+  WorkerPool *_pool;
+  QMutex _inFlightMutex;
+  QWaitCondition _inFlightCondition;
+  int _inFlight;
 
 public:
   explicit HttpServer(int workersPoolSize = 16, int maxQueuedSockets = 32,
                       QObject *parent = 0);
+  /** Serve connections using a shared WorkerPool instead of dedicated
+   * HttpWorker threads. The pool must outlive the server.
+   * Since request handling uses blocking I/O, a dedicated pool (e.g.
+   * WorkerPool::pool("http")) is better than the default one.
+   * At most pool->size()+maxQueuedSockets connections are accepted at a
+   * time, others are closed. */
+  explicit HttpServer(WorkerPool *pool, int maxQueuedSockets = 32,
+                      QObject *parent = 0);
   virtual ~HttpServer();
   /** The handler does not become a child of HttpServer but its deleteLater()
    * method is called by ~HttpServer(). */
@@ -42,6 +59,11 @@ public:
   /** The handler does not become a child of HttpServer but its deleteLater()
    * method is called by ~HttpServer(). */
   void prependHandler(HttpHandler *handler);
+  /** Choose first handler, in registration order, that accepts the request.
+   * Lock-free: uses an immutable routing table, rebuilt whenever handlers or
+   * their static routes change, where static routes are looked up in a
+   * prefix tree and acceptRequest() is only called for handlers without
+   * static routes that come before the first static match. */
   HttpHandler *chooseHandler(HttpRequest req);
   bool listen(QHostAddress address = QHostAddress::Any, quint16 port = 0);
   bool listen(quint16 port) { return listen (QHostAddress::Any, port); }
@@ -54,6 +76,10 @@ private slots:
 
 private:
   Q_INVOKABLE bool doListen(QHostAddress address, quint16 port);
+  void startThread();
+  void submitConnection(qintptr socketDescriptor);
+  void handlerRoutesChanged();
+  void rebuildRoutingTable();
   Q_DISABLE_COPY(HttpServer)
 };
 
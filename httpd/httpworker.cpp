@@ -24,7 +24,6 @@
 //#include "stats/statistics.h"
 #include "log/log.h"
 #include <QString>
-#include <QRegularExpression>
 
 #define MAXIMUM_LINE_SIZE 65536
 #define MAXIMUM_ENCODED_FORM_POST_SIZE MAXIMUM_LINE_SIZE
@@ -32,7 +31,6 @@
 #define MAXIMUM_WRITE_WAIT 10000
 
 static QAtomicInt _workersCounter(1);
-static QRegularExpression _requestLineSeparators { "[ \t]+" };
 
 HttpWorker::HttpWorker(HttpServer *server)
   : _server(server), _thread(new QThread()) {
@@ -61,8 +59,17 @@ void HttpWorker::handleConnection(int socketDescriptor) {
     // LATER
     // emit error(_socket->error());
   }
+  serveConnection(_server, socket);
+  socket->deleteLater();
+  emit connectionHandled(this);
+  //long long duration = before.msecsTo(QTime::currentTime());
+  //Statistics::record("server.http.hit", "", url.path(), duration,
+  //                   req.header("Content-Length").toLongLong(), 1, 0, 0,
+  //                   req.param("login"));
+}
+
+void HttpWorker::serveConnection(HttpServer *server, QTcpSocket *socket) {
   socket->setReadBufferSize(MAXIMUM_LINE_SIZE+2);
-  QStringList args;
   HttpRequest req(socket);
   HttpResponse res(socket);
   ParamsProviderMerger processingContext;
@@ -74,66 +81,56 @@ void HttpWorker::handleConnection(int socketDescriptor) {
   QString line;
   qint64 contentLength = 0;
   HttpRequest::HttpRequestMethod method = HttpRequest::NONE;
-  if (!socket->canReadLine() && !socket->waitForReadyRead(MAXIMUM_READ_WAIT)) {
-    sendError(out, "408 Request timeout");
-    goto finally;
+  HttpRequest::HeadStatus status = HttpRequest::HeadIncomplete;
+  // request line and headers are parsed in place within a single buffer
+  while ((status = req.readHead(MAXIMUM_LINE_SIZE))
+         == HttpRequest::HeadIncomplete) {
+    if (!socket->isOpen()) {
+      //qDebug() << "socket is not open";
+      goto finally;
+    }
+    if (!socket->waitForReadyRead(MAXIMUM_READ_WAIT)) {
+      sendError(out, "408 Request timeout");
+      goto finally;
+    }
   }
-  line = socket->readLine(MAXIMUM_LINE_SIZE+2);
-  if (line.size() > MAXIMUM_LINE_SIZE) {
+  switch (status) {
+  case HttpRequest::RequestLineTooLong:
     sendError(out, "414 Request URI too long",
-              "starting with: "+line.left(200));
+              "starting with: "+req.rawRequestLine().left(200));
     goto finally;
-  }
-  line = line.trimmed();
-  args = line.split(_requestLineSeparators);
-  if (args.size() != 3) {
+  case HttpRequest::BadRequestLine:
     sendError(out, "400 Bad request line",
-              "starting with: "+line.left(200));
+              "starting with: "+req.rawRequestLine().left(200));
     goto finally;
+  default:
+    ;
   }
-  method = HttpRequest::methodFromText(args[0]);
-  req.setMethod(method);
+  method = req.method();
   if (method == HttpRequest::HEAD) {
     res.disableBodyOutput();
   } else if (method == HttpRequest::NONE || method == HttpRequest::ANY) {
     sendError(out, "405 Method not allowed",
-              "starting with: "+args[0].left(200));
+              "starting with: "+req.rawRequestLine().left(200));
     goto finally;
   }
-  if (!args[2].startsWith("HTTP/")) {
+  switch (status) {
+  case HttpRequest::BadRequestProtocol:
     sendError(out, "400 Bad request protocol",
-              "starting with: "+args[2].left(200));
+              "starting with: "+req.rawRequestLine().left(200));
     goto finally;
+  case HttpRequest::HeaderLineTooLong:
+    sendError(out, "413 Header line too long",
+              "starting with: "+req.lastHeadLine().left(200));
+    goto finally;
+  case HttpRequest::BadHeaderLine:
+    sendError(out, "400 Bad request header line",
+              "starting with: "+req.lastHeadLine().left(200));
+    goto finally;
+  default:
+    ;
   }
-  for (;;) {
-    if (!socket->isOpen()) {
-      //qDebug() << "socket is not open";
-      break;
-    }
-    if (!socket->canReadLine()
-        && !socket->waitForReadyRead(MAXIMUM_READ_WAIT)) {
-      sendError(out, "408 Request timeout");
-      goto finally;
-    }
-    line = socket->readLine(MAXIMUM_LINE_SIZE+2).trimmed();
-    if (line.size() > MAXIMUM_LINE_SIZE) {
-      sendError(out, "413 Header line too long",
-                "starting with: "+line.left(200));
-      goto finally;
-    }
-    if (line.isEmpty()) {
-      //qDebug() << "line is empty";
-      break;
-    }
-    // LATER: handle multi line headers
-    if (!req.parseAndAddHeader(line)) {
-      sendError(out, "400 Bad request header line",
-                "starting with: "+line.left(200));
-      goto finally;
-    }
-    //qDebug() << "a7";
-  }
-  uri = args[1];
+  uri = QString::fromUtf8(req.rawUri());
   // replacing + with space in URI since this cannot be done in HttpRequest
   // unless QUrl implements a full HTML form encoding (including + for space)
   // in addition to current QUrl::FullyDecoded
@@ -180,14 +177,16 @@ void HttpWorker::handleConnection(int socketDescriptor) {
     foreach (const auto &p, QUrlQuery(url).queryItems(QUrl::FullyDecoded))
       req.overrideParam(p.first, p.second);
   }
-  handler = _server->chooseHandler(req);
+  res.setAcceptedEncodings(req.header(QStringLiteral("Accept-Encoding")));
+  res.setChunkedEncodingAllowed(req.rawRequestLine().endsWith("HTTP/1.1"));
+  handler = server->chooseHandler(req);
   if (req.header(QStringLiteral("Expect")) == QStringLiteral("100-continue")) {
     // LATER only send 100 Continue if the URI is actually accepted by the handler
     out << "HTTP/1.1 100 Continue\r\n\r\n";
     out.flush();
   }
   handler->handleRequest(req, res, &processingContext);
-  res.output()->flush(); // calling output() ensures that header was sent
+  res.finish(); // ensures that header was sent and body fully encoded
   //qDebug() << req;
 finally:
   out.flush();
@@ -196,12 +195,6 @@ finally:
         && socket->waitForBytesWritten(MAXIMUM_WRITE_WAIT))
     ; //qDebug() << "waitForBytesWritten returned true" << socket->bytesToWrite();
   socket->close();
-  socket->deleteLater();
-  emit connectionHandled(this);
-  //long long duration = before.msecsTo(QTime::currentTime());
-  //Statistics::record("server.http.hit", "", url.path(), duration,
-  //                   req.header("Content-Length").toLongLong(), 1, 0, 0,
-  //                   req.param("login"));
   //qDebug() << "served" << (handler ? handler->name() : "default") << "in"
   //    << duration << "ms" << url.path() << req.header("Content-Length")
   //    << req.param("login");
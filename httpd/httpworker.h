@@ -19,6 +19,7 @@
 #include "libp6core_global.h"
 
 class QTcpSocket;
+class HttpServer;
 
 class LIBPUMPKINSHARED_EXPORT HttpWorker : public QObject {
   Q_OBJECT
@@ -29,6 +30,11 @@ class LIBPUMPKINSHARED_EXPORT HttpWorker : public QObject {
 public:
   explicit HttpWorker(HttpServer *server);
 
+  /** Serve an HTTP request on an already connected socket, using blocking
+   * I/O, hence can be called by any thread, event loop or not.
+   * The socket is closed but not deleted. */
+  static void serveConnection(HttpServer *server, QTcpSocket *socket);
+
 public slots:
   void handleConnection(int socketDescriptor);
 
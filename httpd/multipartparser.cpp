@@ -0,0 +1,157 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "multipartparser.h"
+#include <QRegularExpression>
+
+// headers of a part beyond this size are rejected
+#define MAXIMUM_PART_HEADERS_SIZE 16384
+
+static const QRegularExpression _boundaryRE(
+    "^\\s*multipart/[^;]*;(?:.*;)?\\s*boundary=(?:\"([^\"]+)\"|([^;\\s]+))",
+    QRegularExpression::CaseInsensitiveOption);
+static const QRegularExpression _dispositionParamRE(
+    ";\\s*([a-zA-Z*]+)\\s*=\\s*(?:\"((?:[^\"\\\\]|\\\\.)*)\"|([^;\\s]*))");
+
+MultipartParser::MultipartParser(QByteArray boundary)
+  : _delimiter("\r\n--"+boundary), _state(Preamble) {
+  // the first delimiter may be at the very beginning, without CRLF before
+  _buffer.append("\r\n");
+}
+
+QByteArray MultipartParser::boundaryFromContentType(QString contentType) {
+  QRegularExpressionMatch match = _boundaryRE.match(contentType);
+  if (!match.hasMatch())
+    return QByteArray();
+  QString boundary = match.captured(1);
+  if (boundary.isEmpty())
+    boundary = match.captured(2);
+  return boundary.toLatin1();
+}
+
+bool MultipartParser::fail(QString errorString) {
+  _errorString = errorString;
+  _state = Error;
+  return false;
+}
+
+bool MultipartParser::feed(const char *data, int len) {
+  if (_state == Error)
+    return false;
+  if (_state == Epilogue)
+    return true; // ignoring epilogue
+  _buffer.append(data, len);
+  int pos = 0;
+  forever {
+    const char *p = _buffer.constData()+pos;
+    int available = _buffer.size()-pos;
+    switch (_state) {
+    case Preamble:
+    case Body: {
+      int i = _buffer.indexOf(_delimiter, pos);
+      int end = i >= 0 ? i : _buffer.size()-_delimiter.size()+1;
+      // part content that cannot be the beginning of a delimiter
+      if (_state == Body && end > pos && _partData
+          && !_partData(p, end-pos))
+        return fail("interrupted by part data handler");
+      if (i < 0) {
+        pos = qMax(pos, end);
+        goto incomplete;
+      }
+      if (_state == Body && _partEnd && !_partEnd())
+        return fail("interrupted by part end handler");
+      pos = i+_delimiter.size();
+      _state = AfterDelimiter;
+      break;
+    }
+    case AfterDelimiter: {
+      // skip transport padding
+      int i = 0;
+      while (i < available && (p[i] == ' ' || p[i] == '\t'))
+        ++i;
+      if (available-i < 2)
+        goto incomplete;
+      if (p[i] == '-' && p[i+1] == '-') {
+        _state = Epilogue;
+        _buffer.clear();
+        return true;
+      }
+      if (p[i] != '\r' || p[i+1] != '\n')
+        return fail("garbage after multipart delimiter");
+      pos += i+2;
+      _part = Part();
+      _state = Headers;
+      break;
+    }
+    case Headers: {
+      const char *end;
+      if (available >= 2 && p[0] == '\r' && p[1] == '\n') {
+        end = p; // no header at all
+      } else {
+        int i = _buffer.indexOf("\r\n\r\n", pos);
+        if (i < 0) {
+          if (available > MAXIMUM_PART_HEADERS_SIZE)
+            return fail("multipart part headers too large");
+          goto incomplete;
+        }
+        end = _buffer.constData()+i+2;
+      }
+      if (!parseHeaders(p, end))
+        return false;
+      pos = int(end-_buffer.constData())+2;
+      if (_partBegin && !_partBegin(_part))
+        return fail("interrupted by part begin handler");
+      _state = Body;
+      break;
+    }
+    case Epilogue:
+    case Error:
+      return _state == Epilogue;
+    }
+  }
+incomplete:
+  // keep only unconsumed data, the buffer stays about one feed large
+  _buffer.remove(0, pos);
+  return true;
+}
+
+bool MultipartParser::parseHeaders(const char *begin, const char *end) {
+  // LATER handle obsolete folded header lines
+  QString headers = QString::fromUtf8(begin, int(end-begin));
+  foreach (const QString &line,
+           headers.split(QStringLiteral("\r\n"), Qt::SkipEmptyParts)) {
+    int colon = line.indexOf(':');
+    if (colon <= 0)
+      return fail("bad multipart header line: "+line.left(200));
+    _part._headers.insert(line.left(colon).trimmed().toLower(),
+                          line.mid(colon+1).trimmed());
+  }
+  _part._contentType = _part._headers.value(QStringLiteral("content-type"),
+                                            QStringLiteral("text/plain"));
+  QString disposition =
+      _part._headers.value(QStringLiteral("content-disposition"));
+  QRegularExpressionMatchIterator it =
+      _dispositionParamRE.globalMatch(disposition);
+  while (it.hasNext()) {
+    QRegularExpressionMatch match = it.next();
+    QString name = match.captured(1).toLower();
+    QString value = match.capturedStart(2) >= 0
+        ? match.captured(2).replace(QRegularExpression("\\\\(.)"), "\\1")
+        : match.captured(3);
+    if (name == QStringLiteral("name"))
+      _part._name = value;
+    else if (name == QStringLiteral("filename"))
+      _part._fileName = value.isNull() ? QStringLiteral("") : value;
+  }
+  return true;
+}
@@ -0,0 +1,88 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MULTIPARTPARSER_H
+#define MULTIPARTPARSER_H
+
+#include "libp6core_global.h"
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <functional>
+
+/** Incremental parser for multipart bodies (RFC 2046), e.g.
+ * multipart/form-data uploads (RFC 7578).
+ *
+ * Data is fed as it arrives, in pieces of any size, and part content is
+ * handed over as soon as it cannot be the beginning of a delimiter, so that
+ * memory use does not depend on part sizes.
+ *
+ * Usage example:
+ * MultipartParser parser(MultipartParser::boundaryFromContentType(ct));
+ * parser.setPartBeginHandler([](const MultipartParser::Part &part) { ... });
+ * parser.setPartDataHandler([](const char *data, int len) { ... });
+ * while (...)
+ *   if (!parser.feed(data, len)) ...
+ * if (!parser.isFinished()) ... // truncated body
+ */
+class LIBPUMPKINSHARED_EXPORT MultipartParser {
+public:
+  class Part {
+  public:
+    /** Header values, by lower case names */
+    QHash<QString,QString> _headers;
+    /** Content-Disposition name parameter, e.g. form field name. */
+    QString _name;
+    /** Content-Disposition filename parameter, null if not a file. */
+    QString _fileName;
+    /** Content-Type, "text/plain" if not specified. */
+    QString _contentType;
+  };
+  /** Return false to interrupt parsing. */
+  using PartBeginHandler = std::function<bool(const Part &part)>;
+  using PartDataHandler = std::function<bool(const char *data, int len)>;
+  using PartEndHandler = std::function<bool()>;
+
+private:
+  enum State { Preamble, AfterDelimiter, Headers, Body, Epilogue, Error };
+  QByteArray _delimiter; // CRLF "--" boundary
+  QByteArray _buffer;
+  State _state;
+  Part _part;
+  QString _errorString;
+  PartBeginHandler _partBegin;
+  PartDataHandler _partData;
+  PartEndHandler _partEnd;
+
+public:
+  explicit MultipartParser(QByteArray boundary);
+  /** Extract boundary parameter from a Content-Type header value, e.g.
+   * "multipart/form-data; boundary=xyz".
+   * @return empty QByteArray if not a multipart type or no boundary */
+  static QByteArray boundaryFromContentType(QString contentType);
+  void setPartBeginHandler(PartBeginHandler handler) { _partBegin = handler; }
+  void setPartDataHandler(PartDataHandler handler) { _partData = handler; }
+  void setPartEndHandler(PartEndHandler handler) { _partEnd = handler; }
+  /** Parse more data.
+   * @return false on syntax error or if a handler interrupted parsing */
+  bool feed(const char *data, int len);
+  /** True when the closing delimiter was found. */
+  bool isFinished() const { return _state == Epilogue; }
+  QString errorString() const { return _errorString; }
+
+private:
+  bool fail(QString errorString);
+  bool parseHeaders(const char *begin, const char *end);
+};
+
+#endif // MULTIPARTPARSER_H
@@ -25,6 +25,8 @@
 
 static const QRegularExpression _templateMarkupIdentifierEndRE("[^a-z]");
 static const QRegularExpression _directorySeparatorRE("[/:]");
+// template output is streamed to the client by pieces of about this size
+#define TEMPLATE_OUTPUT_CHUNK 8192
 
 int TemplatingHttpHandler::_defaultMaxValueLength(500);
 TemplatingHttpHandler::TextConversion
@@ -44,19 +46,18 @@ void TemplatingHttpHandler::sendLocalResource(
   foreach (QString filter, _filters) {
     QRegExp re(filter);
     if (re.indexIn(file->fileName()) >= 0) {
+      // output is streamed while being generated, hence without
+      // Content-Length, which makes HttpResponse use chunked encoding
       QString output;
+      output.reserve(2*TEMPLATE_OUTPUT_CHUNK);
       applyTemplateFile(req, res, file, processingContext, &output);
-      QByteArray ba = output.toUtf8();
-      res.setContentLength(ba.size());
-      if (req.method() != HttpRequest::HEAD) {
-        QBuffer buf(&ba);
-        buf.open(QIODevice::ReadOnly);
-        IOUtils::copy(res.output(), &buf);
-      }
+      writeOutput(res, &output);
       return;
     }
   }
   if (!handleCacheHeadersAndSend304(file, req, res)) {
+    if (sendPrecompressedResource(req, res, file))
+      return;
     res.setContentLength(file->size());
     IOUtils::copy(res.output(), file);
   }
@@ -96,6 +97,8 @@ void TemplatingHttpHandler::applyTemplateFile(
   QString input = QString::fromUtf8(buf.data());
   int pos = 0, markupPos;
   while ((markupPos = input.indexOf("<?", pos)) >= 0) {
+    if (output->size() >= TEMPLATE_OUTPUT_CHUNK)
+      writeOutput(res, output);
     output->append(input.mid(pos, markupPos-pos));
     pos = markupPos+2;
     markupPos = input.indexOf("?>", pos);
@@ -184,6 +187,13 @@ void TemplatingHttpHandler::applyTemplateFile(
   output->append(input.right(input.size()-pos));
 }
 
+void TemplatingHttpHandler::writeOutput(HttpResponse res, QString *output) {
+  if (output->isEmpty())
+    return;
+  res.output()->write(output->toUtf8());
+  output->resize(0); // keeps capacity
+}
+
 TemplatingHttpHandler *TemplatingHttpHandler::addView(TextView *view) {
   QString label = view ? view->objectName() : QString();
   if (label.isEmpty())
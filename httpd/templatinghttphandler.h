@@ -131,6 +131,8 @@ private:
                          ParamsProviderMerger *processingContext,
                          QString *output);
   void convertData(QString *data, bool disableTextConversion) const;
+  /** Write generated text so far to the client and clear it. */
+  inline void writeOutput(HttpResponse res, QString *output);
 };
 
 #endif // TEMPLATINGHTTPHANDLER_H
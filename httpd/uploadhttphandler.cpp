@@ -12,7 +12,102 @@
  * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "uploadhttphandler.h"
-#include "util/ioutils.h"
+#include "log/log.h"
+#include <QElapsedTimer>
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
+#define UPLOAD_BUFFER_SIZE 65536
+// waiting for data when Content-Length is known
+#define UPLOAD_READ_WAIT 30000
+// without Content-Length, body is considered complete after this idle time
+#define UPLOAD_IDLE_WAIT 1000
+#define SPLICE_STEP (1024*1024)
+
+#ifdef Q_OS_LINUX
+/** Move up to length bytes from socket to file within the kernel.
+ * If the file does not support splicing, which is only known when the first
+ * bytes are spliced to it, the bytes already read from the socket are written
+ * the regular way and *unsupported is set, so that the caller can go on
+ * reading the body the regular way.
+ * @return bytes moved to the file, -1 on error */
+static qint64 spliceToFile(QAbstractSocket *input, QFile *file,
+                           qint64 length, bool *unsupported) {
+  int in = int(input->socketDescriptor()), out = file->handle();
+  int pipefd[2];
+  *unsupported = true;
+  // splice() refuses files opened with O_APPEND
+  if (in < 0 || out < 0 || (fcntl(out, F_GETFL) & O_APPEND) || !file->flush()
+      || pipe(pipefd))
+    return 0;
+  *unsupported = false;
+  loff_t offset = file->pos();
+  qint64 done = 0;
+  bool failed = false;
+  while (done < length && !failed && !*unsupported) {
+    ssize_t n = splice(in, 0, pipefd[1], 0,
+                       size_t(qMin(length-done, qint64(SPLICE_STEP))),
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (n == 0)
+      break; // connection closed by peer
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN) {
+        pollfd pfd { in, POLLIN, 0 };
+        if (poll(&pfd, 1, UPLOAD_READ_WAIT) <= 0)
+          break; // timeout, reported as truncated body
+        continue;
+      }
+      if (!done && errno == EINVAL) // socket cannot be spliced
+        *unsupported = true;
+      else
+        failed = true;
+      break;
+    }
+    while (n > 0 && !*unsupported) { // drain the pipe into the file
+      ssize_t m = splice(pipefd[0], 0, out, &offset, size_t(n), SPLICE_F_MOVE);
+      if (m < 0 && errno == EINTR)
+        continue;
+      if (m < 0 && errno == EINVAL && !done) {
+        // file system without splice support, data is still in the pipe
+        *unsupported = true;
+        break;
+      }
+      if (m <= 0) {
+        failed = true;
+        break;
+      }
+      n -= m;
+      done += m;
+    }
+    QByteArray buffer;
+    if (n > 0 && !failed)
+      buffer.resize(UPLOAD_BUFFER_SIZE);
+    while (n > 0 && !failed) { // write the pipe content the regular way
+      ssize_t r = ::read(pipefd[0], buffer.data(),
+                         size_t(qMin(n, ssize_t(buffer.size()))));
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0 || pwrite(out, buffer.constData(), size_t(r), offset) != r) {
+        failed = true;
+        break;
+      }
+      offset += r;
+      n -= r;
+      done += r;
+    }
+  }
+  ::close(pipefd[0]);
+  ::close(pipefd[1]);
+  file->seek(offset);
+  return failed ? -1 : done;
+}
+#endif
 
 QString UploadHttpHandler::urlPathPrefix() const {
   return _urlPathPrefix;
@@ -47,41 +142,250 @@ bool UploadHttpHandler::acceptRequest(HttpRequest req) {
 
 bool UploadHttpHandler::handleRequest(
     HttpRequest req, HttpResponse res, ParamsProviderMerger *processingContext) {
-  _maxSimultaneousUploads.acquire(1);
-  if (req.header("Content-Length").toULongLong() > _maxBytesPerUpload) {
+  bool ok;
+  qint64 length = req.header("Content-Length").toLongLong(&ok);
+  if (!ok || length < 0)
+    length = -1;
+  if (length > qint64(_maxBytesPerUpload)) {
     Log::warning() << "data too large when uploading data at "
                    << req.url().toString(QUrl::RemovePassword)
                    << " maximum is " << _maxBytesPerUpload;
     res.setStatus(413); // Request entity too large
     return true;
   }
+  if (_uploadMode == Streaming)
+    return handleStreamingUpload(req, res, processingContext, length);
+  _maxSimultaneousUploads.acquire(1);
   QTemporaryFile *file = _tempFileTemplate.isEmpty()
       ? new QTemporaryFile : new QTemporaryFile(_tempFileTemplate);
+  UploadStats stats;
+  QElapsedTimer timer;
+  timer.start();
+  qint64 result;
   if (!file->open()) {
     Log::warning() << "failed to create temporary file "
                    << file->fileTemplate() << " : " << file->errorString();
-    res.setStatus(500);
+    result = -500;
+  } else {
+    // LATER avoid DoS by setting a maximum *total* read time out
+    result = readBody(req, length, [file](const char *data, qint64 len) {
+      return file->write(data, len) == len;
+    }, file, &stats, 500);
   }
-  // LATER avoid DoS by setting a maximum *total* read time out
-  // LATER also stop copying or waiting when Content-Length is reached
-  qint64 result = IOUtils::copy(file, req.input(), _maxBytesPerUpload,
-                                65536, 1000, 100);
+  stats._durationMsecs = timer.elapsed();
   if (result < 0) {
     Log::warning() << "failed uploading data at "
                    << req.url().toString(QUrl::RemovePassword)
+                   << " with status " << -result
                    << " - socket error : " << req.input()->errorString()
                    << " - temporary file error : " << file->errorString();
-    res.setStatus(500);
-  } else if (req.input()->waitForBytesWritten(100)) {
-    Log::warning() << "data too large when uploading data at "
-                   << req.url().toString(QUrl::RemovePassword)
-                   << " maximum is " << _maxBytesPerUpload;
-    res.setStatus(413); // Request entity too large
+    res.setStatus(int(-result));
   } else {
     file->seek(0);
     processUploadedFile(req, res, processingContext, file);
   }
+  recordStats(req, result >= 0, stats);
   delete file;
   _maxSimultaneousUploads.release(1);
   return true;
 }
+
+bool UploadHttpHandler::handleStreamingUpload(
+    HttpRequest req, HttpResponse res, ParamsProviderMerger *processingContext,
+    qint64 length) {
+  UploadStats stats;
+  QElapsedTimer timer;
+  timer.start();
+  QString contentType = req.header(QStringLiteral("Content-Type"),
+                                   QStringLiteral("application/octet-stream"));
+  QByteArray boundary = MultipartParser::boundaryFromContentType(contentType);
+  qint64 result;
+  if (boundary.isEmpty()) {
+    MultipartParser::Part part;
+    part._headers.insert(QStringLiteral("content-type"), contentType);
+    part._contentType = contentType;
+    QIODevice *device = beginUploadPart(req, processingContext, part);
+    stats._parts = 1;
+    auto consumer = [&](const char *data, qint64 len) {
+      return device ? device->write(data, len) == len
+                    : processUploadData(req, processingContext, part, data,
+                                        len);
+    };
+    result = readBody(req, length, consumer, qobject_cast<QFile*>(device),
+                      &stats, 500);
+    endUploadPart(req, processingContext, part, device);
+  } else {
+    MultipartParser parser(boundary);
+    MultipartParser::Part current;
+    QIODevice *device = 0;
+    bool inPart = false, consumerFailed = false;
+    parser.setPartBeginHandler([&](const MultipartParser::Part &part) {
+      current = part;
+      device = beginUploadPart(req, processingContext, part);
+      inPart = true;
+      ++stats._parts;
+      return true;
+    });
+    parser.setPartDataHandler([&](const char *data, int len) {
+      bool ok = device ? device->write(data, len) == len
+                       : processUploadData(req, processingContext, current,
+                                           data, len);
+      consumerFailed = !ok;
+      return ok;
+    });
+    parser.setPartEndHandler([&]() {
+      inPart = false;
+      endUploadPart(req, processingContext, current, device);
+      device = 0;
+      return true;
+    });
+    auto consumer = [&parser](const char *data, qint64 len) {
+      return parser.feed(data, int(len));
+    };
+    result = readBody(req, length, consumer, 0, &stats, 400);
+    if (inPart) // truncated or interrupted
+      endUploadPart(req, processingContext, current, device);
+    if (result >= 0 && !parser.isFinished())
+      result = -400;
+    // syntax errors are the client's fault, failing to store data is not
+    if (consumerFailed)
+      result = -500;
+    else if (result < 0 && !parser.errorString().isEmpty())
+      Log::warning() << "bad multipart upload at "
+                     << req.url().toString(QUrl::RemovePassword) << " : "
+                     << parser.errorString();
+  }
+  stats._durationMsecs = timer.elapsed();
+  if (result < 0) {
+    Log::warning() << "failed uploading data at "
+                   << req.url().toString(QUrl::RemovePassword)
+                   << " with status " << -result
+                   << " - socket error : " << req.input()->errorString();
+    res.setStatus(int(-result));
+  }
+  recordStats(req, result >= 0, stats);
+  uploadFinished(req, res, processingContext, result >= 0, stats);
+  return true;
+}
+
+qint64 UploadHttpHandler::readBody(
+    HttpRequest req, qint64 length, BodyConsumer consumer, QFile *spliceTarget,
+    UploadStats *stats, int refusalStatus) {
+  QAbstractSocket *input = req.input();
+  bool knownLength = length >= 0;
+  // without Content-Length, read one byte more than allowed to detect excess
+  qint64 remaining = knownLength ? length : qint64(_maxBytesPerUpload)+1;
+  QByteArray buffer(UPLOAD_BUFFER_SIZE, Qt::Uninitialized);
+  forever {
+    // data already buffered by the socket is consumed first
+    while (remaining > 0 && input->bytesAvailable() > 0) {
+      qint64 n = input->read(buffer.data(),
+                             qMin(remaining, qint64(buffer.size())));
+      if (n < 0)
+        return -500;
+      if (!consumer(buffer.constData(), n))
+        return -refusalStatus;
+      stats->_bytes += n;
+      remaining -= n;
+    }
+    if (remaining == 0)
+      break;
+#ifdef Q_OS_LINUX
+    if (spliceTarget && knownLength) {
+      bool unsupported;
+      qint64 n = spliceToFile(input, spliceTarget, remaining, &unsupported);
+      if (n < 0)
+        return -500;
+      stats->_bytes += n;
+      remaining -= n;
+      if (!unsupported)
+        stats->_spliced = true;
+      if (remaining == 0)
+        break;
+      if (unsupported) { // go on reading the body the regular way
+        spliceTarget = 0;
+        continue;
+      }
+      return -408; // timeout or connection closed before end of body
+    }
+#else
+    Q_UNUSED(spliceTarget)
+#endif
+    if (!input->waitForReadyRead(knownLength ? UPLOAD_READ_WAIT
+                                             : UPLOAD_IDLE_WAIT)) {
+      if (knownLength)
+        return -408;
+      break; // without Content-Length, body ends when client stops sending
+    }
+  }
+  if (!knownLength && remaining == 0) {
+    Log::warning() << "data too large when uploading data at "
+                   << req.url().toString(QUrl::RemovePassword)
+                   << " maximum is " << _maxBytesPerUpload;
+    return -413;
+  }
+  return stats->_bytes;
+}
+
+void UploadHttpHandler::recordStats(HttpRequest req, bool success,
+                                    const UploadStats &stats) {
+  _uploadsCount.fetchAndAddRelaxed(1);
+  if (!success)
+    _failedUploadsCount.fetchAndAddRelaxed(1);
+  _uploadedBytes.fetchAndAddRelaxed(quint64(stats._bytes));
+  Log::debug() << "upload at " << req.url().toString(QUrl::RemovePassword)
+               << (success ? " succeeded: " : " failed: ") << stats._bytes
+               << " bytes in " << stats._parts << " part(s) in "
+               << stats._durationMsecs << " ms ("
+               << stats.throughput()/(1024*1024) << " MiB/s"
+               << (stats._spliced ? ", spliced)" : ")");
+}
+
+void UploadHttpHandler::processUploadedFile(
+    HttpRequest req, HttpResponse res, ParamsProviderMerger *processingContext,
+    QFile *file) {
+  Q_UNUSED(processingContext)
+  Q_UNUSED(file)
+  Log::error() << "UploadHttpHandler::processUploadedFile() not implemented "
+                  "for upload at " << req.url().toString(QUrl::RemovePassword);
+  res.setStatus(500);
+}
+
+QIODevice *UploadHttpHandler::beginUploadPart(
+    HttpRequest req, ParamsProviderMerger *processingContext,
+    const MultipartParser::Part &part) {
+  Q_UNUSED(req)
+  Q_UNUSED(processingContext)
+  Q_UNUSED(part)
+  return 0;
+}
+
+bool UploadHttpHandler::processUploadData(
+    HttpRequest req, ParamsProviderMerger *processingContext,
+    const MultipartParser::Part &part, const char *data, qint64 len) {
+  Q_UNUSED(req)
+  Q_UNUSED(processingContext)
+  Q_UNUSED(part)
+  Q_UNUSED(data)
+  Q_UNUSED(len)
+  return true;
+}
+
+void UploadHttpHandler::endUploadPart(
+    HttpRequest req, ParamsProviderMerger *processingContext,
+    const MultipartParser::Part &part, QIODevice *device) {
+  Q_UNUSED(req)
+  Q_UNUSED(processingContext)
+  Q_UNUSED(part)
+  Q_UNUSED(device)
+}
+
+void UploadHttpHandler::uploadFinished(
+    HttpRequest req, HttpResponse res, ParamsProviderMerger *processingContext,
+    bool success, UploadStats stats) {
+  Q_UNUSED(req)
+  Q_UNUSED(res)
+  Q_UNUSED(processingContext)
+  Q_UNUSED(success)
+  Q_UNUSED(stats)
+}
@@ -15,36 +15,79 @@
 #define UPLOADHTTPHANDLER_H
 
 #include "httphandler.h"
+#include "multipartparser.h"
 #include <QTemporaryFile>
 #include <QSemaphore>
+#include <QAtomicInteger>
+#include <functional>
 
-/** HttpHandler to deal with uploading files or data. */
+/** HttpHandler to deal with uploading files or data.
+ *
+ * In TemporaryFile mode (the default), the whole request body is first
+ * written to a temporary file, then processUploadedFile() is called.
+ * In Streaming mode, the body is handed over to the subclass while it is
+ * being received, through beginUploadPart(), processUploadData() and
+ * endUploadPart(), multipart bodies (e.g. multipart/form-data) being parsed
+ * on the fly, then uploadFinished() is called.
+ *
+ * Whatever the mode, when the body is not multipart and is written to a
+ * file, it is moved from socket to file by the kernel (using splice(2) on
+ * Linux) without being copied through user space. */
 class LIBPUMPKINSHARED_EXPORT UploadHttpHandler : public HttpHandler {
   Q_OBJECT
   Q_DISABLE_COPY(UploadHttpHandler)
+
+public:
+  enum UploadMode { TemporaryFile, Streaming };
+  /** Metrics of one upload. */
+  class UploadStats {
+  public:
+    qint64 _bytes = 0;
+    qint64 _durationMsecs = 0;
+    int _parts = 0;
+    bool _spliced = false; // at less part of the body was spliced to a file
+    /** bytes per second */
+    double throughput() const {
+      return _durationMsecs > 0 ? 1000.0*_bytes/_durationMsecs : 0.0; }
+  };
+
+private:
   QString _urlPathPrefix;
   QString _tempFileTemplate;
   quint64 _maxBytesPerUpload;
   QSemaphore _maxSimultaneousUploads;
+  UploadMode _uploadMode;
+  QAtomicInteger<quint64> _uploadsCount, _failedUploadsCount, _uploadedBytes;
 
 public:
   explicit UploadHttpHandler(QObject *parent = 0)
     : HttpHandler(parent), _maxBytesPerUpload(2L*1024*1024),
-      _maxSimultaneousUploads(1) { }
+      _maxSimultaneousUploads(1), _uploadMode(TemporaryFile) { }
   explicit UploadHttpHandler(QString urlPathPrefix, QObject *parent = 0)
     : HttpHandler(parent), _urlPathPrefix(urlPathPrefix),
-      _maxBytesPerUpload(2*1024*1024), _maxSimultaneousUploads(1) { }
+      _maxBytesPerUpload(2*1024*1024), _maxSimultaneousUploads(1),
+      _uploadMode(TemporaryFile) { }
   explicit UploadHttpHandler(QString urlPathPrefix, int maxSimultaneousUploads,
                              QObject *parent = 0)
     : HttpHandler(parent), _urlPathPrefix(urlPathPrefix),
       _maxBytesPerUpload(2*1024*1024),
-      _maxSimultaneousUploads(maxSimultaneousUploads) { }
+      _maxSimultaneousUploads(maxSimultaneousUploads),
+      _uploadMode(TemporaryFile) { }
   QString urlPathPrefix() const;
   void setUrlPathPrefix(const QString &urlPathPrefix);
   QString tempFileTemplate() const;
   void setTempFileTemplate(const QString &tempFileTemplate);
   int maxBytesPerUpload() const;
   void setMaxBytesPerUpload(quint64 maxBytesPerUpload);
+  UploadMode uploadMode() const { return _uploadMode; }
+  /** Default: TemporaryFile.
+   * maxSimultaneousUploads only applies to TemporaryFile mode. */
+  void setUploadMode(UploadMode uploadMode) { _uploadMode = uploadMode; }
+  /** Number of uploads since startup, including failed ones. */
+  quint64 uploadsCount() const { return _uploadsCount.loadAcquire(); }
+  quint64 failedUploadsCount() const {
+    return _failedUploadsCount.loadAcquire(); }
+  quint64 uploadedBytes() const { return _uploadedBytes.loadAcquire(); }
   bool acceptRequest(HttpRequest req);
   bool handleRequest(HttpRequest req, HttpResponse res,
                      ParamsProviderMerger *processingContext);
@@ -54,10 +97,53 @@ public:
    * several simultaneous uploads are enabled, this method can be called by
    * several httpd worker threads at the same time.
    * @param file opened, seeked at begin temporary file, caller will close and
-   *   delete the object (thus removing the file) */
+   *   delete the object (thus removing the file)
+   * Only called in TemporaryFile mode, default implementation sends 500. */
   virtual void processUploadedFile(
       HttpRequest req, HttpResponse res,
-      ParamsProviderMerger *processingContext, QFile *file) = 0;
+      ParamsProviderMerger *processingContext, QFile *file);
+  /** Streaming mode: called when a part of the body begins, i.e. once for a
+   * non-multipart body (part name is then empty and part content type is
+   * request's one).
+   * Must be thread-safe, like every streaming mode method.
+   * @return device to which part data will be written, e.g. a QFile opened
+   *   for writing (which enables splicing), or 0 to have part data given to
+   *   processUploadData() instead. The device is not owned by caller, see
+   *   endUploadPart(). Default: 0 */
+  virtual QIODevice *beginUploadPart(
+      HttpRequest req, ParamsProviderMerger *processingContext,
+      const MultipartParser::Part &part);
+  /** Streaming mode: called with part data as it arrives, unless
+   * beginUploadPart() returned a device.
+   * @return false to abort upload. Default: ignore data. */
+  virtual bool processUploadData(
+      HttpRequest req, ParamsProviderMerger *processingContext,
+      const MultipartParser::Part &part, const char *data, qint64 len);
+  /** Streaming mode: called when a part ends, even on failure (the body may
+   * be truncated), e.g. to close device returned by beginUploadPart(). */
+  virtual void endUploadPart(
+      HttpRequest req, ParamsProviderMerger *processingContext,
+      const MultipartParser::Part &part, QIODevice *device);
+  /** Streaming mode: called when the whole body was received, or on failure,
+   * in which case response status is already set to an error.
+   * Default: does nothing. */
+  virtual void uploadFinished(
+      HttpRequest req, HttpResponse res,
+      ParamsProviderMerger *processingContext, bool success,
+      UploadStats stats);
+
+private:
+  using BodyConsumer = std::function<bool(const char *data, qint64 len)>;
+  bool handleStreamingUpload(HttpRequest req, HttpResponse res,
+                             ParamsProviderMerger *processingContext,
+                             qint64 length);
+  /** Read request body and give it to consumer, or splice it to
+   * spliceTarget if not null.
+   * @return body size, or minus HTTP error status
+   * @param refusalStatus returned status when consumer returns false */
+  qint64 readBody(HttpRequest req, qint64 length, BodyConsumer consumer,
+                  QFile *spliceTarget, UploadStats *stats, int refusalStatus);
+  void recordStats(HttpRequest req, bool success, const UploadStats &stats);
 };
 
 #endif // UPLOADHTTPHANDLER_H
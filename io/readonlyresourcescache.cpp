@@ -15,7 +15,7 @@
 #include <QDateTime>
 #include <QThread>
 #include <unistd.h>
-#include "thread/blockingtimer.h"
+#include "thread/eventwaiter.h"
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QRegularExpression>
@@ -46,22 +46,21 @@ QByteArray ReadOnlyResourcesCache::fetchResource(
     // LATER increment cache hit stats
     return resource;
   }
-  // LATER true asynchronous process rather than polling
+  // LATER true asynchronous process rather than waiting
   // especialy because current behaviour is different depending on the thread
   // - really blocking if not executed by owner thread, hence not depending
   //   on calling code being reentrant
-  // - calling QCoreApplication::processEvents() during wait if executed by
-  //   owner thread, hence requiring reentrant caller code but supporting
-  //   processing QNetworkAccessManager signals callbacks on the same event
-  //   loop
-  BlockingTimer timer(
-        waitForMsecs, 100,
-        [this, pathOrUrl]() {
+  // - running a local event loop during wait if executed by owner thread,
+  //   hence requiring reentrant caller code but supporting processing
+  //   QNetworkAccessManager signals callbacks on the same event loop
+  EventWaiter waiter([this, pathOrUrl]() {
     QMutexLocker ml(&_mutex);
     return _staleTimestamp.value(pathOrUrl)
         >= QDateTime::currentMSecsSinceEpoch();
-  }, QThread::currentThread() == thread());
-  timer.wait();
+  });
+  waiter.addSignal(this, &ReadOnlyResourcesCache::resourceFetched);
+  waiter.setEventLoopThread(thread());
+  waiter.wait(waitForMsecs);
   resource = fetchResourceFromCache(pathOrUrl, false);
   // LATER increment cache hit or miss stats
   if (errorString)
@@ -156,7 +155,9 @@ void ReadOnlyResourcesCache::requestFinished(QNetworkReply *reply) {
     _errorStrings.insert(pathOrUrl, reply->errorString());
     // LATER plan another fetch on certains conditions (e.g. last failures)
   }
+  ml.unlock();
   reply->deleteLater();
+  emit resourceFetched(pathOrUrl);
 }
 
 void ReadOnlyResourcesCache::clear() {
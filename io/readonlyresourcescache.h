@@ -67,6 +67,11 @@ public:
   /** defaults to: 60 (1') */
   void setDefaultNegativeMaxAge(qint64 secs) { _defaultNegativeMaxAge = secs; }
 
+signals:
+  /** Emitted when fetching a resource is finished, either successfuly or
+   * not. */
+  void resourceFetched(QString pathOrUrl);
+
 private:
   /** must be called by owner thread (because of qnam), locks the mutex */
   Q_INVOKABLE void planResourceFetching(QString pathOrUrl);
@@ -46,6 +46,7 @@ DESTDIR = ../build-$$TARGET-$$TARGET_OS/$$BUILD_TYPE
 INCLUDEPATH += ../libqtpf
 LIBS += -L../build-qtpf-$$TARGET_OS/$$BUILD_TYPE
 LIBS += -lqtpf
+LIBS += -lz
 
 SOURCES += \
     httpd/httpworker.cpp \
@@ -54,6 +55,9 @@ SOURCES += \
     httpd/httprequest.cpp \
     httpd/httphandler.cpp \
     thread/blockingtimer.cpp \
+    thread/eventwaiter.cpp \
+    thread/snapshotreaders.cpp \
+    thread/workerpool.cpp \
     textview/htmltableview.cpp \
     textview/textview.cpp \
     httpd/filesystemhttphandler.cpp \
@@ -95,7 +99,14 @@ SOURCES += \
     util/relativedatetime.cpp \
     log/loggerthread.cpp \
     log/multiplexerlogger.cpp \
+    log/logfilearchiver.cpp \
+    log/logfileindex.cpp \
+    log/binaryfilelogger.cpp \
+    log/logstore.cpp \
     httpd/uploadhttphandler.cpp \
+    httpd/httpcompression.cpp \
+    httpd/httpencodingsocket.cpp \
+    httpd/multipartparser.cpp \
     csv/csvfile.cpp \
     csv/csvfilemodel.cpp \
     modelview/shareduiitemdocumentmanager.cpp \
@@ -127,6 +138,8 @@ SOURCES += \
     message/message.cpp \
     message/messagesender.cpp \
     message/tcpconnectionhandler.cpp \
+    message/pfframescanner.cpp \
+    message/pfbinarycodec.cpp \
     message/tcpclient.cpp \
     message/incomingmessagedispatcher.cpp \
     message/outgoingmessagedispatcher.cpp \
@@ -188,7 +201,14 @@ HEADERS +=\
     util/relativedatetime.h \
     log/loggerthread.h \
     log/multiplexerlogger.h \
+    log/logfilearchiver.h \
+    log/logfileindex.h \
+    log/binaryfilelogger.h \
+    log/logstore.h \
     httpd/uploadhttphandler.h \
+    httpd/httpcompression.h \
+    httpd/httpencodingsocket.h \
+    httpd/multipartparser.h \
     csv/csvfile.h \
     csv/csvfilemodel.h \
     modelview/shareduiitemdocumentmanager.h \
@@ -196,6 +216,10 @@ HEADERS +=\
     util/characterseparatedexpression.h \
     util/paramsprovidermerger.h \
     thread/atomicvalue.h \
+    thread/readmostlyatomicvalue.h \
+    thread/eventwaiter.h \
+    thread/snapshotreaders.h \
+    thread/workerpool.h \
     thread/circularbuffer.h \
     modelview/shareduiitemslogmodel.h \
     util/stringsparamsprovider.h \
@@ -225,6 +249,8 @@ HEADERS +=\
     message/message.h \
     message/messagesender.h \
     message/tcpconnectionhandler.h \
+    message/pfframescanner.h \
+    message/pfbinarycodec.h \
     message/tcpclient.h \
     message/incomingmessagedispatcher.h \
     message/outgoingmessagedispatcher.h \
@@ -0,0 +1,220 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "binaryfilelogger.h"
+#include "util/paramset.h"
+#include "format/timeformats.h"
+#include <QtEndian>
+#include <QtDebug>
+#include <cstring>
+
+// size, timestamp, severity
+static const int recordHeaderSize = 4+8+1;
+static const int batchSize = 65536;
+
+const QByteArray BinaryFileLogger::magic("P6LOGBIN");
+
+static inline void appendUInt32(QByteArray *data, quint32 value) {
+  uchar buf[4];
+  qToLittleEndian<quint32>(value, buf);
+  data->append(reinterpret_cast<const char*>(buf), sizeof buf);
+}
+
+static inline void appendInt64(QByteArray *data, qint64 value) {
+  uchar buf[8];
+  qToLittleEndian<qint64>(value, buf);
+  data->append(reinterpret_cast<const char*>(buf), sizeof buf);
+}
+
+static inline void appendField(QByteArray *data, const QString &value) {
+  QByteArray utf8 = value.toUtf8();
+  appendUInt32(data, utf8.size());
+  data->append(utf8);
+}
+
+BinaryFileLogger::BinaryFileLogger(QString pathPattern,
+                                   Log::Severity minSeverity,
+                                   int secondsReopenInterval)
+  : Logger(minSeverity, Logger::DedicatedThread), _pathPattern(pathPattern),
+    _file(0), _lastOpen(0), _secondsReopenInterval(secondsReopenInterval) {
+  _batch.reserve(batchSize+4096);
+}
+
+BinaryFileLogger::~BinaryFileLogger() {
+  doFlush();
+  if (_file)
+    delete _file;
+}
+
+void BinaryFileLogger::appendRecord(QByteArray *data, const LogEntry &entry) {
+  int start = data->size();
+  appendUInt32(data, 0); // record size, set below
+  appendInt64(data, entry.timestampMsecs());
+  data->append(char(entry.severity()));
+  appendField(data, entry.task());
+  appendField(data, entry.execId());
+  appendField(data, entry.sourceCode());
+  appendField(data, entry.message());
+  qToLittleEndian<quint32>(data->size()-start,
+                           reinterpret_cast<uchar*>(data->data()+start));
+}
+
+void BinaryFileLogger::doLog(const LogEntry &entry) {
+  qint64 now = entry.timestampMsecs();
+  if (_file == 0
+      || (_secondsReopenInterval >= 0
+          && (now-_lastOpen)/1000 > _secondsReopenInterval)) {
+    doFlush();
+    if (_file)
+      delete _file;
+    _currentPath = ParamSet().evaluate(_pathPattern);
+    _file = new QFile(_currentPath);
+    // not buffered by QFile since writes are already batched
+    if (!_file->open(QIODevice::WriteOnly|QIODevice::Append
+                     |QIODevice::Unbuffered)) {
+      _openError = _file->errorString();
+      delete _file;
+      _file = 0;
+    } else {
+      _lastOpen = now;
+      if (_file->size() == 0)
+        _file->write(magic);
+    }
+  }
+  appendRecord(&_batch, entry);
+  ++_batchEntries;
+  if (_batch.size() >= batchSize)
+    doFlush();
+}
+
+void BinaryFileLogger::doFlush() {
+  if (_batch.isEmpty())
+    return;
+  if (!_file)
+    batchLost("cannot open file: "+_openError);
+  else if (_file->write(_batch) != _batch.size())
+    batchLost("cannot write to file: "+_file->errorString());
+  _batch.clear();
+  _batchEntries = 0;
+}
+
+void BinaryFileLogger::batchLost(QString reason) {
+  _lostEntries += _batchEntries;
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  if (now - _lastLossWarning <= _lossWarningIntervalMs)
+    return;
+  _lastLossWarning = now;
+#if QT_VERSION >= 0x050400
+  qWarning().noquote()
+#else
+  qWarning()
+#endif
+      << Log::timestampToText(now) << this << "BinaryFileLogger lost"
+      << _lostEntries << "log entries since last warning while logging to"
+      << _currentPath << ":" << reason << "this warning occurs at most every"
+      << TimeFormats::toCoarseHumanReadableTimeInterval(
+           _lossWarningIntervalMs);
+  _lostEntries = 0;
+}
+
+BinaryLogReader::BinaryLogReader(QString path)
+  : _file(path), _data(0), _size(0), _pos(0) {
+  if (!_file.open(QIODevice::ReadOnly))
+    return;
+  _size = _file.size();
+  if (_size < BinaryFileLogger::magic.size())
+    return;
+  _data = _file.map(0, _size);
+  if (_data && ::memcmp(_data, BinaryFileLogger::magic.constData(),
+                        BinaryFileLogger::magic.size())) {
+    _file.unmap(const_cast<uchar*>(_data));
+    _data = 0;
+  }
+  rewind();
+}
+
+void BinaryLogReader::rewind() {
+  _pos = BinaryFileLogger::magic.size();
+}
+
+bool BinaryLogReader::next(Entry *entry, qint64 fromMsecs, qint64 toMsecs,
+                           Log::Severity minSeverity) {
+  while (_data && _pos+recordHeaderSize <= _size) {
+    const uchar *record = _data+_pos;
+    quint32 size = qFromLittleEndian<quint32>(record);
+    if (size < quint32(recordHeaderSize+4*4) || _pos+size > _size)
+      return false; // truncated or corrupted record
+    _pos += size;
+    qint64 timestamp = qFromLittleEndian<qint64>(record+4);
+    if (timestamp < fromMsecs || timestamp >= toMsecs
+        || record[12] < minSeverity)
+      continue;
+    entry->_record = record;
+    return true;
+  }
+  return false;
+}
+
+qint64 BinaryLogReader::Entry::timestamp() const {
+  return _record ? qFromLittleEndian<qint64>(_record+4) : 0;
+}
+
+Log::Severity BinaryLogReader::Entry::severity() const {
+  return _record ? (Log::Severity)_record[12] : Log::Debug;
+}
+
+QString BinaryLogReader::Entry::field(int index) const {
+  if (!_record)
+    return QString();
+  quint32 size = qFromLittleEndian<quint32>(_record);
+  quint32 pos = recordHeaderSize;
+  forever {
+    if (pos+4 > size)
+      return QString();
+    quint32 length = qFromLittleEndian<quint32>(_record+pos);
+    pos += 4;
+    if (length > size-pos)
+      return QString();
+    if (!index--)
+      return QString::fromUtf8(reinterpret_cast<const char*>(_record+pos),
+                               length);
+    pos += length;
+  }
+}
+
+Logger::LogEntry BinaryLogReader::Entry::toLogEntry() const {
+  return Logger::LogEntry(timestamp(), message(), severity(), task(), execId(),
+                          sourceCode());
+}
+
+bool BinaryLogReader::convertToText(QString binaryPath, QString textPath,
+                                    qint64 fromMsecs, qint64 toMsecs,
+                                    Log::Severity minSeverity) {
+  BinaryLogReader reader(binaryPath);
+  if (!reader.isValid())
+    return false;
+  QFile output(textPath);
+  if (!output.open(QIODevice::WriteOnly|QIODevice::Truncate))
+    return false;
+  QByteArray batch;
+  Entry entry;
+  while (reader.next(&entry, fromMsecs, toMsecs, minSeverity)) {
+    batch.append(entry.toLogEntry().asLogLine().append('\n').toUtf8());
+    if (batch.size() >= batchSize) {
+      if (output.write(batch) != batch.size())
+        return false;
+      batch.clear();
+    }
+  }
+  return output.write(batch) == batch.size();
+}
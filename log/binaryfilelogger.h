@@ -0,0 +1,120 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BINARYFILELOGGER_H
+#define BINARYFILELOGGER_H
+
+#include "logger.h"
+#include <QFile>
+#include <climits>
+
+/** Logger writing a binary, append-only, length-prefixed log format, much
+ * cheaper to write and to filter than text log files, e.g. to capture high
+ * volume debug logs.
+ *
+ * File format: an 8 bytes "P6LOGBIN" magic header followed by records, each
+ * record being, with little endian integers:
+ * quint32 record size in bytes (including this size itself),
+ * qint64 timestamp (ms since 1970), quint8 severity,
+ * then task, execid, source code and message, each as a quint32 byte count
+ * followed by UTF-8 bytes.
+ *
+ * Writes are batched and done when the batch is large enough or when there
+ * are no more entries waiting to be logged.
+ * Binary log files are not reported by currentPath() and pathPattern() since
+ * they are not text log files.
+ * @see BinaryLogReader */
+class LIBPUMPKINSHARED_EXPORT BinaryFileLogger : public Logger {
+  Q_OBJECT
+  Q_DISABLE_COPY(BinaryFileLogger)
+  QString _pathPattern, _currentPath, _openError;
+  QFile *_file;
+  qint64 _lastOpen; // ms since 1970
+  int _secondsReopenInterval;
+  QByteArray _batch;
+  int _batchEntries = 0;
+  qint64 _lostEntries = 0, _lastLossWarning = 0; // ms since 1970
+  // LATER make _lossWarningIntervalMs configurable
+  qint64 _lossWarningIntervalMs = 10*60*1000; // 10'
+
+public:
+  explicit BinaryFileLogger(QString pathPattern,
+                            Log::Severity minSeverity = Log::Debug,
+                            int secondsReopenInterval = 300);
+  ~BinaryFileLogger();
+  /** Encode an entry as a binary log record. */
+  static void appendRecord(QByteArray *data, const LogEntry &entry);
+  static const QByteArray magic;
+
+protected:
+  void doLog(const LogEntry &entry);
+  void doFlush();
+
+private:
+  /** Count current batch as lost and warn through Qt's log framework, only
+   * if not warned recently. */
+  void batchLost(QString reason);
+};
+
+/** Reader for files written by BinaryFileLogger, mapping the file in memory
+ * and filtering entries on timestamp and severity without decoding them.
+ * Returned entries point to mapped memory and must not be used after the
+ * reader has been destroyed.
+ * @see BinaryFileLogger */
+class LIBPUMPKINSHARED_EXPORT BinaryLogReader {
+  Q_DISABLE_COPY(BinaryLogReader)
+  QFile _file;
+  const uchar *_data;
+  qint64 _size, _pos;
+
+public:
+  class Entry {
+    friend class BinaryLogReader;
+    const uchar *_record;
+
+  public:
+    Entry() : _record(0) { }
+    qint64 timestamp() const;
+    Log::Severity severity() const;
+    QString task() const { return field(0); }
+    QString execId() const { return field(1); }
+    QString sourceCode() const { return field(2); }
+    QString message() const { return field(3); }
+    /** Convert to a regular log entry, e.g. to feed a LogModel. */
+    Logger::LogEntry toLogEntry() const;
+
+  private:
+    QString field(int index) const;
+  };
+
+  explicit BinaryLogReader(QString path);
+  /** False if the file cannot be mapped or is not a binary log file. */
+  bool isValid() const { return _data; }
+  /** Go back to first entry. */
+  void rewind();
+  /** Read next entry with timestamp in [fromMsecs, toMsecs[ and at less
+   * minSeverity, if any. A truncated last record, e.g. still being written,
+   * is ignored.
+   * @return false when there are no more matching entries */
+  bool next(Entry *entry, qint64 fromMsecs = LLONG_MIN,
+            qint64 toMsecs = LLONG_MAX,
+            Log::Severity minSeverity = Log::Debug);
+  /** Convert a binary log file to text format, as written by FileLogger.
+   * @return false on i/o error or invalid binary log file */
+  static bool convertToText(QString binaryPath, QString textPath,
+                            qint64 fromMsecs = LLONG_MIN,
+                            qint64 toMsecs = LLONG_MAX,
+                            Log::Severity minSeverity = Log::Debug);
+};
+
+#endif // BINARYFILELOGGER_H
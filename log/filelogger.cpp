@@ -17,11 +17,13 @@
 #include <QtDebug>
 #include <QThread>
 #include "util/paramset.h"
+#include "logfilearchiver.h"
+#include "logfileindex.h"
 
 FileLogger::FileLogger(QIODevice *device, Log::Severity minSeverity,
                        bool buffered)
-  : Logger(minSeverity, Logger::DedicatedThread), _device(0),
-    _buffered(buffered) {
+  : Logger(minSeverity, Logger::DedicatedThread), _device(0), _lastOpen(0),
+    _secondsReopenInterval(-1), _buffered(buffered) {
   //qDebug() << "creating FileLogger from device" << device;
   _device = device;
   /*qDebug() << "FileLogger::FileLoger" << this->thread() << _device->thread()
@@ -42,7 +44,8 @@ FileLogger::FileLogger(QIODevice *device, Log::Severity minSeverity,
 FileLogger::FileLogger(QString pathPattern, Log::Severity minSeverity,
                        int secondsReopenInterval, bool buffered)
   : Logger(minSeverity, Logger::DedicatedThread), _device(0),
-    _pathPattern(pathPattern), _lastOpen(QDateTime::currentDateTime()),
+    _pathPattern(pathPattern),
+    _lastOpen(QDateTime::currentMSecsSinceEpoch()),
     _secondsReopenInterval(secondsReopenInterval), _buffered(buffered) {
   //qDebug() << "creating FileLogger from path" << pathPattern << this;
 }
@@ -50,6 +53,8 @@ FileLogger::FileLogger(QString pathPattern, Log::Severity minSeverity,
 FileLogger::~FileLogger() {
   if (_device)
     delete _device;
+  if (_indexWriter)
+    delete _indexWriter;
 }
 
 QString FileLogger::currentPath() const {
@@ -60,43 +65,119 @@ QString FileLogger::pathPattern() const {
   return _pathPattern;
 }
 
-void FileLogger::doLog(const LogEntry &entry) {
-  QDateTime now = QDateTime::currentDateTime();
-  if (!_pathPattern.isEmpty()
-      && (_device == 0
-          || (_secondsReopenInterval >= 0
-              && _lastOpen.secsTo(now) > _secondsReopenInterval))) {
-    //qDebug() << "*******************************************************"
-    //         << _pathPattern << _lastOpen << now << _secondsReopenInterval;
-    if (_device)
-      delete _device;
-    _currentPath = ParamSet().evaluate(_pathPattern);
-    _device = new QFile(_currentPath);
-    if (!_device->open(_buffered ? QIODevice::WriteOnly|QIODevice::Append
-                       : QIODevice::WriteOnly|QIODevice::Append
-                       |QIODevice::Unbuffered)) {
-      // TODO warn, but only once
-      //qWarning() << "cannot open log file" << _currentPath << ":"
-      //           << _device->errorString();
-      delete _device;
-      _device = 0;
-    } else {
-      _lastOpen = now;
-      //qDebug() << "opened log file" << _currentPath;
+void FileLogger::setRotation(qint64 maxBytes, int maxSeconds) {
+  _rotationMaxBytes = qMax(0LL, maxBytes);
+  _rotationMaxMs = qMax(0LL, maxSeconds*1000LL);
+}
+
+void FileLogger::setArchiving(bool compress, int maxFiles, int maxDays) {
+  _compressArchives = compress;
+  _retentionMaxFiles = qMax(0, maxFiles);
+  _retentionMaxAgeMs = qMax(0LL, maxDays*86400000LL);
+}
+
+void FileLogger::setIndexing(bool enabled) {
+  if (enabled && !_indexWriter)
+    _indexWriter = new LogFileIndexWriter;
+  else if (!enabled && _indexWriter) {
+    delete _indexWriter;
+    _indexWriter = 0;
+  }
+}
+
+void FileLogger::openFile(qint64 now) {
+  //qDebug() << "*******************************************************"
+  //         << _pathPattern << _lastOpen << now << _secondsReopenInterval;
+  QString previousPath = _currentPath;
+  if (_device)
+    delete _device;
+  _currentPath = ParamSet().evaluate(_pathPattern);
+  _device = new QFile(_currentPath);
+  if (!_device->open(_buffered ? QIODevice::WriteOnly|QIODevice::Append
+                     : QIODevice::WriteOnly|QIODevice::Append
+                     |QIODevice::Unbuffered)) {
+    // TODO warn, but only once
+    //qWarning() << "cannot open log file" << _currentPath << ":"
+    //           << _device->errorString();
+    delete _device;
+    _device = 0;
+    if (_indexWriter)
+      _indexWriter->close();
+  } else {
+    _lastOpen = now;
+    _currentSize = _device->size();
+    if (_indexWriter)
+      _indexWriter->open(_currentPath, _currentSize);
+    if (previousPath != _currentPath) {
+      _currentSince = now;
+      if (!previousPath.isEmpty())
+        archiveFiles();
     }
+    //qDebug() << "opened log file" << _currentPath;
+  }
+}
+
+void FileLogger::rotateFile(qint64 now) {
+  delete _device;
+  _device = 0;
+  QString rotatedPath = _currentPath+"."+QDateTime::fromMSecsSinceEpoch(now)
+      .toString("yyyyMMddhhmmsszzz");
+  if (_indexWriter)
+    _indexWriter->close();
+  if (QFile::rename(_currentPath, rotatedPath)) {
+    if (_indexWriter)
+      QFile::rename(LogFileIndex::indexPath(_currentPath),
+                    LogFileIndex::indexPath(rotatedPath));
+    _currentPath = QString(); // don't archive it twice
+    openFile(now);
+    archiveFiles();
+  } else {
+    // go on with the same file and retry after another rotation period
+    openFile(now);
+    _currentSize = 0;
+    _currentSince = now;
+  }
+}
+
+void FileLogger::archiveFiles() {
+  if (!_compressArchives && !_retentionMaxFiles && !_retentionMaxAgeMs)
+    return;
+  LogFileArchiver::Job job;
+  job._filesRegexp = ParamSet::matchingRegexp(_pathPattern)
+      +"(\\.[0-9]{17})?(\\.gz)?";
+  job._currentPath = _currentPath;
+  job._compress = _compressArchives;
+  job._maxFiles = _retentionMaxFiles;
+  job._maxAgeMs = _retentionMaxAgeMs;
+  // never blocks, and only fails during process exit
+  LogFileArchiver::enqueue(job);
+}
+
+void FileLogger::doLog(const LogEntry &entry) {
+  qint64 now = entry.timestampMsecs();
+  if (!_pathPattern.isEmpty()) {
+    if (_device == 0
+        || (_secondsReopenInterval >= 0
+            && (now-_lastOpen)/1000 > _secondsReopenInterval))
+      openFile(now);
+    else if ((_rotationMaxBytes && _currentSize >= _rotationMaxBytes)
+             || (_rotationMaxMs && now-_currentSince >= _rotationMaxMs))
+      rotateFile(now);
   }
   if (_device) {
-    // TODO move this to LogEntry::asLogLine()
-    QString line = QStringLiteral("%1 %2/%3 %4 %5 %6")
-        .arg(entry.timestamp()
-             .toString(QStringLiteral("yyyy-MM-ddThh:mm:ss,zzz")))
-        .arg(entry.task()).arg(entry.execId()).arg(entry.sourceCode())
-        .arg(entry.severityToString()).arg(entry.message()).append('\n');
+    QString line = entry.asLogLine().append('\n');
     //qDebug() << "***log" << line;
     QByteArray ba = line.toUtf8();
     //if (_pathPattern.endsWith(".slow") && (QTime::currentTime().second()/10)%2)
     //  ::usleep(1000000);
-    if (_device->write(ba) != ba.size()) {
+    qint64 written = _device->write(ba);
+    if (written > 0) {
+      _currentSize += written;
+      if (_indexWriter)
+        _indexWriter->add(written, entry.severity(), entry.task(),
+                          entry.execId());
+    }
+    if (written != ba.size()) {
       // TODO warn, but only once
       //qWarning() << "error while writing log:" << _device
       //           << _device->errorString();
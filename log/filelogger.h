@@ -20,15 +20,22 @@
 
 class QIODevice;
 class QThread;
+class LogFileIndexWriter;
 
 class LIBPUMPKINSHARED_EXPORT FileLogger : public Logger {
   Q_OBJECT
   Q_DISABLE_COPY(FileLogger)
   QIODevice *_device;
   QString _pathPattern, _currentPath;
-  QDateTime _lastOpen;
+  qint64 _lastOpen; // ms since 1970
   int _secondsReopenInterval;
   bool _buffered;
+  qint64 _currentSize = 0, _currentSince = 0; // bytes, ms since 1970
+  qint64 _rotationMaxBytes = 0, _rotationMaxMs = 0;
+  bool _compressArchives = false;
+  int _retentionMaxFiles = 0;
+  qint64 _retentionMaxAgeMs = 0;
+  LogFileIndexWriter *_indexWriter = 0;
 
 public:
   /** Takes ownership of the device (= will delete it).
@@ -42,9 +49,41 @@ public:
   ~FileLogger();
   QString currentPath() const;
   QString pathPattern() const;
+  /** Rotate log file when it reaches maxBytes or after maxSeconds (0 meaning
+   * never for both): the file is renamed with a timestamp suffix, e.g.
+   * "/var/log/qron.log.20181231235959999", and a new one is opened.
+   * Only applies to loggers created with a path pattern, and must be called
+   * before the logger is added to Log. */
+  void setRotation(qint64 maxBytes, int maxSeconds);
+  /** Archive files that are no longer written to, either because they were
+   * rotated or because the path pattern now evaluates to another path:
+   * optionaly compress them with gzip and keep only the maxFiles most recent
+   * ones not older than maxDays (0 meaning no limit for both).
+   * Retention applies to every file matching the path pattern except the
+   * current one, with or without rotation suffix and ".gz".
+   * This is done by a background thread with idle priority and never blocks
+   * logging.
+   * Only applies to loggers created with a path pattern, and must be called
+   * before the logger is added to Log. */
+  void setArchiving(bool compress, int maxFiles, int maxDays);
+  /** Maintain a sidecar index along with log files, e.g.
+   * "/var/log/qron.log.idx", to make LogFileIndex::search() read only the
+   * parts of the log files that may contain what is looked for.
+   * The index is kept when log files are compressed by archiving, each index
+   * block being compressed separately so that searches only inflate blocks
+   * that may match.
+   * Only applies to loggers created with a path pattern, and must be called
+   * before the logger is added to Log.
+   * @see LogFileIndex */
+  void setIndexing(bool enabled);
 
 protected:
   void doLog(const LogEntry &entry);
+
+private:
+  inline void openFile(qint64 now);
+  inline void rotateFile(qint64 now);
+  inline void archiveFiles();
 };
 
 #endif // FILELOGGER_H
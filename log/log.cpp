@@ -16,9 +16,13 @@
 #include <QList>
 #include <QString>
 #include <QDateTime>
-#include <QRegularExpression>
 #include <QThread>
 #include <time.h>
+#include <climits>
+#include <QHash>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 Q_GLOBAL_STATIC_WITH_ARGS(MultiplexerLogger, _rootLogger, (Log::Debug, true))
 
@@ -26,14 +30,13 @@ static inline MultiplexerLogger *rootLogger() { return _rootLogger(); }
 
 static QtMessageHandler _originalHandler = 0;
 static QMutex _qtHandlerMutex;
-static const QRegularExpression whitespace { "\\s+" };
 static const QString lineContinuation = "\n  ";
 static const QString defaultTask = "?";
 static const QString defaultExecid = "0";
 static const QString defaultSourceCode = ":";
 static const QString defaultTaskAndSourceCode = " ?/0 : ";
 static const QString eol = "\n";
-static const QString timestampFormat = "yyyy-MM-ddThh:mm:ss,zzz";
+static const QString timestampPrefixFormat = "yyyy-MM-ddThh:mm:ss,";
 static const QString severityDebug("DEBUG");
 static const QString severityInfo("INFO");
 static const QString severityWarning("WARNING");
@@ -41,19 +44,82 @@ static const QString severityError("ERROR");
 static const QString severityFatal("FATAL");
 static const QString severityUnknown("UNKNOWN");
 
-static inline QString sanitizeField(QString string) {
-  QString s(string);
-  // LATER optimize: avoid using a regexp 3 times per log line
-  s.replace(whitespace, "_");
-  return s;
+// same characters as \s in a non-unicode regexp: space, \t, \n, \v, \f, \r
+static inline bool isFieldSpace(ushort c) {
+  return c == ' ' || c-9u <= 4u;
+}
+
+static inline int indexOfFirstFieldSpace(const QChar *s, int size) {
+  int i = 0;
+#ifdef __SSE2__
+  // skip 8 chars at a time as long as none of them is a control char or space
+  const __m128i space = _mm_set1_epi16(' '), zero = _mm_setzero_si128();
+  for (; i+8 <= size; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s+i));
+    // unsigned saturated v-' ' is 0 iff v <= ' '
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, space), zero)))
+      break;
+  }
+#endif
+  for (; i < size; ++i)
+    if (isFieldSpace(s[i].unicode()))
+      return i;
+  return -1;
+}
+
+QString Log::sanitizeField(QString string) {
+  const QChar *s = string.constData();
+  int size = string.size();
+  int i = indexOfFirstFieldSpace(s, size);
+  if (i < 0)
+    return string; // most common case: no copy at all
+  QString sanitized;
+  sanitized.reserve(size);
+  sanitized.append(s, i);
+  while (i < size) {
+    if (isFieldSpace(s[i].unicode())) {
+      sanitized.append('_');
+      do {
+        ++i;
+      } while (i < size && isFieldSpace(s[i].unicode()));
+    } else {
+      sanitized.append(s[i++]);
+    }
+  }
+  return sanitized;
 }
 
 static inline QString sanitizeMessage(QString string) {
+  if (!string.contains('\n'))
+    return string;
   QString s(string);
   s.replace('\n', lineContinuation);
   return s;
 }
 
+namespace {
+/** Per-thread cache of sanitized task, execid and source code fields, keyed
+ * by their raw value, so that log entries share the same strings instead of
+ * sanitizing and allocating them again for every log line. */
+struct SanitizedFieldsCache {
+  // bounded since execids are often unique: start again when full
+  static const int _maxSize = 1024;
+  QHash<QString,QString> _fields;
+  QString sanitized(const QString &raw, const QString &defaultValue) {
+    if (raw.isEmpty())
+      return defaultValue;
+    auto it = _fields.constFind(raw);
+    if (it != _fields.constEnd())
+      return it.value();
+    if (_fields.size() >= _maxSize)
+      _fields.clear();
+    QString s = Log::sanitizeField(raw);
+    _fields.insert(raw, s);
+    return s;
+  }
+};
+}
+
 void Log::addLogger(Logger *logger, bool autoRemovable, bool takeOwnership) {
   rootLogger()->addLogger(logger, autoRemovable, takeOwnership);
 }
@@ -86,20 +152,51 @@ void Log::replaceLoggersPlusConsole(Log::Severity consoleLoggerSeverity,
 
 void Log::log(QString message, Severity severity, QString task, QString execId,
               QString sourceCode) {
-  QString realTask(task);
-  if (realTask.isNull()) {
+  // filter before building anything
+  if (!rootLogger()->isSeverityEnabled(severity))
+    return;
+  static thread_local SanitizedFieldsCache cache;
+  if (task.isNull()) {
     QThread *t(QThread::currentThread());
     if (t)
-      realTask = t->objectName();
+      task = t->objectName();
   }
-  realTask = realTask.isEmpty() ? defaultTask : sanitizeField(realTask);
-  QString realExecId = execId.isEmpty() ? defaultExecid : sanitizeField(execId);
-  QString realSourceCode
-      = sourceCode.isEmpty() ? defaultSourceCode : sanitizeField(sourceCode);
-  QDateTime now = QDateTime::currentDateTime();
-  message = sanitizeMessage(message);
-  rootLogger()->log(Logger::LogEntry(now, message, severity, realTask,
-                                     realExecId, realSourceCode));
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  rootLogger()->log(Logger::LogEntry(
+                      now, sanitizeMessage(message), severity,
+                      cache.sanitized(task, defaultTask),
+                      cache.sanitized(execId, defaultExecid),
+                      cache.sanitized(sourceCode, defaultSourceCode)));
+}
+
+bool Log::isSeverityEnabled(Severity severity) {
+  return rootLogger()->isSeverityEnabled(severity);
+}
+
+namespace {
+struct TimestampPrefixCache {
+  qint64 _second = LLONG_MIN;
+  QString _prefix;
+};
+}
+
+QString Log::timestampToText(qint64 msecs, bool utc) {
+  static thread_local TimestampPrefixCache localCache, utcCache;
+  TimestampPrefixCache &cache = utc ? utcCache : localCache;
+  // floor division, to stay correct before 1970
+  qint64 second = msecs >= 0 ? msecs/1000 : (msecs-999)/1000;
+  int millis = msecs-second*1000;
+  if (second != cache._second) {
+    cache._prefix = QDateTime::fromMSecsSinceEpoch(
+          second*1000, utc ? Qt::UTC : Qt::LocalTime)
+        .toString(timestampPrefixFormat);
+    cache._second = second;
+  }
+  QString s;
+  s.reserve(cache._prefix.size()+3);
+  s.append(cache._prefix).append(QChar('0'+millis/100))
+      .append(QChar('0'+millis/10%10)).append(QChar('0'+millis%10));
+  return s;
 }
 
 QString Log::severityToString(Severity severity) {
@@ -174,7 +271,7 @@ static void qtLogSamePatternWrapper(QtMsgType type, const QMessageLogContext &,
     severity = severityUnknown;
   }
   QByteArray localMsg =
-      (QDateTime::currentDateTime().toString(timestampFormat)
+      (Log::timestampToText(QDateTime::currentMSecsSinceEpoch())
       +defaultTaskAndSourceCode+severity+QStringLiteral(" ")
       +sanitizeMessage(msg)+eol).toLocal8Bit();
   /*int localLen = strlen(localMsg);
@@ -65,7 +65,23 @@ public:
   static void log(QString message, Severity severity = Info,
                   QString task = QString(), QString execId = QString(),
                   QString sourceCode = QString());
+  /** Tell if a log entry of this severity would be written by at less one
+   * logger. Entries that would not are discarded before being built.
+   * Lock-free and cheap enough to be called for every log entry. */
+  static bool isSeverityEnabled(Severity severity);
+  /** Make a string usable as a log line field (task, execid, source code) by
+   * replacing each sequence of whitespace characters with a single "_".
+   * Return the string itself, without any copy, when there is nothing to
+   * replace, which is by far the most common case. */
+  static QString sanitizeField(QString string);
   static QString severityToString(Severity severity);
+  /** Format a timestamp the way log files do, e.g. "2018-12-31T23:59:59,999".
+   * The "yyyy-MM-ddThh:mm:ss," prefix is computed at most once per second
+   * and per thread, then only the milliseconds are appended, which avoids a
+   * QDateTime time zone conversion and formatting for every log entry.
+   * @param msecs milliseconds since 1970-01-01 00:00:00 UTC
+   * @param utc format in UTC rather than in local time */
+  static QString timestampToText(qint64 msecs, bool utc = false);
   /** Very tolerant severity mnemonic reader.
    * Read first character of string in a case insensitive manner, e.g.
    * "W", "warn", "warning", and "war against terror" are all interpreted
@@ -138,6 +154,8 @@ private:
 Q_DECLARE_METATYPE(Log::Severity)
 
 class LIBPUMPKINSHARED_EXPORT LogHelper {
+  // _logOnDestroy is false when the severity is disabled, in which case
+  // the message is not even built
   mutable bool _logOnDestroy;
   Log::Severity _severity;
   QString _message, _task, _execId, _sourceCode;
@@ -145,8 +163,10 @@ class LIBPUMPKINSHARED_EXPORT LogHelper {
 public:
   inline LogHelper(Log::Severity severity, QString task, QString execId,
                    QString sourceCode)
-    : _logOnDestroy(true), _severity(severity), _task(task), _execId(execId),
-      _sourceCode(sourceCode) {
+    : _logOnDestroy(Log::isSeverityEnabled(severity)), _severity(severity),
+      _task(task), _execId(execId), _sourceCode(sourceCode) {
+    if (_logOnDestroy)
+      _message.reserve(128); // avoid most reallocations while appending
   }
   // The following copy constructor is needed because static Log::*() methods
   // return LogHelper by value. It must never be called in another context,
@@ -154,7 +174,8 @@ public:
   // Compilers are likely not to use the copy constructor at all, for instance
   // GCC won't use it but if it is called with -fno-elide-constructors option.
   inline LogHelper(const LogHelper &other)
-    : _logOnDestroy(true), _severity(other._severity), _message(other._message),
+    : _logOnDestroy(other._logOnDestroy), _severity(other._severity),
+      _message(other._message),
       _task(other._task), _execId(other._execId),
       _sourceCode(other._sourceCode) {
     other._logOnDestroy = false;
@@ -167,47 +188,88 @@ public:
     }
   }
   inline LogHelper &operator<<(const QString &o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(const QLatin1String &o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(const QStringRef &o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(const QByteArray &o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(const QChar &o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(const char *o) {
-    _message.append(o); return *this; }
+    if (_logOnDestroy)
+      _message.append(o);
+    return *this; }
   inline LogHelper &operator<<(qint8 o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(quint8 o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(short o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(ushort o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(int o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(uint o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(long o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(ulong o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(qlonglong o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(qulonglong o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(double o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(float o) {
-    _message.append(QString::number(o)); return *this; }
+    if (_logOnDestroy)
+      _message.append(QString::number(o));
+    return *this; }
   inline LogHelper &operator<<(bool o) {
-    _message.append(o ? QStringLiteral("true") : QStringLiteral("false"));
+    if (_logOnDestroy)
+      _message.append(o ? QStringLiteral("true") : QStringLiteral("false"));
     return *this; }
   inline LogHelper &operator<<(const QVariant &o) {
-    _message.append(o.toString()); return *this; }
+    if (_logOnDestroy)
+      _message.append(o.toString());
+    return *this; }
   inline LogHelper &operator<<(const QList<QString> &o) {
+    if (!_logOnDestroy)
+      return *this;
     _message.append("{ ");
     foreach (QString s, o) {
       s.replace('\\', "\\\\").replace('"', "\\\"");
@@ -216,6 +278,8 @@ public:
     _message.append("}");
     return *this; }
   inline LogHelper &operator<<(const QSet<QString> &o) {
+    if (!_logOnDestroy)
+      return *this;
     _message.append("{ ");
     foreach (QString s, o) {
       s.replace('\\', "\\\\").replace('"', "\\\"");
@@ -224,6 +288,8 @@ public:
     _message.append("}");
     return *this; }
   inline LogHelper &operator<<(const QObject *o) {
+    if (!_logOnDestroy)
+      return *this;
     const QMetaObject *mo = o ? o->metaObject() : 0;
     if (mo)
       _message.append(mo->className()).append("(0x")
@@ -235,6 +301,8 @@ public:
   inline LogHelper &operator<<(const QObject &o) {
     return operator<<(&o); }
   inline LogHelper &operator<<(const void *o) {
+    if (!_logOnDestroy)
+      return *this;
     _message.append("0x").append(QString::number((quint64)o, 16));
     return *this; }
 };
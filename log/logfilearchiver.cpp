@@ -0,0 +1,220 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "logfilearchiver.h"
+#include "util/ioutils.h"
+#include "logfileindex.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QtDebug>
+#include <algorithm>
+#include <zlib.h>
+
+#define GZIP_BUFFER_SIZE 65536
+
+Q_GLOBAL_STATIC(LogFileArchiver, _instance)
+
+LogFileArchiver::LogFileArchiver() : QThread(0), _jobs(8) {
+  setObjectName("LogFileArchiver");
+  // IdlePriority means SCHED_IDLE on Linux: never compete with real work
+  start(QThread::IdlePriority);
+}
+
+LogFileArchiver::~LogFileArchiver() {
+  requestInterruption();
+  wait();
+}
+
+bool LogFileArchiver::enqueue(Job job) {
+  LogFileArchiver *archiver = _instance();
+  if (!archiver)
+    return false;
+  if (!archiver->_jobs.tryPut(job)) {
+    // a newer job for the same files supersedes the pending one
+    QMutexLocker ml(&archiver->_overflowMutex);
+    archiver->_overflow.insert(job._filesRegexp, job);
+  }
+  return true;
+}
+
+bool LogFileArchiver::takeOverflownJob(Job *job) {
+  QMutexLocker ml(&_overflowMutex);
+  if (_overflow.isEmpty())
+    return false;
+  *job = _overflow.take(_overflow.firstKey());
+  return true;
+}
+
+void LogFileArchiver::run() {
+  while (!isInterruptionRequested()) {
+    Job job;
+    if (_jobs.tryGet(&job, 500) || takeOverflownJob(&job))
+      archive(job);
+  }
+}
+
+void LogFileArchiver::archive(const Job &job) {
+  if (job._filesRegexp.isEmpty())
+    return;
+  QString currentPath = QFileInfo(job._currentPath).absoluteFilePath();
+  QList<QFileInfo> files;
+  foreach (const QString &path, IOUtils::findFiles(job._filesRegexp)) {
+    QFileInfo fi(path);
+    if (fi.absoluteFilePath() != currentPath)
+      files.append(fi);
+  }
+  applyRetention(job, &files);
+  if (!job._compress)
+    return;
+  // not only the file that was just rotated, also any file left behind by a
+  // previous crash or process exit
+  foreach (const QFileInfo &fi, files)
+    if (!fi.fileName().endsWith(".gz") && !gzipFile(fi.filePath()))
+      qWarning() << "cannot compress log file" << fi.filePath();
+}
+
+/** Compress [begin,end[ range of input as a whole gzip member appended to
+ * output. Empty ranges produce no member. */
+static bool gzipMember(z_stream *zs, QFile *input, qint64 begin, qint64 end,
+                       QFile *output) {
+  if (begin >= end)
+    return true;
+  if (!input->seek(begin) || deflateReset(zs) != Z_OK)
+    return false;
+  char in[GZIP_BUFFER_SIZE], out[GZIP_BUFFER_SIZE];
+  qint64 remaining = end-begin;
+  int flush = Z_NO_FLUSH, rc;
+  do {
+    qint64 n = input->read(in, qMin(remaining, qint64(sizeof in)));
+    if (n <= 0)
+      return false; // file is shorter than its index
+    remaining -= n;
+    flush = remaining ? Z_NO_FLUSH : Z_FINISH;
+    zs->next_in = (Bytef*)in;
+    zs->avail_in = uInt(n);
+    do {
+      zs->next_out = (Bytef*)out;
+      zs->avail_out = sizeof out;
+      rc = deflate(zs, flush);
+      if (rc == Z_STREAM_ERROR)
+        return false;
+      qint64 produced = qint64(sizeof out)-zs->avail_out;
+      if (output->write(out, produced) != produced)
+        return false;
+    } while (zs->avail_out == 0);
+  } while (flush != Z_FINISH);
+  return rc == Z_STREAM_END;
+}
+
+bool LogFileArchiver::gzipFile(QString path) {
+  QFile input(path);
+  if (!input.open(QIODevice::ReadOnly))
+    return false;
+  QString gzPath = path+".gz", tmpPath = gzPath+".tmp",
+      indexPath = LogFileIndex::indexPath(path),
+      gzIndexPath = LogFileIndex::indexPath(gzPath),
+      tmpIndexPath = gzIndexPath+".tmp";
+  QFile output(tmpPath);
+  if (!output.open(QIODevice::WriteOnly|QIODevice::Truncate))
+    return false;
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  // 15+16 window bits: 32k window with gzip header and trailer
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    output.remove();
+    return false;
+  }
+  // every index block is compressed as a separate gzip member, which lets
+  // searches only inflate blocks that may match, and so is every range not
+  // covered by the index; the result is still a regular gzip file
+  QList<LogFileIndex::Block> blocks = LogFileIndex::blocks(path);
+  qint64 pos = 0, size = input.size();
+  bool success = true;
+  for (int i = 0; success && i < blocks.size(); ++i) {
+    LogFileIndex::Block &block = blocks[i];
+    if (block._begin < pos) { // overlapping blocks, should not happen
+      blocks.removeAt(i--);
+      continue;
+    }
+    success = gzipMember(&zs, &input, pos, block._begin, &output);
+    block._gzBegin = output.pos();
+    success = success
+        && gzipMember(&zs, &input, block._begin, block._end, &output);
+    block._gzEnd = output.pos();
+    pos = block._end;
+  }
+  success = success && gzipMember(&zs, &input, pos, size, &output);
+  deflateEnd(&zs);
+  if (!output.flush())
+    success = false;
+  output.close();
+  input.close();
+  if (success && !blocks.isEmpty())
+    success = LogFileIndex::writeCompressedIndex(tmpIndexPath, blocks);
+#if QT_VERSION >= 0x050a00
+  if (success) {
+    // retention relies on modification time, which must not be reset
+    QFile tmp(tmpPath);
+    if (tmp.open(QIODevice::ReadWrite))
+      tmp.setFileTime(QFileInfo(path).lastModified(),
+                      QFileDevice::FileModificationTime);
+  }
+#endif
+  if (success) {
+    // a stale index must never describe the new compressed file
+    QFile::remove(gzIndexPath);
+    QFile::remove(gzPath);
+    success = QFile::rename(tmpPath, gzPath);
+  }
+  if (success) {
+    // without index, the compressed file will be searched entirely
+    if (!blocks.isEmpty() && !QFile::rename(tmpIndexPath, gzIndexPath))
+      QFile::remove(tmpIndexPath);
+    QFile::remove(path);
+    QFile::remove(indexPath);
+  } else {
+    QFile::remove(tmpPath);
+    QFile::remove(tmpIndexPath);
+  }
+  return success;
+}
+
+void LogFileArchiver::applyRetention(const Job &job,
+                                     QList<QFileInfo> *files) {
+  if (job._maxFiles <= 0 && job._maxAgeMs <= 0)
+    return;
+  // newest first
+  std::sort(files->begin(), files->end(),
+            [](const QFileInfo &a, const QFileInfo &b) {
+    return a.lastModified() > b.lastModified();
+  });
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QList<QFileInfo> kept;
+  for (int i = 0; i < files->size(); ++i) {
+    const QFileInfo &fi = files->at(i);
+    if ((job._maxFiles > 0 && i >= job._maxFiles)
+        || (job._maxAgeMs > 0
+            && now-fi.lastModified().toMSecsSinceEpoch() > job._maxAgeMs)) {
+      if (!QFile::remove(fi.filePath()))
+        qWarning() << "cannot remove old log file" << fi.filePath();
+      QFile::remove(LogFileIndex::indexPath(fi.filePath()));
+    } else {
+      kept.append(fi);
+    }
+  }
+  *files = kept;
+}
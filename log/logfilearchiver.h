@@ -0,0 +1,75 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LOGFILEARCHIVER_H
+#define LOGFILEARCHIVER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QMap>
+#include "thread/circularbuffer.h"
+#include "libp6core_global.h"
+
+class QFileInfo;
+
+/** Thread class used internally by FileLogger to compress rotated log files
+ * and remove old ones, with idle priority.
+ * A job applies to every archived file of a logger rather than to one file:
+ * it compresses any of them not compressed yet and applies retention, so that
+ * a job does whatever previous jobs of the same logger would have done.
+ * Jobs are queued without ever blocking nor being lost: if the queue is full
+ * the job is kept aside in place of any pending job for the same files.
+ * Errors are reported through Qt's log framework rather than Log, to avoid
+ * feeding loggers from their own archiving.
+ * @see FileLogger */
+class LIBPUMPKINSHARED_EXPORT LogFileArchiver : public QThread {
+  Q_OBJECT
+  Q_DISABLE_COPY(LogFileArchiver)
+
+public:
+  class Job {
+  public:
+    QString _filesRegexp; // files to archive
+    QString _currentPath; // never compressed or removed
+    bool _compress = false;
+    int _maxFiles = 0; // 0: no limit
+    qint64 _maxAgeMs = 0; // 0: no limit
+  };
+
+private:
+  CircularBuffer<Job> _jobs;
+  QMutex _overflowMutex;
+  QMap<QString,Job> _overflow; // jobs that did not fit in queue, by regexp
+
+public:
+  LogFileArchiver();
+  ~LogFileArchiver();
+  /** Queue a job for the background thread, starting it if needed.
+   * This method is thread-safe and never blocks.
+   * @return false if the archiver is no longer available (process exit) */
+  static bool enqueue(Job job);
+  /** Compress a file to path+".gz" with gzip, keeping its modification time,
+   * then remove it.
+   * Can be called from any thread, blocks until done. */
+  static bool gzipFile(QString path);
+
+protected:
+  void run();
+
+private:
+  bool takeOverflownJob(Job *job);
+  void archive(const Job &job);
+  void applyRetention(const Job &job, QList<QFileInfo> *files);
+};
+
+#endif // LOGFILEARCHIVER_H
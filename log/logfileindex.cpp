@@ -0,0 +1,323 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "logfileindex.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <algorithm>
+#include <zlib.h>
+
+#define GUNZIP_BUFFER_SIZE 65536
+
+namespace {
+
+/** Filter log lines, keeping continuation lines of multiline messages with
+ * their entry. */
+class EntriesCollector {
+  QString _task, _execId;
+  QByteArray _needle;
+  Log::Severity _minSeverity;
+  QStringList *_entries;
+  bool _inMatchingEntry = false;
+
+public:
+  EntriesCollector(QString task, QString execId, Log::Severity minSeverity,
+                   QStringList *entries)
+    : _task(task), _execId(execId),
+      _needle((execId.isEmpty() ? task : execId).toUtf8()),
+      _minSeverity(minSeverity), _entries(entries) { }
+  void addLine(QByteArray raw) {
+    if (raw.endsWith('\n'))
+      raw.chop(1);
+    if (raw.startsWith("  ")) { // continuation line, see Log::log()
+      if (_inMatchingEntry)
+        _entries->last().append('\n').append(QString::fromUtf8(raw));
+      return;
+    }
+    // avoid decoding most of the lines that cannot match
+    if (!_needle.isEmpty() && !raw.contains(_needle)) {
+      _inMatchingEntry = false;
+      return;
+    }
+    QString line = QString::fromUtf8(raw);
+    _inMatchingEntry = matches(line);
+    if (_inMatchingEntry)
+      _entries->append(line);
+  }
+  void startRange() { _inMatchingEntry = false; }
+
+private:
+  // line format: timestamp task/execid sourcecode severity message
+  bool matches(const QString &line) const {
+    int s1 = line.indexOf(' ');
+    int s2 = s1 < 0 ? -1 : line.indexOf(' ', s1+1);
+    int s3 = s2 < 0 ? -1 : line.indexOf(' ', s2+1);
+    if (s3 < 0 || s3+1 >= line.size())
+      return false;
+    QStringRef taskAndExecId = line.midRef(s1+1, s2-s1-1);
+    int slash = taskAndExecId.lastIndexOf('/');
+    if (slash < 0)
+      return false;
+    if (!_task.isEmpty() && taskAndExecId.left(slash) != _task)
+      return false;
+    if (!_execId.isEmpty() && taskAndExecId.mid(slash+1) != _execId)
+      return false;
+    return _minSeverity == Log::Debug
+        || Log::severityFromString(line.mid(s3+1, 1)) >= _minSeverity;
+  }
+};
+
+} // unnamed namespace
+
+static void scanRange(QFile *file, qint64 begin, qint64 end,
+                      EntriesCollector *collector) {
+  if (!file->seek(begin))
+    return;
+  collector->startRange();
+  while ((end < 0 || file->pos() < end) && !file->atEnd())
+    collector->addLine(file->readLine());
+}
+
+/** Inflate [begin,end[ range of a gzip file, which must hold whole gzip
+ * members, end < 0 meaning until end of file. */
+static void scanGzRange(QFile *file, qint64 begin, qint64 end,
+                        EntriesCollector *collector) {
+  if (!file->seek(begin))
+    return;
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  zs.next_in = Z_NULL;
+  zs.avail_in = 0;
+  if (inflateInit2(&zs, 16+MAX_WBITS) != Z_OK)
+    return;
+  collector->startRange();
+  char in[GUNZIP_BUFFER_SIZE], out[GUNZIP_BUFFER_SIZE];
+  QByteArray data;
+  bool failed = false;
+  while (!failed && (end < 0 || file->pos() < end)) {
+    qint64 n = file->read(in, end < 0 ? qint64(sizeof in)
+                                      : qMin(qint64(sizeof in),
+                                             end-file->pos()));
+    if (n <= 0)
+      break;
+    zs.next_in = (Bytef*)in;
+    zs.avail_in = uInt(n);
+    do {
+      zs.next_out = (Bytef*)out;
+      zs.avail_out = sizeof out;
+      int rc = inflate(&zs, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END)
+        rc = inflateReset(&zs); // next member, if any
+      else if (rc == Z_BUF_ERROR)
+        break; // needs more input
+      if (rc != Z_OK) {
+        failed = true; // corrupted data: give up this range
+        break;
+      }
+      data.append(out, int(sizeof out-zs.avail_out));
+      int i = 0, eol;
+      while ((eol = data.indexOf('\n', i)) >= 0) {
+        collector->addLine(data.mid(i, eol-i+1));
+        i = eol+1;
+      }
+      data.remove(0, i);
+    } while (zs.avail_in > 0 || zs.avail_out == 0);
+  }
+  if (!failed && !data.isEmpty())
+    collector->addLine(data);
+  inflateEnd(&zs);
+}
+
+bool LogFileIndex::Block::mayMatch(
+    QString task, QString execId, Log::Severity minSeverity) const {
+  if (!(_severities >> minSeverity))
+    return false;
+  if (!task.isEmpty()
+      && !std::binary_search(_tasks.begin(), _tasks.end(), task))
+    return false;
+  if (!execId.isEmpty()
+      && !std::binary_search(_execIds.begin(), _execIds.end(), execId))
+    return false;
+  return true;
+}
+
+QList<LogFileIndex::Block> LogFileIndex::blocks(QString logPath) {
+  QList<Block> blocks;
+  QFile file(indexPath(logPath));
+  if (!file.open(QIODevice::ReadOnly))
+    return blocks;
+  bool compressed = logPath.endsWith(".gz");
+  qint64 logSize = QFileInfo(logPath).size();
+  QDataStream in(&file);
+  in.setVersion(QDataStream::Qt_5_0);
+  while (!in.atEnd()) {
+    Block block;
+    in >> block;
+    if (compressed)
+      in >> block._gzBegin >> block._gzEnd;
+    if (in.status() != QDataStream::Ok)
+      break; // last block was being written or was truncated by a crash
+    if (compressed) {
+      if (block._gzBegin < 0 || block._gzEnd > logSize)
+        return QList<Block>(); // does not describe this file
+      blocks.append(block);
+    } else if (block._begin >= 0 && block._end <= logSize) {
+      // ignore blocks describing data not yet flushed to the log file, they
+      // will be scanned as non-indexed data
+      blocks.append(block);
+    }
+  }
+  std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) {
+    return a._begin < b._begin;
+  });
+  return blocks;
+}
+
+bool LogFileIndex::writeCompressedIndex(QString indexPath,
+                                        const QList<Block> &blocks) {
+  QFile file(indexPath);
+  if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate))
+    return false;
+  QDataStream out(&file);
+  out.setVersion(QDataStream::Qt_5_0);
+  foreach (const Block &block, blocks)
+    out << block << block._gzBegin << block._gzEnd;
+  return out.status() == QDataStream::Ok && file.flush();
+}
+
+QStringList LogFileIndex::search(
+    QString logPath, QString task, QString execId,
+    Log::Severity minSeverity) {
+  QStringList entries;
+  EntriesCollector collector(task, execId, minSeverity, &entries);
+  QList<Block> blocks = LogFileIndex::blocks(logPath);
+  if (logPath.endsWith(".gz") && !blocks.isEmpty()) {
+    QFile file(logPath);
+    if (!file.open(QIODevice::ReadOnly))
+      return entries;
+    qint64 pos = 0;
+    foreach (const Block &block, blocks) {
+      if (pos < block._gzBegin) // not indexed
+        scanGzRange(&file, pos, block._gzBegin, &collector);
+      if (block.mayMatch(task, execId, minSeverity))
+        scanGzRange(&file, block._gzBegin, block._gzEnd, &collector);
+      pos = qMax(pos, block._gzEnd);
+    }
+    scanGzRange(&file, pos, -1, &collector); // not indexed
+    return entries;
+  }
+  if (logPath.endsWith(".gz")) {
+    gzFile in = gzopen(QFile::encodeName(logPath).constData(), "rb");
+    if (!in)
+      return entries;
+    char buf[65536];
+    QByteArray line;
+    while (gzgets(in, buf, sizeof buf)) {
+      line.append(buf);
+      if (line.endsWith('\n')) {
+        collector.addLine(line);
+        line.clear();
+      }
+    }
+    if (!line.isEmpty())
+      collector.addLine(line);
+    gzclose(in);
+    return entries;
+  }
+  QFile file(logPath);
+  if (!file.open(QIODevice::ReadOnly))
+    return entries;
+  qint64 pos = 0;
+  foreach (const Block &block, blocks) {
+    if (pos < block._begin) // not indexed
+      scanRange(&file, pos, block._begin, &collector);
+    if (block.mayMatch(task, execId, minSeverity))
+      scanRange(&file, block._begin, block._end, &collector);
+    pos = qMax(pos, block._end);
+  }
+  scanRange(&file, pos, -1, &collector); // not indexed yet
+  return entries;
+}
+
+QStringList LogFileIndex::search(
+    QStringList logPaths, QString task, QString execId,
+    Log::Severity minSeverity) {
+  QStringList entries;
+  foreach (const QString &logPath, logPaths)
+    entries.append(search(logPath, task, execId, minSeverity));
+  return entries;
+}
+
+QDataStream &operator<<(QDataStream &out, const LogFileIndex::Block &block) {
+  return out << block._begin << block._end << block._severities
+             << block._tasks << block._execIds;
+}
+
+QDataStream &operator>>(QDataStream &in, LogFileIndex::Block &block) {
+  return in >> block._begin >> block._end >> block._severities
+            >> block._tasks >> block._execIds;
+}
+
+void LogFileIndexWriter::open(QString logPath, qint64 offset) {
+  QString indexPath = LogFileIndex::indexPath(logPath);
+  if (indexPath == _indexPath && offset == _offset)
+    return; // same file reopened, go on with current block
+  close();
+  _indexPath = indexPath;
+  _offset = offset;
+  if (offset == 0) // new log file: any index is a leftover
+    QFile::remove(_indexPath);
+}
+
+void LogFileIndexWriter::add(qint64 size, Log::Severity severity, QString task,
+                             QString execId) {
+  if (_indexPath.isEmpty())
+    return;
+  if (_block.isEmpty())
+    _block._begin = _offset;
+  _offset += size;
+  _block._end = _offset;
+  _block._severities |= 1 << severity;
+  _tasks.insert(task);
+  _execIds.insert(execId);
+  if (_block._end-_block._begin >= _blockSize)
+    flush();
+}
+
+void LogFileIndexWriter::flush() {
+  if (_indexPath.isEmpty() || _block.isEmpty())
+    return;
+  foreach (const QString &task, _tasks)
+    _block._tasks.append(task);
+  std::sort(_block._tasks.begin(), _block._tasks.end());
+  foreach (const QString &execId, _execIds)
+    _block._execIds.append(execId);
+  std::sort(_block._execIds.begin(), _block._execIds.end());
+  QFile file(_indexPath);
+  if (file.open(QIODevice::WriteOnly|QIODevice::Append)) {
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << _block;
+  }
+  _block = LogFileIndex::Block();
+  _tasks.clear();
+  _execIds.clear();
+}
+
+void LogFileIndexWriter::close() {
+  flush();
+  _indexPath.clear();
+}
@@ -0,0 +1,101 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LOGFILEINDEX_H
+#define LOGFILEINDEX_H
+
+#include "log.h"
+#include <QStringList>
+#include <QSet>
+
+class QDataStream;
+
+/** Sidecar index of a log file, e.g. "/var/log/qron.log.idx" for
+ * "/var/log/qron.log", made of blocks each describing a range of lines of
+ * the log file: which severities, tasks and execids appear in it.
+ * This enables looking for the log entries of a given task or execution
+ * without reading the whole log file, only blocks that may contain them.
+ * Index files are written by FileLogger when indexing is enabled.
+ * @see FileLogger::setIndexing() */
+class LIBPUMPKINSHARED_EXPORT LogFileIndex {
+public:
+  class Block {
+  public:
+    qint64 _begin = 0, _end = 0; // byte offsets in log file, end excluded
+    // compressed log files only: byte offsets of the gzip member holding the
+    // block in the *.gz file, end excluded
+    qint64 _gzBegin = -1, _gzEnd = -1;
+    quint8 _severities = 0; // 1 << Log::Severity for each severity found
+    QStringList _tasks, _execIds; // sorted
+    bool isEmpty() const { return _end <= _begin; }
+    bool mayMatch(QString task, QString execId,
+                  Log::Severity minSeverity) const;
+  };
+
+  static QString indexPath(QString logPath) { return logPath+".idx"; }
+  /** Read index blocks of a log file, sorted by offset.
+   * Return an empty list if there is no index. */
+  static QList<Block> blocks(QString logPath);
+  /** Write the whole index of a compressed log file, including blocks
+   * compressed offsets, to indexPath.
+   * Used by log files archiving when compressing an indexed log file. */
+  static bool writeCompressedIndex(QString indexPath,
+                                   const QList<Block> &blocks);
+  /** Return log entries of a log file matching every criterion, empty or null
+   * criteria matching anything. Each entry is a log line, plus its
+   * continuation lines for multiline messages, without trailing newline.
+   * Only blocks that may contain matching entries are read, along with parts
+   * of the file that are not indexed (yet), therefore this method works the
+   * same, only slower, without index. Gzipped files (*.gz) compressed along
+   * with their index only inflate blocks that may match, other gzipped files
+   * are inflated entirely. */
+  static QStringList search(QString logPath, QString task, QString execId,
+                            Log::Severity minSeverity = Log::Debug);
+  /** Same as search(QString...) for several files, e.g. the result of
+   * Log::pathsToAllLogs() */
+  static QStringList search(QStringList logPaths, QString task,
+                            QString execId,
+                            Log::Severity minSeverity = Log::Debug);
+
+private:
+  LogFileIndex() { }
+};
+
+QDataStream &operator<<(QDataStream &out, const LogFileIndex::Block &block);
+QDataStream &operator>>(QDataStream &in, LogFileIndex::Block &block);
+
+/** Accumulate what is written to a log file and append a block to its index
+ * file every time blockSize bytes of log have been written.
+ * Used internally by FileLogger, not thread-safe.
+ * @see LogFileIndex */
+class LIBPUMPKINSHARED_EXPORT LogFileIndexWriter {
+  QString _indexPath;
+  qint64 _offset, _blockSize;
+  LogFileIndex::Block _block;
+  QSet<QString> _tasks, _execIds;
+
+public:
+  explicit LogFileIndexWriter(qint64 blockSize = 65536)
+    : _offset(0), _blockSize(blockSize) { }
+  ~LogFileIndexWriter() { close(); }
+  /** Start indexing a log file, which current size is offset. */
+  void open(QString logPath, qint64 offset);
+  /** Record an entry of size bytes just written to the log file. */
+  void add(qint64 size, Log::Severity severity, QString task, QString execId);
+  /** Write current block, if any, to index file. */
+  void flush();
+  /** Flush and stop indexing. */
+  void close();
+};
+
+#endif // LOGFILEINDEX_H
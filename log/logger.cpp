@@ -17,8 +17,6 @@
 #include "util/paramset.h"
 #include "format/timeformats.h"
 
-#define ISO8601 QStringLiteral("yyyy-MM-ddThh:mm:ss,zzz")
-
 static QString _uiHeaderNames[] = {
   "Timestamp", // 0
   "Task",
@@ -28,28 +26,29 @@ static QString _uiHeaderNames[] = {
   "Message" // 5
 };
 
-static QAtomicInt _sequence;
+static QAtomicInteger<quint64> _sequence;
 
 class Logger::LogEntryData : public SharedUiItemData {
 public:
-  QString _id;
-  QDateTime _timestamp;
+  quint64 _id;
+  qint64 _timestamp;
   QString _message;
   Log::Severity _severity;
   QString _task, _execId, _sourceCode;
-  LogEntryData(QDateTime timestamp, QString message, Log::Severity severity,
+  LogEntryData(qint64 timestamp, QString message, Log::Severity severity,
                QString task, QString execId, QString sourceCode)
-    : _id(QString::number(_sequence.fetchAndAddOrdered(1))),
+    : _id(_sequence.fetchAndAddRelaxed(1)),
       _timestamp(timestamp), _message(message), _severity(severity),
       _task(task), _execId(execId), _sourceCode(sourceCode) { }
   QVariant uiData(int section, int role) const;
   QVariant uiHeaderData(int section, int role) const;
   int uiSectionCount() const;
-  QString id() const { return _id; }
+  // string id is only built when needed by a model
+  QString id() const { return QString::number(_id); }
   QString idQualifier() const { return "logentry"; }
 };
 
-Logger::LogEntry::LogEntry(QDateTime timestamp, QString message,
+Logger::LogEntry::LogEntry(qint64 timestamp, QString message,
                            Log::Severity severity, QString task,
                            QString execId, QString sourceCode)
   : SharedUiItem(new LogEntryData(timestamp, message, severity, task, execId,
@@ -57,6 +56,15 @@ Logger::LogEntry::LogEntry(QDateTime timestamp, QString message,
 
 }
 
+Logger::LogEntry::LogEntry(QDateTime timestamp, QString message,
+                           Log::Severity severity, QString task,
+                           QString execId, QString sourceCode)
+  : SharedUiItem(new LogEntryData(
+                   timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : 0,
+                   message, severity, task, execId, sourceCode)) {
+
+}
+
 Logger::LogEntry::LogEntry() {
 }
 
@@ -65,7 +73,20 @@ Logger::LogEntry::LogEntry(const Logger::LogEntry &other)
 }
 
 QDateTime Logger::LogEntry::timestamp() const {
-  return isNull() ? QDateTime() : data()->_timestamp;
+  return isNull() ? QDateTime()
+                  : QDateTime::fromMSecsSinceEpoch(data()->_timestamp);
+}
+
+quint64 Logger::LogEntry::sequenceNumber() const {
+  return isNull() ? 0 : data()->_id;
+}
+
+qint64 Logger::LogEntry::timestampMsecs() const {
+  return isNull() ? 0 : data()->_timestamp;
+}
+
+QString Logger::LogEntry::timestampToText() const {
+  return isNull() ? QString() : Log::timestampToText(data()->_timestamp);
 }
 
 QString Logger::LogEntry::message() const {
@@ -92,13 +113,28 @@ QString Logger::LogEntry::sourceCode() const {
   return isNull() ? QString() : data()->_sourceCode;
 }
 
+QString Logger::LogEntry::asLogLine() const {
+  if (isNull())
+    return QString();
+  const LogEntryData *d = data();
+  const QString severity = Log::severityToString(d->_severity);
+  QString line = Log::timestampToText(d->_timestamp);
+  line.reserve(line.size()+d->_task.size()+d->_execId.size()
+               +d->_sourceCode.size()+severity.size()+d->_message.size()+5);
+  line.append(' ').append(d->_task).append('/').append(d->_execId)
+      .append(' ').append(d->_sourceCode).append(' ').append(severity)
+      .append(' ').append(d->_message);
+  return line;
+}
+
 QVariant Logger::LogEntryData::uiData(int section, int role) const {
   switch(role) {
   case Qt::DisplayRole:
   case Qt::EditRole:
     switch(section) {
     case 0:
-      return _timestamp.toString("yyyy-MM-dd hh:mm:ss,zzz");
+      return QDateTime::fromMSecsSinceEpoch(_timestamp)
+          .toString("yyyy-MM-dd hh:mm:ss,zzz");
     case 1:
       return _task;
     case 2:
@@ -190,7 +226,7 @@ void Logger::log(const LogEntry &entry) {
 #else
           qWarning()
 #endif
-              << QDateTime::currentDateTime().toString(ISO8601) << this
+              << Log::timestampToText(now) << this
               << "Logger::log discarded at less one log entry due to "
                  "thread buffer full" << entry.message()
               << "this warning occurs at most every"
@@ -205,6 +241,9 @@ void Logger::log(const LogEntry &entry) {
   }
 }
 
+void Logger::doFlush() {
+}
+
 QString Logger::currentPath() const {
   return QString();
 }
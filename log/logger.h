@@ -40,18 +40,33 @@ public:
   class LogEntry : public SharedUiItem {
   public:
     LogEntry();
+    /** @param timestamp milliseconds since 1970-01-01 00:00:00 UTC */
+    LogEntry(qint64 timestamp, QString message, Log::Severity severity,
+             QString task, QString execId, QString sourceCode);
     LogEntry(QDateTime timestamp, QString message, Log::Severity severity,
              QString task, QString execId, QString sourceCode);
     LogEntry(const LogEntry &other);
     LogEntry &operator=(const LogEntry &other) {
       SharedUiItem::operator=(other); return *this; }
+    /** Unique number of the entry within the process, same value as id() but
+     * without converting it to a string. */
+    quint64 sequenceNumber() const;
+    /** Timestamp as a QDateTime (in local time), built on demand. */
     QDateTime timestamp() const;
+    /** Timestamp in milliseconds since 1970-01-01 00:00:00 UTC. */
+    qint64 timestampMsecs() const;
+    /** Timestamp as text, e.g. "2018-12-31T23:59:59,999" (in local time).
+     * @see Log::timestampToText() */
+    QString timestampToText() const;
     QString message() const;
     Log::Severity severity() const;
     QString severityToString() const;
     QString task() const;
     QString execId() const;
     QString sourceCode() const;
+    /** Log line as written in log files, without trailing newline, e.g.
+     * "2018-12-31T23:59:59,999 task/42 source INFO message" */
+    QString asLogLine() const;
 
   private:
     const LogEntryData *data() const {
@@ -102,6 +117,10 @@ protected:
    * method must be threadsafe (= able to handle calls from any thread at any
    * time). */
   virtual void doLog(const LogEntry &entry) = 0;
+  /** Called by the dedicated thread, if any, each time there is no more
+   * entry in the queue, to let loggers that batch their writes flush them.
+   * Default: do nothing. */
+  virtual void doFlush();
 };
 
 Q_DECLARE_METATYPE(Logger::LogEntry)
@@ -30,8 +30,11 @@ LoggerThread::~LoggerThread() {
 void LoggerThread::run() {
   while (!isInterruptionRequested()) {
     Logger::LogEntry le;
-    if (_logger->_buffer->tryGet(&le, 500))
+    if (_logger->_buffer->tryGet(&le, 500)) {
       _logger->doLog(le);
+      if (!_logger->_buffer->used())
+        _logger->doFlush();
+    }
   }
   //qDebug() << "LoggerThread received stop message" << this << _logger;
   // only connect deleteLater() now because in case of unwanted thread stop,
@@ -13,11 +13,18 @@
  */
 #include "logmodel.h"
 #include "memorylogger.h"
+#include <QTimer>
+#include <QDateTime>
+#include <algorithm>
 
 LogModel::LogModel(QObject *parent, Log::Severity minSeverity, int maxrows,
                    QString prefixFilter)
   : SharedUiItemsTableModel(parent),
-    _logger(new MemoryLogger(minSeverity, prefixFilter, this)) {
+    _logger(new MemoryLogger(minSeverity, prefixFilter, this, maxrows)),
+    _deliveryTimer(new QTimer(this)), _lastDelivery(0),
+    _minRefreshIntervalMs(200) {
+  _deliveryTimer->setSingleShot(true);
+  connect(_deliveryTimer, &QTimer::timeout, this, &LogModel::deliverPending);
   setMaxrows(maxrows);
   setDefaultInsertionPoint(SharedUiItemsTableModel::FirstItem);
   setHeaderDataFromTemplate(
@@ -27,7 +34,8 @@ LogModel::LogModel(QObject *parent, Log::Severity minSeverity, int maxrows,
 }
 
 LogModel::LogModel(QObject *parent, int maxrows)
-  : SharedUiItemsTableModel(parent), _logger(0) {
+  : SharedUiItemsTableModel(parent), _logger(0), _deliveryTimer(0),
+    _lastDelivery(0), _minRefreshIntervalMs(200) {
   setMaxrows(maxrows);
   setDefaultInsertionPoint(SharedUiItemsTableModel::FirstItem);
   setHeaderDataFromTemplate(
@@ -39,3 +47,39 @@ LogModel::~LogModel() {
   if (_logger)
     Log::removeLogger(_logger);
 }
+
+quint64 LogModel::droppedCount() const {
+  return _logger ? _logger->store()->droppedCount() : 0;
+}
+
+void LogModel::setMaxrows(int maxrows) {
+  SharedUiItemsTableModel::setMaxrows(maxrows);
+  if (_logger)
+    _logger->store()->setCapacity(maxrows);
+}
+
+void LogModel::scheduleDelivery() {
+  if (_deliveryTimer->isActive())
+    return;
+  qint64 elapsed = QDateTime::currentMSecsSinceEpoch()-_lastDelivery;
+  if (elapsed >= _minRefreshIntervalMs)
+    deliverPending();
+  else
+    _deliveryTimer->start(_minRefreshIntervalMs-elapsed);
+}
+
+void LogModel::deliverPending() {
+  _lastDelivery = QDateTime::currentMSecsSinceEpoch();
+  QList<Logger::LogEntry> entries = _logger->store()->takePending();
+  if (entries.isEmpty()
+      || (!itemQualifierFilter().isEmpty()
+          && !itemQualifierFilter().contains(entries.first().idQualifier())))
+    return; // same filter as changeItem()
+  QList<Logger::LogEntry> reversed = entries;
+  // newest entry goes first
+  std::reverse(reversed.begin(), reversed.end());
+  insertItemsAt(reversed, 0);
+  // same signals as if entries were inserted one by one through changeItem()
+  foreach (const Logger::LogEntry &entry, entries)
+    emit itemChanged(entry, SharedUiItem());
+}
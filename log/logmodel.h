@@ -18,17 +18,25 @@
 #include "logger.h"
 
 class MemoryLogger;
+class QTimer;
 
 // LATER remove log entries depending on their age too
 
 /** Model to hold and optionnaly (see constructors) collect log entries.
  * Contains a log entry per row, the first row being the last recorded entry
  * when automatically collecting.
+ * Collected entries are inserted in batches, but itemChanged() is still
+ * emitted for each inserted entry, oldest first, after the batch has been
+ * inserted. Entries dropped because the model was late (see droppedCount())
+ * are never inserted nor signaled.
  * @see MemoryLogger */
 class LIBPUMPKINSHARED_EXPORT LogModel : public SharedUiItemsTableModel {
   Q_OBJECT
   Q_DISABLE_COPY(LogModel)
   MemoryLogger *_logger;
+  QTimer *_deliveryTimer;
+  qint64 _lastDelivery; // ms since 1970
+  int _minRefreshIntervalMs;
 
 public:
   /** Create a model that collects log entries with severity >= minSeverity. */
@@ -55,6 +63,20 @@ public:
   explicit LogModel(int maxrows = 100) : LogModel(0, maxrows) { }
   ~LogModel();
   MemoryLogger *logger() const { return _logger; }
+  /** Minimum interval between two updates of the model with collected log
+   * entries, entries received meanwhile being inserted as a batch.
+   * Default: 200 ms */
+  void setMinRefreshInterval(int ms) { _minRefreshIntervalMs = ms; }
+  /** Number of collected entries that were dropped because the model was
+   * not updated fast enough to show them, 0 if not collecting. */
+  quint64 droppedCount() const;
+  /** Also bounds the store of collected entries.
+   * @see MemoryLogger::store() */
+  void setMaxrows(int maxrows) override;
+
+private:
+  Q_INVOKABLE void scheduleDelivery();
+  void deliverPending();
 };
 
 #endif // LOGMODEL_H
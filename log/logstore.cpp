@@ -0,0 +1,138 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "logstore.h"
+#include <algorithm>
+
+static inline int severityIndex(const Logger::LogEntry &entry) {
+  return qBound(0, (int)entry.severity(), (int)Log::Fatal);
+}
+
+LogStore::LogStore(int capacity) : _ring(qMax(1, capacity)) {
+}
+
+int LogStore::capacity() const {
+  QMutexLocker locker(&_mutex);
+  return _ring.size();
+}
+
+void LogStore::setCapacity(int capacity) {
+  QMutexLocker locker(&_mutex);
+  capacity = qMax(1, capacity);
+  quint64 oldCapacity = _ring.size();
+  if (quint64(capacity) == oldCapacity)
+    return;
+  // keep most recent entries and reindex them from position 0
+  quint64 count = qMin(_count, oldCapacity);
+  count = qMin(count, quint64(capacity));
+  QVector<Logger::LogEntry> ring(capacity);
+  for (quint64 i = 0; i < count; ++i)
+    ring[int(i)] = at(_count-count+i);
+  _ring = ring;
+  _count = 0;
+  for (int severity = 0; severity <= Log::Fatal; ++severity)
+    _bySeverity[severity].clear();
+  _byTask.clear();
+  for (; _count < count; ++_count) {
+    const Logger::LogEntry &entry = _ring[int(_count)];
+    _bySeverity[severityIndex(entry)].append(_count);
+    _byTask[entry.task()].append(_count);
+  }
+  while (_pending.size() > capacity) {
+    _pending.removeFirst();
+    ++_droppedCount;
+  }
+}
+
+bool LogStore::append(Logger::LogEntry entry) {
+  QMutexLocker locker(&_mutex);
+  quint64 capacity = _ring.size();
+  if (_count >= capacity) {
+    // oldest entry is overwritten, it is first in every index it belongs to
+    quint64 oldest = _count-capacity;
+    Logger::LogEntry old = at(oldest);
+    _bySeverity[severityIndex(old)].removeFirst();
+    auto it = _byTask.find(old.task());
+    if (it != _byTask.end()) {
+      it.value().removeFirst();
+      if (it.value().isEmpty())
+        _byTask.erase(it);
+    }
+  }
+  _ring[_count%capacity] = entry;
+  _bySeverity[severityIndex(entry)].append(_count);
+  _byTask[entry.task()].append(_count);
+  ++_count;
+  bool wasEmpty = _pending.isEmpty();
+  if ((quint64)_pending.size() >= capacity) {
+    _pending.removeFirst();
+    ++_droppedCount;
+  }
+  _pending.append(entry);
+  return wasEmpty;
+}
+
+QList<Logger::LogEntry> LogStore::takePending() {
+  QMutexLocker locker(&_mutex);
+  QList<Logger::LogEntry> pending = _pending;
+  _pending.clear();
+  return pending;
+}
+
+QList<Logger::LogEntry> LogStore::entries() const {
+  QMutexLocker locker(&_mutex);
+  QList<Logger::LogEntry> entries;
+  quint64 capacity = _ring.size();
+  quint64 position = _count > capacity ? _count-capacity : 0;
+  entries.reserve(_count-position);
+  for (; position < _count; ++position)
+    entries.append(at(position));
+  return entries;
+}
+
+QList<Logger::LogEntry> LogStore::entries(Log::Severity minSeverity) const {
+  QMutexLocker locker(&_mutex);
+  QList<quint64> positions;
+  for (int severity = qMax(0, (int)minSeverity); severity <= Log::Fatal;
+       ++severity)
+    positions.append(_bySeverity[severity]);
+  std::sort(positions.begin(), positions.end());
+  QList<Logger::LogEntry> entries;
+  entries.reserve(positions.size());
+  foreach (quint64 position, positions)
+    entries.append(at(position));
+  return entries;
+}
+
+QList<Logger::LogEntry> LogStore::entriesByTask(QString task) const {
+  QMutexLocker locker(&_mutex);
+  QList<Logger::LogEntry> entries;
+  foreach (quint64 position, _byTask.value(task))
+    entries.append(at(position));
+  return entries;
+}
+
+quint64 LogStore::droppedCount() const {
+  QMutexLocker locker(&_mutex);
+  return _droppedCount;
+}
+
+void LogStore::clear() {
+  QMutexLocker locker(&_mutex);
+  _ring = QVector<Logger::LogEntry>(_ring.size());
+  _count = 0;
+  for (int severity = 0; severity <= Log::Fatal; ++severity)
+    _bySeverity[severity].clear();
+  _byTask.clear();
+  _pending.clear();
+}
@@ -0,0 +1,67 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include "logger.h"
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+
+/** Bounded in-memory log entries store, used by MemoryLogger.
+ * Keeps the capacity() last entries in a ring, along with indexes by
+ * severity and by task for filtered views, and a queue of entries not yet
+ * delivered to a consumer (e.g. a LogModel) to enable delivering them in
+ * batches. When the consumer is too slow, entries not yet delivered are
+ * dropped from the queue (but not from the store) and counted.
+ * This class is thread-safe. */
+class LIBPUMPKINSHARED_EXPORT LogStore {
+  Q_DISABLE_COPY(LogStore)
+  mutable QMutex _mutex;
+  QVector<Logger::LogEntry> _ring;
+  quint64 _count = 0; // entries appended since last clear or resize
+  // indexes hold positions (i.e. value of _count when appended), oldest first
+  QList<quint64> _bySeverity[Log::Fatal+1];
+  QHash<QString,QList<quint64>> _byTask;
+  QList<Logger::LogEntry> _pending;
+  quint64 _droppedCount = 0;
+
+public:
+  explicit LogStore(int capacity);
+  int capacity() const;
+  /** Change capacity, keeping the most recent entries, and dropping pending
+   * entries in excess. */
+  void setCapacity(int capacity);
+  /** Append an entry, removing the oldest one if the store is full.
+   * @return true if the pending queue was empty, i.e. if the consumer should
+   * be notified */
+  bool append(Logger::LogEntry entry);
+  /** Remove and return pending entries, oldest first. */
+  QList<Logger::LogEntry> takePending();
+  /** Entries currently held, oldest first. */
+  QList<Logger::LogEntry> entries() const;
+  /** Entries currently held with severity >= minSeverity, oldest first. */
+  QList<Logger::LogEntry> entries(Log::Severity minSeverity) const;
+  /** Entries currently held for a given task, oldest first. */
+  QList<Logger::LogEntry> entriesByTask(QString task) const;
+  /** Number of entries dropped before being delivered. */
+  quint64 droppedCount() const;
+  void clear();
+
+private:
+  inline Logger::LogEntry at(quint64 position) const {
+    return _ring[position%_ring.size()]; }
+};
+
+#endif // LOGSTORE_H
@@ -16,16 +16,18 @@
 #include <QMetaObject>
 
 MemoryLogger::MemoryLogger(
-    Log::Severity minSeverity, QString prefixFilter, LogModel *logmodel)
+    Log::Severity minSeverity, QString prefixFilter, LogModel *logmodel,
+    int capacity)
   : Logger(minSeverity, Logger::DirectCall), _prefixFilter(prefixFilter),
-    _model(logmodel) {
+    _model(logmodel), _store(capacity) {
 }
 
 void MemoryLogger::doLog(const LogEntry &entry) {
   if (!_prefixFilter.isNull() && !entry.message().startsWith(_prefixFilter))
     return;
-  QMetaObject::invokeMethod(_model, "changeItem",
-                            Q_ARG(SharedUiItem, entry),
-                            Q_ARG(SharedUiItem, SharedUiItem()),
-                            Q_ARG(QString, entry.idQualifier()));
+  // only notify the model for the first entry of a batch, the model will
+  // take every pending entry at once
+  if (_store.append(entry))
+    QMetaObject::invokeMethod(_model, "scheduleDelivery",
+                              Qt::QueuedConnection);
 }
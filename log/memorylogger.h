@@ -15,10 +15,13 @@
 #define MEMORYLOGGER_H
 
 #include "logger.h"
+#include "logstore.h"
 
 class LogModel;
 
 /** Logger used internaly by LogModel.
+ * Entries are kept in a LogStore and delivered to the model in batches,
+ * the model being notified at most once per batch.
  * @see LogModel */
 class LIBPUMPKINSHARED_EXPORT MemoryLogger : public Logger {
   friend class LogModel;
@@ -26,11 +29,16 @@ class LIBPUMPKINSHARED_EXPORT MemoryLogger : public Logger {
   Q_DISABLE_COPY(MemoryLogger)
   QString _prefixFilter;
   LogModel *_model;
+  LogStore _store;
 
   // only LogModel can create a MemoryLogger object, ensuring they share the
   // same thread, therefore the constructor must not be public
   MemoryLogger(Log::Severity minSeverity, QString prefixFilter,
-               LogModel *logmodel);
+               LogModel *logmodel, int capacity);
+
+public:
+  /** Store holding entries, e.g. for views filtered by severity or task. */
+  LogStore *store() { return &_store; }
 
 protected:
   void doLog(const LogEntry &entry);
@@ -17,10 +17,25 @@
 #include <QFile>
 #include "util/ioutils.h"
 
+class MultiplexerLogger::LoggersSnapshot {
+public:
+  const QList<Logger*> _loggers;
+  // loggers removed since this snapshot was published, they are deleted when
+  // the last reader releases the snapshot, since it can still use them
+  QList<Logger*> _loggersToDelete;
+  LoggersSnapshot(QList<Logger*> loggers) : _loggers(loggers) { }
+  ~LoggersSnapshot() {
+    foreach (Logger *logger, _loggersToDelete)
+      logger->deleteLater();
+  }
+};
+
 MultiplexerLogger::MultiplexerLogger(
     Log::Severity minSeverity, bool isRootLogger)
   : Logger(minSeverity, isRootLogger ? Logger::RootLogger
-                                     : Logger::DirectCall) {
+                                     : Logger::DirectCall),
+    _snapshot(std::make_shared<LoggersSnapshot>(QList<Logger*>())),
+    _minLoggersSeverity(Log::Fatal+1) {
 }
 
 void MultiplexerLogger::addLogger(
@@ -40,20 +55,24 @@ void MultiplexerLogger::addLogger(
     _loggers.append(logger);
     if (takeOwnership)
       _ownedLoggers.insert(logger);
+    publishLoggers(QList<Logger*>());
   }
 }
 
 void MultiplexerLogger::removeLogger(Logger *logger) {
   QMutexLocker locker(&_loggersMutex);
-  foreach(Logger *l, _loggers)
-    if (l == logger) {
-      if (_ownedLoggers.contains(logger)) {
-        logger->deleteLater();
-        _ownedLoggers.remove(logger);
-      }
-      _loggers.removeAll(logger);
-      break;
-    }
+  if (!logger || !_loggers.contains(logger))
+    return;
+  _loggers.removeAll(logger);
+  if (_ownedLoggers.remove(logger)) {
+    publishLoggers(QList<Logger*>() << logger);
+    return;
+  }
+  publishLoggers(QList<Logger*>());
+  // the caller may delete the logger as soon as we return, so wait for
+  // readers still using it to be done, without preventing them to log
+  locker.unlock();
+  _readers.waitForReaders();
 }
 
 void MultiplexerLogger::addConsoleLogger(Log::Severity severity,
@@ -80,7 +99,10 @@ void MultiplexerLogger::replaceLoggers(Logger *newLogger, bool takeOwnership) {
 void MultiplexerLogger::replaceLoggers(
     QList<Logger*> newLoggers, bool takeOwnership) {
   QMutexLocker locker(&_loggersMutex);
-  doReplaceLoggers(newLoggers, takeOwnership);
+  if (doReplaceLoggers(newLoggers, takeOwnership)) {
+    locker.unlock();
+    _readers.waitForReaders();
+  }
 }
 
 void MultiplexerLogger::replaceLoggersPlusConsole(
@@ -93,16 +115,23 @@ void MultiplexerLogger::replaceLoggersPlusConsole(
   QMutexLocker locker(&_loggersMutex);
   // own console logger regardless taking ownership of other loggers
   _ownedLoggers.insert(consoleLogger);
-  doReplaceLoggers(newLoggers, takeOwnership);
+  if (doReplaceLoggers(newLoggers, takeOwnership)) {
+    locker.unlock();
+    _readers.waitForReaders();
+  }
 }
 
-void MultiplexerLogger::doReplaceLoggers(
+bool MultiplexerLogger::doReplaceLoggers(
     QList<Logger*> newLoggers, bool takeOwnership) {
+  QList<Logger*> loggersToDelete;
+  bool notOwnedLoggersRemoved = false;
   foreach(Logger *logger, _loggers)
     if (logger->_autoRemovable) {
-      if (!newLoggers.contains(logger) && _ownedLoggers.contains(logger)) {
-        logger->deleteLater();
-        _ownedLoggers.remove(logger);
+      if (!newLoggers.contains(logger)) {
+        if (_ownedLoggers.remove(logger))
+          loggersToDelete.append(logger);
+        else
+          notOwnedLoggersRemoved = true;
       }
       _loggers.removeAll(logger);
     }
@@ -111,14 +140,34 @@ void MultiplexerLogger::doReplaceLoggers(
     if (takeOwnership)
       _ownedLoggers.insert(logger);
   }
+  publishLoggers(loggersToDelete);
+  // removed loggers that are not owned can be deleted by their owner as soon
+  // as the caller returns
+  return notOwnedLoggersRemoved;
+}
+
+void MultiplexerLogger::publishLoggers(QList<Logger*> loggersToDelete) {
+  // writers are serialized by _loggersMutex, which is locked by caller
+  std::shared_ptr<LoggersSnapshot> previous = std::atomic_load(&_snapshot);
+  previous->_loggersToDelete = loggersToDelete;
+  _readers.retire(previous);
+  std::atomic_store(&_snapshot, std::make_shared<LoggersSnapshot>(_loggers));
+  updateMinLoggersSeverity();
+}
+
+void MultiplexerLogger::updateMinLoggersSeverity() {
+  int severity = Log::Fatal+1;
+  foreach (Logger *logger, _loggers)
+    if (logger->minSeverity() < severity)
+      severity = logger->minSeverity();
+  _minLoggersSeverity.storeRelease(severity);
 }
 
 QString MultiplexerLogger::pathToLastFullestLog() {
-  // LATER avoid locking here whereas right logger won't change often
-  QMutexLocker locker(&_loggersMutex);
+  SnapshotReaders::Reader<LoggersSnapshot> snapshot(&_readers, &_snapshot);
   int severity = Log::Fatal+1;
   QString path;
-  foreach(Logger *logger, _loggers) {
+  foreach(Logger *logger, snapshot->_loggers) {
     if (logger->minSeverity() < severity) {
       QString p = logger->currentPath();
       if (!p.isEmpty()) {
@@ -133,42 +182,36 @@ QString MultiplexerLogger::pathToLastFullestLog() {
 }
 
 QStringList MultiplexerLogger::pathsToFullestLogs() {
-  // LATER avoid locking here whereas right logger won't change often
-  QMutexLocker locker(&_loggersMutex);
+  SnapshotReaders::Reader<LoggersSnapshot> snapshot(&_readers, &_snapshot);
   int severity = Log::Fatal+1;
   QString path;
-  foreach(Logger *logger, _loggers) {
+  foreach(Logger *logger, snapshot->_loggers) {
     if (logger->minSeverity() < severity) {
       QString p = logger->pathMatchingRegexp();
       if (!p.isEmpty()) {
-        if (severity == Log::Debug) {
-          locker.unlock();
+        if (severity == Log::Debug)
           return IOUtils::findFiles(p);
-        }
         path = p;
         severity = logger->minSeverity();
       }
     }
   }
-  locker.unlock();
   return IOUtils::findFiles(path);
 }
 
 QStringList MultiplexerLogger::pathsToAllLogs() {
-  // LATER avoid locking here whereas loggers list won't change often
-  QMutexLocker locker(&_loggersMutex);
+  SnapshotReaders::Reader<LoggersSnapshot> snapshot(&_readers, &_snapshot);
   QStringList paths;
-  foreach(Logger *logger, _loggers) {
+  foreach(Logger *logger, snapshot->_loggers) {
     QString p = logger->pathMatchingRegexp();
     if (!p.isEmpty())
       paths.append(p);
   }
-  locker.unlock();
   return IOUtils::findFiles(paths);
 }
 
 void MultiplexerLogger::doLog(const LogEntry &entry) {
-  QMutexLocker locker(&_loggersMutex);
-  foreach (Logger *logger, _loggers)
+  SnapshotReaders::Reader<LoggersSnapshot> snapshot(&_readers, &_snapshot);
+  foreach (Logger *logger, snapshot->_loggers)
     logger->log(entry);
 }
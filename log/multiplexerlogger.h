@@ -17,16 +17,27 @@
 #include "logger.h"
 #include <QList>
 #include <QMutex>
+#include <memory>
+#include "thread/snapshotreaders.h"
 
 /** Logger for multiplexing to log writing to several loggers.
  * Mainly intended to be used internaly as a singleton by Log.
+ * Logging and path queries never lock: they read an immutable snapshot of
+ * the loggers list, which is replaced as a whole by any change to the list.
  * @see Log */
 class LIBPUMPKINSHARED_EXPORT MultiplexerLogger : public Logger {
   Q_OBJECT
   Q_DISABLE_COPY(MultiplexerLogger)
+  class LoggersSnapshot;
+  // _loggers and _ownedLoggers are writers' data, protected by _loggersMutex
   QList<Logger*> _loggers;
   QSet<Logger*> _ownedLoggers;
   QMutex _loggersMutex;
+  // readers' data, only accessed through SnapshotReaders::Reader and
+  // std::atomic_store()
+  std::shared_ptr<LoggersSnapshot> _snapshot;
+  SnapshotReaders _readers;
+  QAtomicInt _minLoggersSeverity;
 
 public:
   explicit MultiplexerLogger(Log::Severity minSeverity = Log::Debug,
@@ -53,12 +64,20 @@ public:
   QString pathToLastFullestLog();
   QStringList pathsToFullestLogs();
   QStringList pathsToAllLogs();
+  /** Tell if at less one of the loggers would accept an entry of this
+   * severity. Lock-free, intended to discard entries before building them. */
+  bool isSeverityEnabled(Log::Severity severity) const {
+    return severity >= _minLoggersSeverity.loadAcquire(); }
 
 protected:
   void doLog(const LogEntry &entry);
 
 private:
-  inline void doReplaceLoggers(QList<Logger*> newLoggers, bool takeOwnership);
+  /** @return true if caller must wait for readers before returning */
+  inline bool doReplaceLoggers(QList<Logger*> newLoggers, bool takeOwnership);
+  inline void updateMinLoggersSeverity();
+  /** must be called with _loggersMutex locked */
+  inline void publishLoggers(QList<Logger*> loggersToDelete);
 };
 
 #endif // MULTIPLEXERLOGGER_H
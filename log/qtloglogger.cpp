@@ -19,10 +19,10 @@ QtLogLogger::QtLogLogger(Log::Severity minSeverity)
 }
 
 void QtLogLogger::doLog(const LogEntry &entry) {
-  QString header = QString("%1 %2/%3 %4 %5")
-      .arg(entry.timestamp().toString("yyyy-MM-ddThh:mm:ss,zzz"))
-      .arg(entry.task()).arg(entry.execId()).arg(entry.sourceCode())
-      .arg(entry.severityToString());
+  QString header = entry.timestampToText();
+  header.append(' ').append(entry.task()).append('/').append(entry.execId())
+      .append(' ').append(entry.sourceCode()).append(' ')
+      .append(entry.severityToString());
   // LATER try to use QLoggingCategory e.g. using task as a category
   switch(entry.severity()) {
   case Log::Debug:
@@ -13,14 +13,189 @@
  */
 #include "incomingmessagedispatcher.h"
 #include "log/log.h"
+#include "thread/workerpool.h"
+#include <QElapsedTimer>
+
+// ordered sessions give back their worker after this many messages in a row
+#define MAX_MESSAGES_PER_SESSION_RUN 16
+
+namespace {
+
+class Clock {
+public:
+  QElapsedTimer _timer;
+  Clock() { _timer.start(); }
+};
+
+} // unnamed namespace
+
+Q_GLOBAL_STATIC(Clock, _clock)
+
+static inline qint64 nowNsecs() {
+  Clock *clock = _clock();
+  return clock ? clock->_timer.nsecsElapsed() : 0;
+}
+
+static inline void recordMax(QAtomicInteger<quint64> *max, quint64 value) {
+  quint64 current = max->loadAcquire();
+  while (value > current && !max->testAndSetOrdered(current, value))
+    current = max->loadAcquire();
+}
+
+class IncomingMessageDispatcher::Route {
+public:
+  class Pending {
+  public:
+    Message _message;
+    qint64 _enqueuedNsecs;
+  };
+  QString _key;
+  RouteOptions _options;
+  WorkerPool *_pool;
+  QAtomicInteger<quint64> _queued, _handled, _handledInline, _totalWaitUsecs,
+  _maxWaitUsecs, _totalRunUsecs, _maxRunUsecs;
+  // OrderedPerSession state: sessions having a task running or queued, with
+  // messages waiting behind it
+  QMutex _mutex;
+  QWaitCondition _roomAvailable;
+  QHash<qint64,QList<Pending>> _sessions;
+  Route(QString key, RouteOptions options)
+    : _key(key), _options(options), _pool(options._pool) {
+    if (!_pool && options._mode != Inline)
+      _pool = WorkerPool::pool(QStringLiteral("messages"));
+  }
+  void recordRun(qint64 enqueuedNsecs, qint64 startNsecs, qint64 endNsecs) {
+    quint64 wait = quint64(qMax(0LL, startNsecs-enqueuedNsecs)/1000);
+    quint64 run = quint64(qMax(0LL, endNsecs-startNsecs)/1000);
+    _totalWaitUsecs.fetchAndAddRelaxed(wait);
+    recordMax(&_maxWaitUsecs, wait);
+    _totalRunUsecs.fetchAndAddRelaxed(run);
+    recordMax(&_maxRunUsecs, run);
+    _handled.fetchAndAddRelaxed(1);
+  }
+};
+
+IncomingMessageDispatcher::IncomingMessageDispatcher()
+  : _defaultRoute(std::make_shared<Route>(QString(), RouteOptions())) {
+  _allRoutes.append(_defaultRoute);
+}
+
+void IncomingMessageDispatcher::setRouteOptions(
+    QString key, RouteOptions options, bool isPrefix) {
+  std::shared_ptr<Route> route = std::make_shared<Route>(key, options);
+  _routes.insert(key, route, isPrefix);
+  _allRoutes.append(route);
+}
 
 bool IncomingMessageDispatcher::dispatch(Message message) {
-  MessageHandler handler = _handlers[message.node().name()];
-  if (handler) {
-    handler(message);
-  } else {
+  QString name = message.node().name();
+  MessageHandler handler = _handlers[name];
+  if (!handler) {
     Log::error(message.session().id())
-        << "unhandled incomming message type: " << message.node().name();
+        << "unhandled incomming message type: " << name;
+    return true;
+  }
+  std::shared_ptr<Route> route = _routes[name];
+  if (!route)
+    route = _defaultRoute;
+  qint64 now = nowNsecs();
+  switch (route->_options._mode) {
+  case Inline:
+    break;
+  case Pool:
+    // take room before checking the bound, and give it back if there was
+    // none, so that concurrent connection threads cannot exceed it
+    if (route->_queued.fetchAndAddOrdered(1)
+        < quint64(route->_options._maxQueuedMessages)) {
+      auto task = [route, handler, message, now]() {
+        route->_queued.fetchAndSubRelaxed(1);
+        runHandler(route, handler, message, now);
+      };
+      if (route->_pool->submit(task))
+        return true;
+    }
+    route->_queued.fetchAndSubRelaxed(1);
+    route->_handledInline.fetchAndAddRelaxed(1);
+    break; // queue full or pool stopping: handle inline
+  case OrderedPerSession: {
+    qint64 sessionid = message.session().id();
+    QMutexLocker ml(&route->_mutex);
+    while (route->_queued.loadAcquire()
+           >= quint64(route->_options._maxQueuedMessages))
+      route->_roomAvailable.wait(&route->_mutex);
+    route->_queued.fetchAndAddRelaxed(1);
+    auto it = route->_sessions.find(sessionid);
+    if (it != route->_sessions.end()) {
+      // a task is already running or queued for this session
+      it.value().append({ message, now });
+      return true;
+    }
+    route->_sessions[sessionid].append({ message, now });
+    ml.unlock();
+    auto task = [route, handler, sessionid]() {
+      runSession(route, handler, sessionid);
+    };
+    if (!route->_pool->submit(task)) {
+      Log::error(sessionid) << "cannot dispatch incoming message to pool "
+                            << route->_pool->name()
+                            << ", handling it inline: " << name;
+      runSession(route, handler, sessionid);
+    }
+    return true;
   }
+  }
+  handler(message);
+  route->recordRun(now, now, nowNsecs());
   return true;
 }
+
+void IncomingMessageDispatcher::runHandler(
+    std::shared_ptr<Route> route, MessageHandler handler, Message message,
+    qint64 enqueuedNsecs) {
+  qint64 start = nowNsecs();
+  handler(message);
+  route->recordRun(enqueuedNsecs, start, nowNsecs());
+}
+
+void IncomingMessageDispatcher::runSession(
+    std::shared_ptr<Route> route, MessageHandler handler, qint64 sessionid) {
+  for (int i = 0; i < MAX_MESSAGES_PER_SESSION_RUN; ++i) {
+    QMutexLocker ml(&route->_mutex);
+    QList<Route::Pending> &pendings = route->_sessions[sessionid];
+    if (pendings.isEmpty()) {
+      route->_sessions.remove(sessionid);
+      return;
+    }
+    Route::Pending pending = pendings.takeFirst();
+    route->_queued.fetchAndSubRelaxed(1);
+    route->_roomAvailable.wakeOne();
+    ml.unlock();
+    runHandler(route, handler, pending._message, pending._enqueuedNsecs);
+  }
+  // give other sessions a chance, the session entry is kept so that ordering
+  // is preserved meanwhile
+  auto task = [route, handler, sessionid]() {
+    runSession(route, handler, sessionid);
+  };
+  if (!route->_pool->submit(task))
+    runSession(route, handler, sessionid);
+}
+
+QList<IncomingMessageDispatcher::RouteStats>
+IncomingMessageDispatcher::routesStats() const {
+  QList<RouteStats> list;
+  foreach (const std::shared_ptr<Route> &route, _allRoutes) {
+    RouteStats stats;
+    stats._key = route->_key;
+    stats._mode = route->_options._mode;
+    stats._queued = route->_queued.loadAcquire();
+    stats._handled = route->_handled.loadAcquire();
+    stats._handledInline = route->_handledInline.loadAcquire();
+    stats._totalWaitUsecs = route->_totalWaitUsecs.loadAcquire();
+    stats._maxWaitUsecs = route->_maxWaitUsecs.loadAcquire();
+    stats._totalRunUsecs = route->_totalRunUsecs.loadAcquire();
+    stats._maxRunUsecs = route->_maxRunUsecs.loadAcquire();
+    list.append(stats);
+  }
+  return list;
+}
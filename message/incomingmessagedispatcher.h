@@ -15,28 +15,81 @@
 #define INCOMINGMESSAGEDISPATCHER_H
 
 #include <functional>
+#include <memory>
 #include "message.h"
 #include "util/radixtree.h"
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInteger>
+
+class WorkerPool;
 
 /** Dispatch incoming messages among registred handlers, depending on their
- * root node name. */
+ * root node name.
+ *
+ * By default handlers are called inline, by the connection thread that
+ * received the message. Routes can be configured with setRouteOptions() to
+ * run their handlers on a WorkerPool instead, either without any ordering
+ * (Pool) or serially for a given session and in parallel across sessions
+ * (OrderedPerSession). Handlers of such routes must be thread-safe.
+ *
+ * A route queue is bounded: when it is full, Pool messages are handled
+ * inline by the connection thread and OrderedPerSession ones make the
+ * connection thread wait for room, both of which slow the peer down.
+ *
+ * Every route, including the implicit default inline one, has queue depth
+ * and latency metrics, see routesStats(). */
 class LIBPUMPKINSHARED_EXPORT IncomingMessageDispatcher {
 
 public:
   using MessageHandler = std::function<void(Message)>;
+  enum DispatchMode { Inline, Pool, OrderedPerSession };
+  class RouteOptions {
+  public:
+    DispatchMode _mode = Inline;
+    WorkerPool *_pool = 0; // 0 means WorkerPool::pool("messages")
+    int _maxQueuedMessages = 1024;
+    RouteOptions(DispatchMode mode = Inline) : _mode(mode) { }
+  };
+  class RouteStats {
+  public:
+    QString _key;
+    DispatchMode _mode = Inline;
+    quint64 _queued = 0, _handled = 0, _handledInline = 0;
+    quint64 _totalWaitUsecs = 0, _maxWaitUsecs = 0;
+    quint64 _totalRunUsecs = 0, _maxRunUsecs = 0;
+  };
 
 private:
+  class Route;
   RadixTree<MessageHandler> _handlers;
+  RadixTree<std::shared_ptr<Route>> _routes;
+  QList<std::shared_ptr<Route>> _allRoutes;
+  std::shared_ptr<Route> _defaultRoute;
 
 public:
+  IncomingMessageDispatcher();
   /** not thread-safe, must only be called once at process initialization */
   void setHandlers(const RadixTree<MessageHandler> &handlers) {
     _handlers = handlers; }
+  /** Set dispatch options for messages which root node name is key, or
+   * starts with key if isPrefix is true.
+   * not thread-safe, must only be called at process initialization */
+  void setRouteOptions(QString key, RouteOptions options,
+                       bool isPrefix = false);
   /** not thread-safe, must only be called by connection handler thread:
    * actually thread-safe per se (provided setHandlers() is not called
-   * meanwhile) but the called handlers are not thread-safe */
+   * meanwhile) but the called handlers are not thread-safe, unless their
+   * route was configured with another mode than Inline */
   bool dispatch(Message message);
+  /** thread-safe */
+  QList<RouteStats> routesStats() const;
+
+private:
+  static void runHandler(std::shared_ptr<Route> route, MessageHandler handler,
+                         Message message, qint64 enqueuedNsecs);
+  static void runSession(std::shared_ptr<Route> route, MessageHandler handler,
+                         qint64 sessionid);
 };
 
 #endif // INCOMINGMESSAGEDISPATCHER_H
-
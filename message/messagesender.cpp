@@ -18,8 +18,13 @@
 MessageSender::MessageSender(QObject *parent) : QObject(parent) {
 }
 
-void MessageSender::sendOutgoingMessage(Message message) {
+int MessageSender::queuedMessagesCount() const {
+  return 0;
+}
+
+bool MessageSender::sendOutgoingMessage(Message message) {
   Log::error(message.session().id())
       << "MessageSender::sendOutgoingMessage called without implementation "
          "class";
+  return false;
 }
@@ -24,7 +24,15 @@ class LIBPUMPKINSHARED_EXPORT MessageSender : public QObject {
 
 public:
   explicit MessageSender(QObject *parent = 0);
-  virtual void sendOutgoingMessage(Message message);
+  /** Queue or send a message. Must never block.
+   * @return false if the message was dropped, e.g. because the outbound queue
+   * is full or the connection is gone, so that producers can detect the
+   * loss. Default: log an error and return false. */
+  virtual bool sendOutgoingMessage(Message message);
+  /** Number of messages waiting to be sent, used as a gauge and by load
+   * balancing policies. Default: 0.
+   * Must be thread-safe. */
+  virtual int queuedMessagesCount() const;
 };
 
 #endif // MESSAGESENDER_H
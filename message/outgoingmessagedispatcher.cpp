@@ -16,54 +16,146 @@
 #include <QMetaObject>
 #include "messagesender.h"
 #include <QtDebug>
+#include <QSet>
+#include <algorithm>
 
 OutgoingMessageDispatcher *OutgoingMessageDispatcher::_instance = 0;
 static QMutex _instanceMutex;
 
+static QByteArray defaultKey(const Message &message) {
+  return message.node().name().toUtf8();
+}
+
 OutgoingMessageDispatcher::OutgoingMessageDispatcher(Behavior behavior)
-  : _behavior(behavior), _lastInserted(0) {
+  : _behavior(behavior), _routes(std::make_shared<Routes>()),
+    _keyFunction(defaultKey) {
   QMutexLocker ml(&_instanceMutex);
   Q_ASSERT(!_instance);
   _instance = this;
 }
 
-void OutgoingMessageDispatcher::doDispatch(Message message) {
-  // TODO use queued calls, especialy because the mutex is still locked
+OutgoingMessageDispatcher::~OutgoingMessageDispatcher() {
+  QMutexLocker ml(&_instanceMutex);
+  if (_instance == this)
+    _instance = 0;
+}
+
+bool OutgoingMessageDispatcher::doDispatch(Message message) {
   qint64 sessionid = message.session().id();
-  QMutexLocker ml(&_mutex);
-  if (_behavior == SendToLastRecordedSender) {
-    //qDebug() << "OutgoingMessageDispatcher::doDispatch"
-    //         << sessionid << message.node().name();
-    if (_lastInserted)
-      _lastInserted->sendOutgoingMessage(message);
-    else
-      Log::warning(sessionid)
-          << "cannot dispatch outgoing message without a current sender "
-          << message.node().name();
+  SnapshotReaders::Reader<Routes> routes(&_readers, &_routes);
+  MessageSender *sender = chooseSender(*routes, message);
+  //qDebug() << "OutgoingMessageDispatcher::doDispatch"
+  //         << sessionid << message.node().name() << sender;
+  if (sender) {
+    // routes snapshot is kept until the end of the call, which guarantees
+    // that the sender is not deleted meanwhile
+    return sender->sendOutgoingMessage(message);
+  }
+  if (_behavior == DispatchAmongSessions) {
+    Log::debug(sessionid)
+        << "cannot dispatch outgoing message without a sender associated with "
+           "the session: " << message.node().name();
   } else {
-    MessageSender *sender = _sessionSenders.value(sessionid);
-    //qDebug() << "OutgoingMessageDispatcher::doDispatch"
-    //         << sessionid << message.node().name() << sender;
-    if (sender) {
-      sender->sendOutgoingMessage(message);
-    } else {
-      Log::debug(sessionid)
-          << "cannot dispatch outgoing message without a sender associated with "
-             "the session: " << message.node().name();
-    }
+    Log::warning(sessionid)
+        << "cannot dispatch outgoing message without a current sender "
+        << message.node().name();
   }
+  return false;
+}
+
+MessageSender *OutgoingMessageDispatcher::chooseSender(
+    const Routes &routes, const Message &message) {
+  int count = routes._senders.size();
+  switch (_behavior) {
+  case DispatchAmongSessions:
+    return routes._sessionSenders.value(message.session().id());
+  case SendToLastRecordedSender:
+    return routes._lastInserted;
+  case RoundRobin:
+    if (!count)
+      return 0;
+    return routes._senders[
+        int(_nextSender.fetchAndAddRelaxed(1) % uint(count))];
+  case LeastQueued: {
+    if (!count)
+      return 0;
+    // power of two choices: nearly as good as looking at every sender's
+    // queue, at constant cost
+    quint32 n = _nextSender.fetchAndAddRelaxed(1)*2654435761U;
+    MessageSender *a = routes._senders[int((n >> 16) % uint(count))];
+    MessageSender *b = routes._senders[int((n & 0xffff) % uint(count))];
+    return a->queuedMessagesCount() <= b->queuedMessagesCount() ? a : b;
+  }
+  case ConsistentHash: {
+    if (routes._ring.isEmpty())
+      return 0;
+    uint hash = qHash(_keyFunction(message));
+    auto it = std::lower_bound(
+          routes._ring.constBegin(), routes._ring.constEnd(),
+          qMakePair(hash, (MessageSender*)0));
+    return it == routes._ring.constEnd() ? routes._ring.first().second
+                                         : it->second;
+  }
+  }
+  return 0;
 }
 
 void OutgoingMessageDispatcher::doSetSessionSender(
     qint64 sessionid, MessageSender *sender) {
   QMutexLocker ml(&_mutex);
-  _sessionSenders.insert(sessionid, sender);
-  _lastInserted = sender;
+  Routes *routes = new Routes(*std::atomic_load(&_routes));
+  routes->_sessionSenders.insert(sessionid, sender);
+  routes->_lastInserted = sender;
+  publish(routes);
 }
 
 void OutgoingMessageDispatcher::doRemoveSessionSender(qint64 sessionid) {
   QMutexLocker ml(&_mutex);
-  MessageSender *sender = _sessionSenders.take(sessionid);
-  if (sender == _lastInserted)
-    _lastInserted = 0;
+  Routes *routes = new Routes(*std::atomic_load(&_routes));
+  MessageSender *sender = routes->_sessionSenders.take(sessionid);
+  // a sender can be registred under several keys, e.g. TcpClient
+  if (sender == routes->_lastInserted
+      && !routes->_sessionSenders.values().contains(sender))
+    routes->_lastInserted = 0;
+  publish(routes);
+  // dispatches still using previous routes may be calling the removed sender
+  ml.unlock();
+  _readers.waitForReaders();
+}
+
+void OutgoingMessageDispatcher::publish(Routes *routes) {
+  routes->_senders.clear();
+  routes->_ring.clear();
+  if (_behavior == RoundRobin || _behavior == LeastQueued
+      || _behavior == ConsistentHash) {
+    QSet<MessageSender*> seen;
+    foreach (MessageSender *sender, routes->_sessionSenders) {
+      if (seen.contains(sender))
+        continue;
+      seen.insert(sender);
+      routes->_senders.append(sender);
+    }
+  }
+  if (_behavior == ConsistentHash) {
+    // several points per sender evens out the load among senders
+    foreach (MessageSender *sender, routes->_senders) {
+      quintptr id = quintptr(sender);
+      for (int i = 0; i < RING_POINTS_PER_SENDER; ++i)
+        routes->_ring.append(qMakePair(qHash(qMakePair(id, i)), sender));
+    }
+    std::sort(routes->_ring.begin(), routes->_ring.end());
+  }
+  _readers.retire(std::atomic_load(&_routes));
+  std::atomic_store(&_routes, std::shared_ptr<Routes>(routes));
+}
+
+QHash<qint64,int> OutgoingMessageDispatcher::queuedMessagesCounts() {
+  QHash<qint64,int> counts;
+  OutgoingMessageDispatcher *dispatcher = instance();
+  SnapshotReaders::Reader<Routes> routes(&dispatcher->_readers,
+                                         &dispatcher->_routes);
+  for (auto it = routes->_sessionSenders.constBegin();
+       it != routes->_sessionSenders.constEnd(); ++it)
+    counts.insert(it.key(), it.value()->queuedMessagesCount());
+  return counts;
 }
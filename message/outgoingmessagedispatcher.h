@@ -16,35 +16,75 @@
 
 #include "message.h"
 #include <QMutex>
+#include <QAtomicInteger>
+#include <QVector>
+#include <memory>
+#include <functional>
+#include "thread/snapshotreaders.h"
 
 class MessageSender;
 
 /** Dispatch outgoing messages among registred senders, depending on their
- * session id. */
+ * session id or on a load balancing policy.
+ *
+ * Routes are held in an immutable snapshot that is replaced on every sender
+ * registration or removal, therefore dispatching a message does not lock
+ * anything. doRemoveSessionSender() waits for dispatches that were using
+ * previous snapshots to finish, without holding any lock meanwhile, so that
+ * the removed sender can safely be deleted as soon as it returns. A sender
+ * removed from within a dispatch does not wait for this very dispatch. */
 class LIBPUMPKINSHARED_EXPORT OutgoingMessageDispatcher {
 public:
   enum Behavior {
     DispatchAmongSessions, // intended for multiple peers (server)
     SendToLastRecordedSender, // intended for auto-reconnection (client)
+    // following ones ignore message's session and balance load among senders
+    RoundRobin,
+    LeastQueued, // less queued messages of 2 randomly chosen senders
+    ConsistentHash, // same sender for same key, see setKeyFunction()
   };
+  using KeyFunction = std::function<QByteArray(const Message &message)>;
 
 private:
+  class Routes {
+  public:
+    QHash<qint64,MessageSender*> _sessionSenders; // sesionid -> messagesender
+    QVector<MessageSender*> _senders;
+    QVector<QPair<uint,MessageSender*>> _ring; // sorted by hash
+    MessageSender *_lastInserted = 0;
+  };
+  static const int RING_POINTS_PER_SENDER = 64;
   Behavior _behavior;
-  QHash<qint64,MessageSender*> _sessionSenders; // sesionid -> messagesender
-  MessageSender *_lastInserted;
-  QMutex _mutex;
+  // readers' data, only accessed through SnapshotReaders::Reader and
+  // std::atomic_store()
+  std::shared_ptr<Routes> _routes;
+  SnapshotReaders _readers;
+  QMutex _mutex; // writers' mutex
+  KeyFunction _keyFunction;
+  QAtomicInteger<quint32> _nextSender;
   static OutgoingMessageDispatcher *_instance;
 
 public:
   OutgoingMessageDispatcher(Behavior behavior);
-  /** thread-safe */
-  static void dispatch(Message message) { instance()->doDispatch(message); }
+  ~OutgoingMessageDispatcher();
+  /** thread-safe
+   * @return false if the message was dropped, either because there is no
+   * sender for it or because the sender dropped it (e.g. queue full) */
+  static bool dispatch(Message message) {
+    return instance()->doDispatch(message); }
   /** thread-safe */
   static void setSessionSender(qint64 sessionid, MessageSender *sender) {
     instance()->doSetSessionSender(sessionid, sender); }
   /** thread-safe */
   static void removeSessionSender(qint64 sessionid) {
     instance()->doRemoveSessionSender(sessionid); }
+  /** Set the function computing the key used by ConsistentHash behavior.
+   * Default key is the message root node name.
+   * Must be called before any dispatch. */
+  void setKeyFunction(KeyFunction keyFunction) { _keyFunction = keyFunction; }
+  /** Outbound queue size of every session sender, as gauges.
+   * thread-safe */
+  static QHash<qint64,int> queuedMessagesCounts();
 
 private:
   static OutgoingMessageDispatcher *instance() {
@@ -52,11 +92,14 @@ private:
     return _instance;
   }
   /** thread-safe */
-  void doDispatch(Message message);
+  bool doDispatch(Message message);
   /** thread-safe */
   void doSetSessionSender(qint64 sessionid, MessageSender *sender);
   /** thread-safe */
   void doRemoveSessionSender(qint64 sessionid);
+  MessageSender *chooseSender(const Routes &routes, const Message &message);
+  /** must be called with _mutex locked */
+  void publish(Routes *routes);
 };
 
 #endif // OUTGOINGMESSAGEDISPATCHER_H
@@ -0,0 +1,145 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pfbinarycodec.h"
+#include <QtEndian>
+
+static inline void writeVarint(QByteArray *out, quint64 value) {
+  while (value >= 0x80) {
+    out->append(char((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->append(char(value));
+}
+
+static inline bool readVarint(const char *&p, const char *end,
+                              quint64 *value) {
+  quint64 result = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    quint8 byte = quint8(*p++);
+    result |= quint64(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void writeBytes(QByteArray *out, const QByteArray &data) {
+  writeVarint(out, quint64(data.size()));
+  out->append(data);
+}
+
+void PfBinaryEncoder::encodeFrame(const PfNode &node, QByteArray *out) {
+  int begin = out->size();
+  out->append(FRAME_MARKER);
+  out->append(FRAME_HEADER_SIZE-1, '\0'); // size placeholder
+  encodeNode(node, out);
+  qToLittleEndian<quint32>(quint32(out->size()-begin-FRAME_HEADER_SIZE),
+                           reinterpret_cast<uchar*>(out->data()+begin+1));
+}
+
+void PfBinaryEncoder::encodeNode(const PfNode &node, QByteArray *out) {
+  QString name = node.name();
+  int ref = _names.value(name, 0);
+  writeVarint(out, quint64(ref));
+  if (!ref) {
+    writeBytes(out, name.toUtf8());
+    if (_names.size() < MAX_INTERNED_NAMES)
+      _names.insert(name, _names.size()+1);
+  }
+  if (node.contentIsBinary()) {
+    writeVarint(out, 2);
+    writeBytes(out, node.contentAsByteArray());
+  } else {
+    QString content = node.contentAsString();
+    if (content.isEmpty()) {
+      writeVarint(out, 0);
+    } else {
+      writeVarint(out, 1);
+      writeBytes(out, content.toUtf8());
+    }
+  }
+  QList<PfNode> children;
+  foreach (const PfNode &child, node.children())
+    if (!child.isComment())
+      children.append(child);
+  writeVarint(out, quint64(children.size()));
+  foreach (const PfNode &child, children)
+    encodeNode(child, out);
+}
+
+qint64 PfBinaryDecoder::frameSize(const QByteArray &data) {
+  if (data.size() < PfBinaryEncoder::FRAME_HEADER_SIZE)
+    return -1;
+  return PfBinaryEncoder::FRAME_HEADER_SIZE + qFromLittleEndian<quint32>(
+        reinterpret_cast<const uchar*>(data.constData()+1));
+}
+
+bool PfBinaryDecoder::decodeFrame(const QByteArray &data, PfNode *node) {
+  qint64 size = frameSize(data);
+  if (size < 0 || size > data.size()
+      || data.at(0) != PfBinaryEncoder::FRAME_MARKER)
+    return fail("incomplete or invalid binary frame header");
+  const char *p = data.constData()+PfBinaryEncoder::FRAME_HEADER_SIZE;
+  const char *end = data.constData()+size;
+  if (!decodeNode(p, end, 0, node))
+    return false;
+  if (p != end)
+    return fail("trailing bytes in binary frame");
+  return true;
+}
+
+bool PfBinaryDecoder::decodeNode(const char *&p, const char *end, int depth,
+                                 PfNode *node) {
+  if (depth >= PfBinaryEncoder::MAX_DEPTH)
+    return fail("binary frame nodes nested too deeply");
+  quint64 ref, type, size, count;
+  QString name;
+  if (!readVarint(p, end, &ref))
+    return fail("truncated node name in binary frame");
+  if (ref) {
+    if (ref > quint64(_names.size()))
+      return fail("unknown interned name in binary frame");
+    name = _names[int(ref-1)];
+  } else {
+    if (!readVarint(p, end, &size) || size > quint64(end-p))
+      return fail("truncated node name in binary frame");
+    name = QString::fromUtf8(p, int(size));
+    p += size;
+    if (_names.size() < PfBinaryEncoder::MAX_INTERNED_NAMES)
+      _names.append(name);
+  }
+  *node = PfNode(name);
+  if (!readVarint(p, end, &type) || type > 2)
+    return fail("invalid content type in binary frame");
+  if (type) {
+    if (!readVarint(p, end, &size) || size > quint64(end-p))
+      return fail("truncated content in binary frame");
+    if (type == 1)
+      node->appendContent(QString::fromUtf8(p, int(size)));
+    else
+      node->appendContent(QByteArray(p, int(size)));
+    p += size;
+  }
+  if (!readVarint(p, end, &count) || count > quint64(end-p))
+    return fail("invalid children count in binary frame");
+  for (quint64 i = 0; i < count; ++i) {
+    PfNode child;
+    if (!decodeNode(p, end, depth+1, &child))
+      return false;
+    node->appendChild(child);
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PFBINARYCODEC_H
+#define PFBINARYCODEC_H
+
+#include "pf/pfnode.h"
+#include <QHash>
+#include <QStringList>
+#include "libp6core_global.h"
+
+/** Compact length-prefixed binary encoding of PfNode trees, used by
+ * TcpConnectionHandler as an alternative to PF text when both peers support
+ * it, to avoid escaping and parsing text.
+ *
+ * A frame is FRAME_MARKER, a 32 bits little endian payload size and the
+ * payload, i.e. the root node encoded as:
+ * node := name content childrenCount child*
+ * name := varint ref, 0 meaning an inline name (varint size + UTF-8) that is
+ *   then interned, otherwise 1-based index of an already interned name
+ * content := varint type (0 none, 1 UTF-8 text, 2 raw binary), and for types
+ *   1 and 2: varint size + bytes
+ * Varints are unsigned LEB128.
+ *
+ * Names are interned per stream: an encoder and the decoder at the other end
+ * of the same connection must see the same frames in the same order, and
+ * both stop interning at MAX_INTERNED_NAMES.
+ * Comment nodes are not encoded.
+ * LATER support array content natively, it is currently sent as text. */
+class LIBPUMPKINSHARED_EXPORT PfBinaryEncoder {
+  QHash<QString,int> _names;
+
+public:
+  static const char FRAME_MARKER = '\x01';
+  static const int FRAME_HEADER_SIZE = 5;
+  static const int MAX_INTERNED_NAMES = 4096;
+  static const int MAX_DEPTH = 256;
+  /** Append a whole frame (marker, size and payload) to out. */
+  void encodeFrame(const PfNode &node, QByteArray *out);
+  void reset() { _names.clear(); }
+
+private:
+  void encodeNode(const PfNode &node, QByteArray *out);
+};
+
+class LIBPUMPKINSHARED_EXPORT PfBinaryDecoder {
+  QStringList _names;
+  QString _errorString;
+
+public:
+  /** Size of the frame starting at data[0], including header, or -1 if
+   * data does not yet contain the whole header. */
+  static qint64 frameSize(const QByteArray &data);
+  /** Decode the frame starting at data[0], which must be complete.
+   * @return false on error, see errorString() */
+  bool decodeFrame(const QByteArray &data, PfNode *node);
+  QString errorString() const { return _errorString; }
+  void reset() { _names.clear(); _errorString.clear(); }
+
+private:
+  bool decodeNode(const char *&p, const char *end, int depth, PfNode *node);
+  bool fail(QString errorString) { _errorString = errorString; return false; }
+};
+
+#endif // PFBINARYCODEC_H
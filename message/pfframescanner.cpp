@@ -0,0 +1,101 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pfframescanner.h"
+
+PfFrameScanner::Result PfFrameScanner::scan(
+    const QByteArray &data, int *begin, int *end) {
+  const char *p = data.constData();
+  int size = data.size();
+  while (_pos < size) {
+    char c = p[_pos];
+    switch (_state) {
+    case Text:
+      switch (c) {
+      case '(':
+        if (!_depth)
+          _begin = _pos;
+        ++_depth;
+        break;
+      case ')':
+        if (!_depth)
+          return Error;
+        if (!--_depth) {
+          *begin = _begin;
+          *end = ++_pos;
+          return Frame;
+        }
+        break;
+      case '\\':
+        _state = Escape;
+        break;
+      case '#':
+        _state = Comment;
+        break;
+      case '|':
+        if (!_depth)
+          return Error;
+        _state = BinaryHeader;
+        _binarySize = 0;
+        _binaryDigits = 0;
+        _binaryDigitsDone = false;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+        break;
+      default:
+        if (!_depth)
+          return Error; // text outside any node
+      }
+      ++_pos;
+      break;
+    case Escape:
+      _state = Text;
+      ++_pos;
+      break;
+    case Comment:
+      if (c == '\n')
+        _state = Text;
+      ++_pos;
+      break;
+    case BinaryHeader:
+      // binary fragment header is |size[anything]\n, followed by size bytes
+      if (c == '\n') {
+        if (!_binaryDigits)
+          return Error;
+        _state = _binarySize ? Binary : Text;
+      } else if (c >= '0' && c <= '9' && !_binaryDigitsDone) {
+        _binarySize = _binarySize*10+(c-'0');
+        if (++_binaryDigits > 10)
+          return Error; // no sane message is that large
+      } else {
+        if (!_binaryDigits)
+          return Error;
+        _binaryDigitsDone = true;
+      }
+      ++_pos;
+      break;
+    case Binary: {
+      qint64 n = qMin(_binarySize, qint64(size-_pos));
+      _pos += int(n);
+      _binarySize -= n;
+      if (!_binarySize)
+        _state = Text;
+      break;
+    }
+    }
+  }
+  return Incomplete;
+}
@@ -0,0 +1,64 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PFFRAMESCANNER_H
+#define PFFRAMESCANNER_H
+
+#include <QByteArray>
+#include "libp6core_global.h"
+
+/** Incremental scanner finding root node boundaries in a PF byte stream, so
+ * that a complete node can be handed to PfParser without blocking on a
+ * socket while waiting for the rest of it.
+ * Only knows what is needed to follow node nesting: parenthesis depth,
+ * backslash escapes, comments and binary fragments (whose raw content must not
+ * be looked at). Any other syntax error is left to PfParser.
+ * Scanning resumes where the previous call stopped, therefore data that was
+ * already scanned is never looked at twice while waiting for more input. */
+class LIBPUMPKINSHARED_EXPORT PfFrameScanner {
+public:
+  enum Result { Incomplete, Frame, Error };
+
+private:
+  enum State { Text, Escape, Comment, BinaryHeader, Binary };
+  State _state;
+  int _pos, _depth, _begin;
+  qint64 _binarySize;
+  int _binaryDigits;
+  bool _binaryDigitsDone;
+
+public:
+  PfFrameScanner() { reset(); }
+  /** Look for end of the first root node in data, which must start with the
+   * same bytes than data given to previous calls since last reset().
+   * @param begin set to index of the root node opening parenthesis
+   * @param end set to index following the root node closing parenthesis
+   * @return Frame if a whole root node has been found, Incomplete if more
+   * data is needed, Error if data cannot be a PF document (e.g. text outside
+   * any node) */
+  Result scan(const QByteArray &data, int *begin, int *end);
+  /** Forget state, to be called when scanned data is removed from buffer,
+   * typically after a frame has been extracted. */
+  void reset() {
+    _state = Text;
+    _pos = _depth = 0;
+    _begin = -1;
+    _binarySize = 0;
+    _binaryDigits = 0;
+    _binaryDigitsDone = false;
+  }
+  /** Number of bytes already scanned. */
+  int scannedSize() const { return _pos; }
+};
+
+#endif // PFFRAMESCANNER_H
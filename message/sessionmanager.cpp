@@ -12,74 +12,208 @@
  * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "sessionmanager.h"
+#include <QDateTime>
+#include <QThread>
+#include <QTimer>
 
-static QMutex _mutex;
-static SessionManager *_singleton = 0;
+SessionManager::SessionManager()
+  : QObject(0), _reaperThread(0), _reaperTimer(0), _idleTimeout(0) {
+}
+
+SessionManager *SessionManager::instance() {
+  // never deleted, as before sharding, since sessions may be closed until
+  // the very end of the process
+  static SessionManager *singleton = new SessionManager;
+  return singleton;
+}
 
 Session SessionManager::createSession() {
   SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  qint64 id = ++(sm->_lastSessionId);
+  qint64 id = sm->_lastSessionId.fetchAndAddOrdered(1)+1;
   Session session = Session(id);
-  sm->_sessions.insert(id, session);
+  Shard &shard = sm->shard(id);
+  QMutexLocker ml(&shard._mutex);
+  SessionData &data = shard._sessions[id];
+  data._session = session;
+  data._lastActivity = QDateTime::currentMSecsSinceEpoch();
+  ml.unlock();
+  sm->_sessionsCount.fetchAndAddRelaxed(1);
   return session;
 }
 
 Session SessionManager::session(qint64 sessionid) {
-  SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  return sm->_sessions.value(sessionid);
-}
-
-SessionManager *SessionManager::instance() {
-  QMutexLocker ml(&_mutex);
-  if (!_singleton)
-    _singleton = new SessionManager;
-  return _singleton;
+  Shard &shard = instance()->shard(sessionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.constFind(sessionid);
+  return it == shard._sessions.constEnd() ? Session() : it.value()._session;
 }
 
 void SessionManager::closeSession(qint64 sessionid) {
   SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  Session session = sm->_sessions.value(sessionid);
-  if (session.isNull())
+  Shard &shard = sm->shard(sessionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(sessionid);
+  if (it == shard._sessions.end())
     return;
-  sm->_sessions.remove(sessionid);
+  Session session = it.value()._session;
+  // params are removed along with the session, under the same lock
+  shard._sessions.erase(it);
   ml.unlock();
+  sm->_sessionsCount.fetchAndSubRelaxed(1);
   emit sm->sessionClosed(session);
 }
 
-QVariant SessionManager::param(qint64 sessionid, const char *key) {
+void SessionManager::touchSession(qint64 sessionid) {
+  Shard &shard = instance()->shard(sessionid);
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(sessionid);
+  if (it != shard._sessions.end())
+    it.value()._lastActivity = now;
+}
+
+void SessionManager::attachConnection(qint64 sessionid) {
+  Shard &shard = instance()->shard(sessionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(sessionid);
+  if (it != shard._sessions.end())
+    ++it.value()._connections;
+}
+
+void SessionManager::detachConnection(qint64 sessionid) {
+  Shard &shard = instance()->shard(sessionid);
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(sessionid);
+  if (it == shard._sessions.end())
+    return;
+  if (it.value()._connections > 0)
+    --it.value()._connections;
+  // idle time starts when the last connection goes away
+  it.value()._lastActivity = now;
+}
+
+void SessionManager::setIdleTimeout(qint64 idleTimeout) {
   SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  const QHash<const char*,QVariant> &paramset = sm->_params.value(sessionid);
-  return paramset.value(key);
+  QMutexLocker ml(&sm->_reaperMutex);
+  sm->_idleTimeout = idleTimeout;
+  if (!sm->_reaperThread) {
+    if (idleTimeout <= 0)
+      return;
+    sm->_reaperThread = new QThread;
+    sm->_reaperThread->setObjectName("SessionReaper");
+    sm->_reaperThread->start(QThread::LowPriority);
+    sm->_reaperTimer = new QTimer;
+    sm->_reaperTimer->moveToThread(sm->_reaperThread);
+    // direct connection: reaping is done by the reaper thread itself
+    connect(sm->_reaperTimer, &QTimer::timeout,
+            sm, &SessionManager::reapIdleSessions, Qt::DirectConnection);
+  }
+  // timer must be started and stopped by its own thread
+  if (idleTimeout > 0)
+    QMetaObject::invokeMethod(sm->_reaperTimer, "start",
+                              Q_ARG(int, int(qMax(1000LL, idleTimeout/4))));
+  else
+    QMetaObject::invokeMethod(sm->_reaperTimer, "stop");
+}
+
+void SessionManager::reapIdleSessions() {
+  QMutexLocker ml(&_reaperMutex);
+  qint64 idleTimeout = _idleTimeout;
+  ml.unlock();
+  if (idleTimeout > 0)
+    closeIdleSessions(idleTimeout);
+}
+
+int SessionManager::closeIdleSessions(qint64 idleTimeout) {
+  SessionManager *sm = instance();
+  qint64 deadline = QDateTime::currentMSecsSinceEpoch()-idleTimeout;
+  int count = 0;
+  for (int i = 0; i < SHARDS_COUNT; ++i) {
+    QList<Session> idle;
+    Shard &shard = sm->_shards[i];
+    QMutexLocker ml(&shard._mutex);
+    for (auto it = shard._sessions.begin(); it != shard._sessions.end(); ) {
+      if (it.value()._lastActivity <= deadline
+          && !it.value()._connections) {
+        idle.append(it.value()._session);
+        it = shard._sessions.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    ml.unlock();
+    sm->_sessionsCount.fetchAndSubRelaxed(idle.size());
+    count += idle.size();
+    foreach (const Session &session, idle)
+      emit sm->sessionClosed(session);
+  }
+  return count;
+}
+
+int SessionManager::sessionsCount() {
+  return instance()->_sessionsCount.loadAcquire();
+}
+
+qint64 SessionManager::memoryUsage() {
+  SessionManager *sm = instance();
+  // rough estimates of QHash nodes overhead, enough for a gauge
+  static const qint64 sessionOverhead = sizeof(SessionData)+32;
+  static const qint64 paramOverhead = sizeof(const char*)+sizeof(QVariant)+24;
+  qint64 total = 0;
+  for (int i = 0; i < SHARDS_COUNT; ++i) {
+    Shard &shard = sm->_shards[i];
+    QMutexLocker ml(&shard._mutex);
+    total += shard._sessions.size()*sessionOverhead;
+    foreach (const SessionData &data, shard._sessions) {
+      total += data._params.size()*paramOverhead;
+      foreach (const QVariant &value, data._params) {
+        // only the most common types are worth counting
+        if (value.type() == QVariant::String)
+          total += value.toString().size()*2;
+        else if (value.type() == QVariant::ByteArray)
+          total += value.toByteArray().size();
+      }
+    }
+  }
+  return total;
+}
+
+QVariant SessionManager::param(qint64 sessionid, const char *key) {
+  Shard &shard = instance()->shard(sessionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.constFind(sessionid);
+  return it == shard._sessions.constEnd() ? QVariant()
+                                          : it.value()._params.value(key);
 }
 
 void SessionManager::setParam(
     qint64 seesionid, const char *key, const QVariant &value) {
-  SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  if (!sm->_sessions.contains(seesionid))
+  Shard &shard = instance()->shard(seesionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(seesionid);
+  if (it == shard._sessions.end())
     return; // do not set param to inexistent session
-  sm->_params[seesionid][key] = value;
+  it.value()._params[key] = value;
 }
 
 void SessionManager::unsetParam(
     qint64 seesionid, const char *key) {
-  SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
-  if (!sm->_sessions.contains(seesionid))
+  Shard &shard = instance()->shard(seesionid);
+  QMutexLocker ml(&shard._mutex);
+  auto it = shard._sessions.find(seesionid);
+  if (it == shard._sessions.end())
     return; // do not set param to inexistent session
-  sm->_params[seesionid].remove(key);
+  it.value()._params.remove(key);
 }
 
 const QHash<const char*,QVariant> SessionManager::params(qint64 sessionid) {
-  SessionManager *sm = instance();
-  QMutexLocker ml(&_mutex);
+  Shard &shard = instance()->shard(sessionid);
+  QMutexLocker ml(&shard._mutex);
   QHash<const char *,QVariant> params;
-  if (sm->_sessions.contains(sessionid)) {
-    params = sm->_params.value(sessionid);
+  auto it = shard._sessions.constFind(sessionid);
+  if (it != shard._sessions.constEnd()) {
+    params = it.value()._params;
     params.detach();
   }
   return params;
@@ -18,22 +18,86 @@
 #include "session.h"
 #include <QHash>
 #include <QMutex>
+#include <QAtomicInteger>
 
+class QThread;
+class QTimer;
+
+/** Registry of sessions and their params.
+ * Sessions are spread among SHARDS_COUNT independently locked shards
+ * depending on their id, so that connections threads seldom contend.
+ * A session's params are held with the session itself and therefore
+ * disappear with it when it is closed.
+ * The idle sessions reaper never closes a session while a connection is
+ * attached to it (see attachConnection()), since the connection handler owns
+ * the session's lifecycle. */
 class LIBPUMPKINSHARED_EXPORT SessionManager : public QObject {
   Q_OBJECT
-  QHash<qint64,Session> _sessions;
-  QHash<qint64,QHash<const char*,QVariant>> _params;
-  qint64 _lastSessionId;
+  Q_DISABLE_COPY(SessionManager)
+
+public:
+  static const int SHARDS_COUNT = 64;
+
+private:
+  class SessionData {
+  public:
+    Session _session;
+    QHash<const char*,QVariant> _params;
+    qint64 _lastActivity; // ms since epoch
+    int _connections = 0; // attached connections count
+  };
+  class Shard {
+  public:
+    QMutex _mutex;
+    QHash<qint64,SessionData> _sessions;
+  };
+  Shard _shards[SHARDS_COUNT];
+  QAtomicInteger<qint64> _lastSessionId;
+  QAtomicInt _sessionsCount;
+  QMutex _reaperMutex;
+  QThread *_reaperThread;
+  QTimer *_reaperTimer;
+  qint64 _idleTimeout;
 
-  explicit SessionManager() : QObject(0), _lastSessionId(0) { }
+  explicit SessionManager();
 
 public:
   /** This method is thread-safe. */
   static Session createSession();
   /** This method is thread-safe. */
   static Session session(qint64 sessionid);
-  /** This method is thread-safe. */
+  /** Close the session and drop its params.
+   * This method is thread-safe. */
   static void closeSession(qint64 sessionid);
+  /** Record activity on the session, which postpones its closing by the idle
+   * sessions reaper.
+   * This method is thread-safe. */
+  static void touchSession(qint64 sessionid);
+  /** Record that a connection (e.g. a TcpConnectionHandler) is using the
+   * session, which prevents the idle sessions reaper from closing it until
+   * detachConnection() is called.
+   * This method is thread-safe. */
+  static void attachConnection(qint64 sessionid);
+  /** Undo attachConnection() and record activity on the session.
+   * This method is thread-safe. */
+  static void detachConnection(qint64 sessionid);
+  /** Close sessions without activity for idleTimeout ms or more, every
+   * idleTimeout/4 ms, in a dedicated low priority thread. 0 (the default)
+   * disables the reaper.
+   * This method is thread-safe. */
+  static void setIdleTimeout(qint64 idleTimeout);
+  /** Close sessions without activity for idleTimeout ms or more, and with no
+   * attached connection.
+   * @return number of closed sessions
+   * This method is thread-safe. */
+  static int closeIdleSessions(qint64 idleTimeout);
+  /** Number of live sessions, as a gauge.
+   * This method is thread-safe. */
+  static int sessionsCount();
+  /** Approximate memory used by sessions and their params, in bytes, as a
+   * gauge. Walks through every session, don't call it too often.
+   * This method is thread-safe. */
+  static qint64 memoryUsage();
   /** This method is thread-safe. */
   static SessionManager *instance();
   /** This method is thread-safe. */
@@ -50,6 +114,11 @@ public:
 
 signals:
   void sessionClosed(const Session &session);
+
+private:
+  Shard &shard(qint64 sessionid) {
+    return _shards[quint64(sessionid) % SHARDS_COUNT]; }
+  void reapIdleSessions();
 };
 
 #endif // SESSIONMANAGER_H
@@ -13,26 +13,46 @@
  */
 #include "tcpclient.h"
 #include <QTcpSocket>
+#include <QTimer>
+#include <QDateTime>
+#include <QAtomicInteger>
 #include "tcpconnectionhandler.h"
+#include "outgoingmessagedispatcher.h"
 #include "log/log.h"
 #include "session.h"
 #include "sessionmanager.h"
-#include <QtDebug>
+
+static QAtomicInteger<qint64> _lastSenderKey;
 
 TcpClient::TcpClient(IncomingMessageDispatcher *dispatcher)
-  : QObject(), _thread(new QThread), _dispatcher(dispatcher), _handler(0),
-    _port(0) {
+  : MessageSender(), _thread(new QThread), _dispatcher(dispatcher), _handler(0),
+    _socket(0), _connectTimer(new QTimer(this)), _retryTimer(new QTimer(this)),
+    _port(0), _senderKey(0), _connected(false), _maxQueuedMessages(1024),
+    _droppedMessages(0), _attempts(0), _initialReconnectDelay(100),
+    _maxReconnectDelay(30000),
+    _random(quint32(QDateTime::currentMSecsSinceEpoch())) {
   _thread->setObjectName("TcpClient");
-  connect(this, &TcpConnectionHandler::destroyed, _thread, &QThread::quit);
+  connect(this, &TcpClient::destroyed, _thread, &QThread::quit);
   connect(_thread, &QThread::finished, _thread, &QThread::deleteLater);
   _thread->start();
   moveToThread(_thread);
+  _connectTimer->setSingleShot(true);
+  _connectTimer->setInterval(CONNECT_TIMEOUT);
+  connect(_connectTimer, &QTimer::timeout, this, &TcpClient::connectTimeout);
+  _retryTimer->setSingleShot(true);
+  connect(_retryTimer, &QTimer::timeout, this, &TcpClient::tryConnect);
   _handler = new TcpConnectionHandler(dispatcher);
   connect(_handler, &TcpConnectionHandler::handlerReleased,
-          this, &TcpClient::tryConnect);
-  // TODO may need to connect to some socket events too
+          this, &TcpClient::handlerReleased);
   qRegisterMetaType<QHostAddress>("QHostAddress");
-  qMetaTypeId<TcpConnectionHandler*>();
+}
+
+TcpClient::~TcpClient() {
+  // dispatcher waits for dispatches that may be using this client
+  if (_session)
+    OutgoingMessageDispatcher::removeSessionSender(_session.id());
+  if (_senderKey)
+    OutgoingMessageDispatcher::removeSessionSender(_senderKey);
 }
 
 void TcpClient::connectToHost(const QHostAddress &address, quint16 port) {
@@ -44,29 +64,133 @@ void TcpClient::connectToHost(const QHostAddress &address, quint16 port) {
 void TcpClient::doConnectToHost(const QHostAddress &address, quint16 port) {
   _address = address;
   _port = port;
-  tryConnect(0);
+  if (!_senderKey) {
+    // negative keys cannot collide with session ids
+    _senderKey = -_lastSenderKey.fetchAndAddRelaxed(1)-1;
+    OutgoingMessageDispatcher::setSessionSender(_senderKey, this);
+  }
+  _attempts = 0;
+  tryConnect();
 }
 
-void TcpClient::tryConnect(TcpConnectionHandler*) {
-  qDebug() << "connecting";
-  emit connecting();
-  qDebug() << "connecting signal emitted";
-  QTcpSocket *socket = new QTcpSocket;
-  socket->connectToHost(_address, _port);
-  bool result = socket->waitForConnected(3000);
-  qDebug() << "waitForConnected" << result;
-  if (!result) {
-    Log::warning() << "cannot connect to server: " << socket->errorString();
-    QMetaObject::invokeMethod(this, "tryConnect", Qt::QueuedConnection,
-                              Q_ARG(TcpConnectionHandler*, 0));
-    // FIXME need to delete again socket after solving multithread issue
-    //delete socket;
+void TcpClient::setReconnectDelays(int initialReconnectDelay,
+                                   int maxReconnectDelay) {
+  QMutexLocker ml(&_mutex);
+  _initialReconnectDelay = qMax(1, initialReconnectDelay);
+  _maxReconnectDelay = qMax(_initialReconnectDelay, maxReconnectDelay);
+}
+
+void TcpClient::setMaxQueuedMessages(int maxQueuedMessages) {
+  QMutexLocker ml(&_mutex);
+  _maxQueuedMessages = qMax(0, maxQueuedMessages);
+}
+
+void TcpClient::tryConnect() {
+  if (_socket || _connected)
     return;
-  }
+  emit connecting();
+  _socket = new QTcpSocket(this);
+  connect(_socket, &QTcpSocket::connected, this, &TcpClient::socketConnected);
+#if QT_VERSION >= 0x050f00
+  connect(_socket, &QTcpSocket::errorOccurred, this, &TcpClient::socketError);
+#else
+  connect(_socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+          this, &TcpClient::socketError);
+#endif
+  _connectTimer->start();
+  _socket->connectToHost(_address, _port);
+}
+
+void TcpClient::socketConnected() {
+  _connectTimer->stop();
+  QTcpSocket *socket = _socket;
+  _socket = 0;
+  socket->disconnect(this);
+  socket->setParent(0);
   Log::debug() << "successfuly connected to server";
+  _attempts = 0;
   _session = SessionManager::createSession();
   socket->moveToThread(_handler->thread());
-  _handler->processConnection(socket, _session);
+  _handler->processConnection(socket, _session, false);
+  QMutexLocker ml(&_mutex);
+  // replaying under lock ensures that new messages cannot overtake queued ones
+  foreach (const Message &message, _queuedMessages)
+    _handler->sendOutgoingMessage(Message(_session, message.node()));
+  _queuedMessages.clear();
+  _connected = true;
+  ml.unlock();
+  OutgoingMessageDispatcher::setSessionSender(_session.id(), this);
   emit connected();
-  qDebug() << "connected";
+}
+
+void TcpClient::socketError(QAbstractSocket::SocketError) {
+  if (_socket)
+    connectionFailed(_socket->errorString());
+}
+
+void TcpClient::connectTimeout() {
+  connectionFailed("connection timeout");
+}
+
+void TcpClient::connectionFailed(QString errorString) {
+  if (!_socket)
+    return;
+  _connectTimer->stop();
+  _socket->disconnect(this);
+  _socket->abort();
+  _socket->deleteLater();
+  _socket = 0;
+  Log::warning() << "cannot connect to server: " << errorString;
+  scheduleReconnect();
+}
+
+void TcpClient::handlerReleased() {
+  QMutexLocker ml(&_mutex);
+  _connected = false;
+  ml.unlock();
+  if (_session)
+    OutgoingMessageDispatcher::removeSessionSender(_session.id());
+  _session = Session();
+  emit disconnected();
+  scheduleReconnect();
+}
+
+void TcpClient::scheduleReconnect() {
+  QMutexLocker ml(&_mutex);
+  int initial = _initialReconnectDelay, max = _maxReconnectDelay;
+  ml.unlock();
+  qint64 delay = qMin(qint64(max), qint64(initial) << qMin(_attempts, 30));
+  ++_attempts;
+  // random delay between half and full backoff delay
+  delay = delay/2+qint64(_random() % quint64(delay/2+1));
+  Log::debug() << "will try to reconnect in " << delay << " ms";
+  _retryTimer->start(int(delay));
+}
+
+int TcpClient::queuedMessagesCount() const {
+  QMutexLocker ml(&_mutex);
+  return _connected ? _handler->queuedMessagesCount() : _queuedMessages.size();
+}
+
+bool TcpClient::sendOutgoingMessage(Message message) {
+  QMutexLocker ml(&_mutex);
+  if (_connected)
+    return _handler->sendOutgoingMessage(message);
+  if (_queuedMessages.size() < _maxQueuedMessages) {
+    _queuedMessages.append(message);
+    if (_droppedMessages) {
+      qint64 dropped = _droppedMessages;
+      _droppedMessages = 0;
+      ml.unlock();
+      Log::warning() << "dropped " << dropped << " outgoing messages while "
+                        "disconnected from server";
+    }
+    return true;
+  }
+  bool first = !_droppedMessages++;
+  ml.unlock();
+  if (first)
+    Log::warning() << "outgoing messages queue full while disconnected from "
+                      "server, dropping messages";
+  return false;
 }
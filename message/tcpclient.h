@@ -14,37 +14,90 @@
 #ifndef TCPCLIENT_H
 #define TCPCLIENT_H
 
-#include <QObject>
+#include "messagesender.h"
 #include "incomingmessagedispatcher.h"
 #include <QHostAddress>
+#include <QAbstractSocket>
+#include <QMutex>
+#include <random>
 
 class TcpConnectionHandler;
 class Session;
+class QTcpSocket;
+class QTimer;
 
 /** Object responsible for (re)connecting to the server via TCP.
  * Create a TcpConnectionHandler that processes established connections
- * and call MessageDispatcher when needed. */
-class LIBPUMPKINSHARED_EXPORT TcpClient : public QObject {
+ * and call MessageDispatcher when needed.
+ *
+ * Connection is asynchronous. After a failure or a disconnection, next
+ * attempt is delayed with exponential backoff, starting from
+ * initialReconnectDelay() and up to maxReconnectDelay(), with jitter so that
+ * many clients of the same server do not retry all at once.
+ *
+ * The client registers itself as an OutgoingMessageDispatcher sender, under
+ * a key unique to the client that is never a session id, for its whole
+ * lifetime, which makes it usable with SendToLastRecordedSender behavior and
+ * load balancing behaviors, and also under its current session id while
+ * connected, for DispatchAmongSessions behavior.
+ * While disconnected, outgoing messages are queued, up to
+ * maxQueuedMessages(), and sent once connected again. */
+class LIBPUMPKINSHARED_EXPORT TcpClient : public MessageSender {
   Q_OBJECT
   QThread *_thread;
   IncomingMessageDispatcher *_dispatcher;
   TcpConnectionHandler* _handler;
+  QTcpSocket *_socket;
+  QTimer *_connectTimer, *_retryTimer;
   QHostAddress _address;
   quint16 _port;
   Session _session;
+  qint64 _senderKey; // 0 until registred, then < 0
+  mutable QMutex _mutex;
+  bool _connected;
+  QList<Message> _queuedMessages;
+  int _maxQueuedMessages;
+  qint64 _droppedMessages;
+  int _attempts, _initialReconnectDelay, _maxReconnectDelay;
+  std::minstd_rand _random;
 
 public:
+  static const int CONNECT_TIMEOUT = 3000; // ms
+
   explicit TcpClient(IncomingMessageDispatcher *dispatcher);
+  ~TcpClient();
   /** thread-safe */
   void connectToHost(const QHostAddress &address, quint16 port = 0);
+  /** thread-safe, can be called by any thread, never blocks
+   * @return false if the message was dropped, either by the connection
+   * handler or because too many messages are queued while disconnected */
+  bool sendOutgoingMessage(Message message) override;
+  /** thread-safe */
+  int queuedMessagesCount() const override;
+  /** Set backoff delays, in ms. Defaults to 100 and 30000.
+   * thread-safe, applies to next reconnection */
+  void setReconnectDelays(int initialReconnectDelay, int maxReconnectDelay);
+  int initialReconnectDelay() const { return _initialReconnectDelay; }
+  int maxReconnectDelay() const { return _maxReconnectDelay; }
+  /** Defaults to 1024, 0 means no queuing at all.
+   * thread-safe */
+  void setMaxQueuedMessages(int maxQueuedMessages);
+  int maxQueuedMessages() const { return _maxQueuedMessages; }
 
 signals:
   void connecting();
   void connected();
+  void disconnected();
 
 private:
   Q_INVOKABLE void doConnectToHost(const QHostAddress &address, quint16 port);
-  Q_INVOKABLE void tryConnect(TcpConnectionHandler*);
+  void tryConnect();
+  void socketConnected();
+  void socketError(QAbstractSocket::SocketError error);
+  void connectTimeout();
+  void handlerReleased();
+  void connectionFailed(QString errorString);
+  void scheduleReconnect();
 };
 
 #endif // TCPCLIENT_H
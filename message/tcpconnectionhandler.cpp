@@ -17,103 +17,399 @@
 #include <QHostAddress>
 #include "pf/pfparser.h"
 #include "pf/pfdomhandler.h"
-#include <QCoreApplication>
+#include <QBuffer>
 #include "outgoingmessagedispatcher.h"
 #include "sessionmanager.h"
 
-static QAtomicInt _handlersCounter;
+namespace {
+
+/** Threads shared among all connection handlers. WorkerPool does not fit
+ * since handlers need an event loop to receive socket signals. */
+class ConnectionThreads {
+public:
+  QList<QThread*> _threads;
+  QAtomicInt _next;
+  ConnectionThreads() {
+    // LATER make threads count configurable
+    int count = qMax(2, QThread::idealThreadCount());
+    for (int i = 0; i < count; ++i) {
+      QThread *thread = new QThread;
+      thread->setObjectName(QString("TcpConnectionHandler-%1").arg(i));
+      thread->start();
+      _threads.append(thread);
+    }
+  }
+  ~ConnectionThreads() {
+    foreach (QThread *thread, _threads)
+      thread->quit();
+    foreach (QThread *thread, _threads)
+      thread->wait();
+    qDeleteAll(_threads);
+  }
+  QThread *next() {
+    return _threads[int(uint(_next.fetchAndAddRelaxed(1)) % _threads.size())];
+  }
+};
+
+} // unnamed namespace
+
+Q_GLOBAL_STATIC(ConnectionThreads, _connectionThreads)
+
+static QAtomicInt _binaryEncodingEnabled;
+
+// handshake is a PF comment, which peers without binary support ignore
+static const QByteArray _handshakeComment("#pfbinary");
 
 TcpConnectionHandler::TcpConnectionHandler(IncomingMessageDispatcher *dispatcher)
-  : _thread(new QThread()), _socket(0), _session(0),
-    _dispatcher(dispatcher) {
-  _thread->setObjectName(QString("TcpConnectionHandler-%1")
-                         .arg(_handlersCounter.fetchAndAddOrdered(1)));
-  connect(this, &TcpConnectionHandler::destroyed, _thread, &QThread::quit);
-  connect(_thread, &QThread::finished, _thread, &QThread::deleteLater);
-  _thread->start();
-  moveToThread(_thread);
+  : _socket(0), _session(0), _dispatcher(dispatcher),
+    _activityTimer(new QTimer(this)), _writeScheduled(false),
+    _inputPaused(false), _peerAcceptsBinary(false),
+    _registeredAsSender(false), _droppedMessages(0) {
+  // reserved capacity is kept when the buffer is truncated
+  _outBuffer.reserve(OUTPUT_BUFFER_RESERVE);
+  _activityTimer->setSingleShot(true);
+  _activityTimer->setInterval(ACTIVITY_TIMEOUT);
+  connect(_activityTimer, &QTimer::timeout,
+          this, &TcpConnectionHandler::activityTimeout);
+  moveToThread(_connectionThreads()->next());
   qMetaTypeId<QTcpSocket*>();
 }
 
+int TcpConnectionHandler::threadsCount() {
+  return _connectionThreads()->_threads.size();
+}
+
+void TcpConnectionHandler::setBinaryEncodingEnabled(bool enabled) {
+  _binaryEncodingEnabled.storeRelease(enabled);
+}
+
+bool TcpConnectionHandler::binaryEncodingEnabled() {
+  return _binaryEncodingEnabled.loadAcquire();
+}
+
 void TcpConnectionHandler::processConnection(
-    QTcpSocket *socket, const Session &session) {
+    QTcpSocket *socket, const Session &session, bool registerAsSender) {
   QMutexLocker ml(&_mutex);
   _socket = socket;
   _session = session;
+  _registeredAsSender = registerAsSender;
   ml.unlock();
-  OutgoingMessageDispatcher::setSessionSender(session.id(), this);
+  // the session lives as long as the connection, whatever its idle time
+  SessionManager::attachConnection(session.id());
+  if (registerAsSender)
+    OutgoingMessageDispatcher::setSessionSender(session.id(), this);
   // sending QTcpSocket* through queued connection is safe because it cannot be
   // deleted before processing the call otherwise it wouldn't
   // this is guaranted because the only way to delete it is calling
-  // releaseHandler() which is only called by doProcessConnection
+  // releaseHandler() which is only called once doProcessConnection was called
   QMetaObject::invokeMethod(this, "doProcessConnection",
                             Q_ARG(QTcpSocket*, socket),
                             Q_ARG(Session, session));
 }
 
 void TcpConnectionHandler::doProcessConnection(QTcpSocket *, const Session &) {
-  QString clientaddr = _session.string("clientaddr");
-  Log::debug(_session.id()) << "processing new connection " << clientaddr
+  Log::debug(_session.id()) << "processing new connection "
+                            << _session.string("clientaddr")
                             << _socket << _session;
-  PfDomHandler handler;
-  PfParser parser(&handler);
-  PfOptions options = PfOptions().stopAfterFirstRootNode()
-      .setReadTimeout(ACTIVITY_TIMEOUT);
+  _inBuffer.clear();
+  _scanner.reset();
+  _encoder.reset();
+  _decoder.reset();
+  _inputPaused = false;
+  _peerAcceptsBinary = false;
+  if (binaryEncodingEnabled())
+    _socket->write(_handshakeComment+" 1\n");
+  // bounding socket read buffer ensures that when input is paused, Qt stops
+  // reading and TCP flow control applies to the peer
+  _socket->setReadBufferSize(INPUT_BUFFER_SIZE);
+  connect(_socket, &QTcpSocket::readyRead,
+          this, &TcpConnectionHandler::readIncoming);
+  connect(_socket, &QTcpSocket::bytesWritten,
+          this, &TcpConnectionHandler::writeOutgoing);
+  connect(_socket, &QTcpSocket::disconnected,
+          this, &TcpConnectionHandler::peerDisconnected);
+  _activityTimer->start();
+  // data may have been received and messages queued before signals were
+  // connected
+  readIncoming();
+  writeOutgoing();
+}
+
+void TcpConnectionHandler::readIncoming() {
+  if (!_socket || _inputPaused)
+    return;
+  _activityTimer->start();
+  _inBuffer.append(_socket->readAll());
+  bool debug = Log::isSeverityEnabled(Log::Debug);
   forever {
-    if (!parser.parse(_socket, options)) {
-      Log::warning(_session.id()) << "cannot parse pf document: " << clientaddr
-                                  << " : " << handler.errorString();
+    if (!_scanner.scannedSize()) {
+      // between frames: skip separators and look for a binary frame
+      int i = 0;
+      for (; i < _inBuffer.size(); ++i) {
+        char c = _inBuffer.at(i);
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+          break;
+      }
+      if (i)
+        _inBuffer.remove(0, i);
+      if (!_inBuffer.isEmpty() && _inBuffer.at(0) == '#') {
+        // comment between root nodes, possibly a binary encoding handshake
+        int eol = _inBuffer.indexOf('\n');
+        if (eol < 0) {
+          if (_inBuffer.size() > MAX_MESSAGE_SIZE) {
+            Log::warning(_session.id()) << "incoming comment too large: "
+                                        << _session.string("clientaddr");
+            releaseHandler();
+          }
+          return; // wait for the end of the comment
+        }
+        QByteArray comment = _inBuffer.left(eol).trimmed();
+        _inBuffer.remove(0, eol+1);
+        if (comment.startsWith(_handshakeComment)) {
+          _peerAcceptsBinary =
+              comment.mid(_handshakeComment.size()).trimmed() == "1";
+          Log::debug(_session.id()) << "peer "
+                                    << (_peerAcceptsBinary ? "accepts"
+                                                           : "refuses")
+                                    << " binary encoding";
+        }
+        continue;
+      }
+      if (!_inBuffer.isEmpty()
+          && _inBuffer.at(0) == PfBinaryEncoder::FRAME_MARKER) {
+        qint64 size = PfBinaryDecoder::frameSize(_inBuffer);
+        if (size > MAX_MESSAGE_SIZE) {
+          Log::warning(_session.id()) << "incoming message too large: "
+                                      << _session.string("clientaddr");
+          releaseHandler();
+          return;
+        }
+        if (size < 0 || size > _inBuffer.size())
+          return; // wait for the rest of the frame
+        PfNode node;
+        if (!_decoder.decodeFrame(_inBuffer, &node)) {
+          Log::warning(_session.id()) << "cannot decode binary message: "
+                                      << _session.string("clientaddr")
+                                      << " : " << _decoder.errorString();
+          releaseHandler();
+          return;
+        }
+        _inBuffer.remove(0, int(size));
+        Message message(_session, node);
+        if (debug)
+          Log::debug(_session.id()) << "<<< "
+                                    << QString::fromUtf8(node.toPf());
+        if (!dispatchIncoming(message))
+          return;
+        continue;
+      }
+    }
+    int begin, end;
+    PfFrameScanner::Result result = _scanner.scan(_inBuffer, &begin, &end);
+    if (result == PfFrameScanner::Incomplete) {
+      if (_inBuffer.size() > MAX_MESSAGE_SIZE) {
+        Log::warning(_session.id()) << "incoming message too large: "
+                                    << _session.string("clientaddr");
+        releaseHandler();
+      }
+      return;
+    }
+    if (result == PfFrameScanner::Error) {
+      Log::warning(_session.id()) << "cannot parse pf document: "
+                                  << _session.string("clientaddr")
+                                  << " : data found outside pf nodes";
       releaseHandler();
-      break;
+      return;
     }
-    if (handler.roots().isEmpty()) {
-      Log::debug(_session.id()) << "peer disconnected or timed out: "
-                                << clientaddr;
+    QByteArray frame = _inBuffer.mid(begin, end-begin);
+    _inBuffer.remove(0, end);
+    _scanner.reset();
+    PfDomHandler handler;
+    PfParser parser(&handler);
+    QBuffer buffer(&frame);
+    buffer.open(QIODevice::ReadOnly);
+    if (!parser.parse(&buffer, PfOptions().stopAfterFirstRootNode())
+        || handler.roots().isEmpty()) {
+      Log::warning(_session.id()) << "cannot parse pf document: "
+                                  << _session.string("clientaddr")
+                                  << " : " << handler.errorString();
       releaseHandler();
-      break;
-    } else {
-      Message message(_session, handler.roots().first());
-      Log::debug(_session.id()) << "<<< "
-                                << QString::fromUtf8(message.node().toPf());
-      _dispatcher->dispatch(message);
+      return;
     }
-    handler.clear();
-    QCoreApplication::processEvents();
+    PfNode node = handler.roots().first();
+    Message message(_session, node);
+    if (debug)
+      Log::debug(_session.id()) << "<<< " << QString::fromUtf8(frame);
+    if (!dispatchIncoming(message))
+      return;
   }
 }
 
-void TcpConnectionHandler::sendOutgoingMessage(Message message) {
-  QByteArray ba = message.node().toPf();
+bool TcpConnectionHandler::dispatchIncoming(Message message) {
+  SessionManager::touchSession(_session.id());
+  _dispatcher->dispatch(message);
+  if (!_socket) // dispatching may have released the connection
+    return false;
   QMutexLocker ml(&_mutex);
-  if (_socket) {
-    if (_socket->write(ba) == -1) {
-      Log::warning(_session.id()) << "cannot send outgoing message : "
-                                  << _socket->errorString() << " : " << message;
-    }
-    _socket->write("\n");
-    Log::debug(_session.id()) << ">>> " << QString::fromUtf8(ba);
-    _socket->flush();
-  } else {
+  if (_outQueue.size() >= OUTPUT_QUEUE_HIGH_WATERMARK) {
+    // stop reading until peer has read enough of our output, remaining
+    // input stays in _inBuffer and in socket
+    _inputPaused = true;
+    return false;
+  }
+  return true;
+}
+
+bool TcpConnectionHandler::sendOutgoingMessage(Message message) {
+  QMutexLocker ml(&_mutex);
+  if (!_socket) {
+    ml.unlock();
     Log::warning() << "cannot send outgoing message : "
                       "connection disappeared : " << message;
+    return false;
+  }
+  if (_outQueue.size() >= OUTPUT_QUEUE_MAX_SIZE) {
+    qint64 sessionid = _session.id();
+    bool first = !_droppedMessages++;
+    ml.unlock();
+    if (first)
+      Log::warning(sessionid) << "outgoing messages queue full, peer is too "
+                                 "slow, dropping messages";
+    return false;
+  }
+  _outQueue.append(message);
+  if (_writeScheduled)
+    return true;
+  _writeScheduled = true;
+  ml.unlock();
+  QMetaObject::invokeMethod(this, "writeOutgoing", Qt::QueuedConnection);
+  return true;
+}
+
+int TcpConnectionHandler::queuedMessagesCount() const {
+  QMutexLocker ml(&_mutex);
+  return _outQueue.size();
+}
+
+void TcpConnectionHandler::writeOutgoing() {
+  QMutexLocker ml(&_mutex);
+  _writeScheduled = false;
+  if (!_socket)
+    return;
+  qint64 sessionid = _session.id();
+  bool debug = Log::isSeverityEnabled(Log::Debug);
+  bool binary = _peerAcceptsBinary && binaryEncodingEnabled();
+  int count = 0;
+  // text is written through a QBuffer, whereas binary frames are appended to
+  // the QByteArray itself, truncating it keeps its capacity in both cases
+  QBuffer buffer(&_outBuffer);
+  if (binary)
+    _outBuffer.resize(0);
+  else
+    buffer.open(QIODevice::WriteOnly | QIODevice::Truncate);
+  // _socket can only be changed by this thread, it's safe to use it unlocked
+  qint64 room = OUTPUT_BYTES_HIGH_WATERMARK - _socket->bytesToWrite();
+  while (!_outQueue.isEmpty() && _outBuffer.size() < room) {
+    QList<Message> batch;
+    if (_outQueue.size() <= OUTPUT_BATCH_SIZE) {
+      batch.swap(_outQueue);
+    } else {
+      batch = _outQueue.mid(0, OUTPUT_BATCH_SIZE);
+      _outQueue.erase(_outQueue.begin(),
+                      _outQueue.begin()+OUTPUT_BATCH_SIZE);
+    }
+    ml.unlock();
+    foreach (const Message &message, batch) {
+      if (binary) {
+        _encoder.encodeFrame(message.node(), &_outBuffer);
+        if (debug)
+          Log::debug(sessionid) << ">>> " << QString::fromUtf8(
+                                     message.node().toPf());
+        continue;
+      }
+      qint64 begin = buffer.pos();
+      message.node().writePf(&buffer);
+      if (debug)
+        Log::debug(sessionid) << ">>> " << QString::fromUtf8(
+                                   _outBuffer.constData()+begin,
+                                   int(buffer.pos()-begin));
+      buffer.putChar('\n');
+    }
+    count += batch.size();
+    ml.relock();
+  }
+  qint64 dropped = 0;
+  if (_droppedMessages && _outQueue.size() < OUTPUT_QUEUE_MAX_SIZE) {
+    dropped = _droppedMessages;
+    _droppedMessages = 0;
+  }
+  bool resumeInput = _inputPaused
+      && _outQueue.size() <= OUTPUT_QUEUE_LOW_WATERMARK;
+  ml.unlock();
+  if (!binary)
+    buffer.close();
+  if (count) // outgoing traffic is activity too, e.g. for receive-only peers
+    SessionManager::touchSession(sessionid);
+  if (count && _socket->write(_outBuffer) != _outBuffer.size())
+    Log::warning(sessionid) << "cannot send " << count
+                            << " outgoing messages : "
+                            << _socket->errorString();
+  if (_outBuffer.capacity() > 2*OUTPUT_BYTES_HIGH_WATERMARK) {
+    // don't keep memory from an exceptionally large message
+    _outBuffer = QByteArray();
+    _outBuffer.reserve(OUTPUT_BUFFER_RESERVE);
+  }
+  if (dropped)
+    Log::warning(sessionid) << "dropped " << dropped
+                            << " outgoing messages because peer was too slow";
+  if (resumeInput) {
+    _inputPaused = false;
+    readIncoming();
   }
 }
 
+void TcpConnectionHandler::peerDisconnected() {
+  Log::debug(_session.id()) << "peer disconnected: "
+                            << _session.string("clientaddr");
+  releaseHandler();
+}
+
+void TcpConnectionHandler::activityTimeout() {
+  Log::debug(_session.id()) << "peer timed out: "
+                            << _session.string("clientaddr");
+  releaseHandler();
+}
+
 void TcpConnectionHandler::releaseHandler() {
-  OutgoingMessageDispatcher::removeSessionSender(_session.id());
   QMutexLocker ml(&_mutex);
-  //disconnect(_socket);
-  //_socket->flush();
-  //if (_socket->state() == QAbstractSocket::ConnectedState)
-  //  _socket->waitForBytesWritten(FLUSH_TIMEOUT);
-  qDebug() << "  before deleting" << _socket;
-  // FIXME need to delete again socket after solving multithread issue
-  // delete _socket;
-  qDebug() << "  after";
+  if (!_socket)
+    return;
+  qint64 sessionid = _session.id();
+  bool registeredAsSender = _registeredAsSender;
+  ml.unlock();
+  if (registeredAsSender)
+    OutgoingMessageDispatcher::removeSessionSender(sessionid);
+  _activityTimer->stop();
+  ml.relock();
+  QTcpSocket *socket = _socket;
   _socket = 0;
-  SessionManager::closeSession(_session.id());
+  _outQueue.clear();
+  _droppedMessages = 0;
+  _inBuffer.clear();
+  _scanner.reset();
+  _encoder.reset();
+  _decoder.reset();
+  _inputPaused = false;
+  _peerAcceptsBinary = false;
+  SessionManager::detachConnection(sessionid);
+  SessionManager::closeSession(sessionid);
   _session = Session();
   ml.unlock();
+  // let already written data reach the peer before deleting the socket
+  socket->disconnect(this);
+  connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+  socket->disconnectFromHost();
+  if (socket->state() == QAbstractSocket::UnconnectedState)
+    socket->deleteLater();
   emit handlerReleased(this);
 }
-
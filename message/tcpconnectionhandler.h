@@ -19,36 +19,94 @@
 #include <QThread>
 #include <QTimer>
 #include "incomingmessagedispatcher.h"
+#include "pfframescanner.h"
+#include "pfbinarycodec.h"
 #include <QMutex>
 
 /** Object responsible for processing an established TCP connection.
  * Managed by TcpListener on the server side and TcpClient on the the
- * client side. */
+ * client side.
+ *
+ * Processing is event-driven: incoming data is accumulated in a buffer and
+ * every complete root node found by PfFrameScanner is parsed and dispatched,
+ * therefore a handler never blocks its thread, and handlers share a small
+ * set of threads (see threadsCount()) rather than having one each.
+ *
+ * Outgoing messages are queued per connection and written when the socket
+ * can accept them: every message queued during an event loop turn is
+ * serialized into a reusable per-connection buffer and written to the
+ * socket at once, so that a burst costs one write rather than several per
+ * message. When the queue reaches OUTPUT_QUEUE_HIGH_WATERMARK,
+ * incoming data is no longer read (which in turn fills TCP windows and slows
+ * the peer down) until the queue is back to OUTPUT_QUEUE_LOW_WATERMARK.
+ * Beyond OUTPUT_QUEUE_MAX_SIZE, outgoing messages are dropped, which
+ * sendOutgoingMessage() reports to producers by returning false.
+ *
+ * When binary encoding is enabled, the handler announces it to the peer with
+ * a "#pfbinary 1" PF comment line at connection start, which peers that do
+ * not support binary encoding ignore like any comment, and sends
+ * PfBinaryEncoder frames once the peer has announced it too. Otherwise PF
+ * text is used. Incoming binary frames are always accepted. */
 class LIBPUMPKINSHARED_EXPORT TcpConnectionHandler : public MessageSender {
   Q_OBJECT
-  QThread *_thread;
   QTcpSocket *_socket;
   Session _session;
   IncomingMessageDispatcher *_dispatcher;
-  QMutex _mutex;
+  mutable QMutex _mutex;
+  QTimer *_activityTimer;
+  QByteArray _inBuffer;
+  PfFrameScanner _scanner;
+  QList<Message> _outQueue;
+  QByteArray _outBuffer;
+  PfBinaryEncoder _encoder;
+  PfBinaryDecoder _decoder;
+  bool _writeScheduled, _inputPaused, _peerAcceptsBinary;
+  bool _registeredAsSender;
+  qint64 _droppedMessages;
 
 public:
   static const int ACTIVITY_TIMEOUT = 60000; // ms
+  static const int INPUT_BUFFER_SIZE = 65536;
+  static const int MAX_MESSAGE_SIZE = 64*1024*1024;
+  static const int OUTPUT_BYTES_HIGH_WATERMARK = 1024*1024;
+  static const int OUTPUT_QUEUE_HIGH_WATERMARK = 1024;
+  static const int OUTPUT_QUEUE_LOW_WATERMARK = 256;
+  static const int OUTPUT_QUEUE_MAX_SIZE = 16384;
+  static const int OUTPUT_BATCH_SIZE = 64;
+  static const int OUTPUT_BUFFER_RESERVE = 65536;
 
   explicit TcpConnectionHandler(IncomingMessageDispatcher *dispatcher);
-  /** thread-safe, can be called by any thread */
-  void processConnection(QTcpSocket *socket, const Session &session);
-  /** not-thread safe: must only be called by the thread handling the
-   * connection, or through signals
-   * however currently processConnection is blocking and this method cannot be
-   * exposed through slot or Q_INVOKABLE for queued calls */
-  void sendOutgoingMessage(Message message) override;
+  /** thread-safe, can be called by any thread
+   * socket must already have been moved to handler's thread()
+   * @param registerAsSender register with OutgoingMessageDispatcher for
+   * the session, false when the caller sends messages through the handler
+   * itself (e.g. TcpClient) */
+  void processConnection(QTcpSocket *socket, const Session &session,
+                         bool registerAsSender = true);
+  /** thread-safe, can be called by any thread, never blocks
+   * @return false if the message was dropped because the connection is gone
+   * or because the queue already holds OUTPUT_QUEUE_MAX_SIZE messages */
+  bool sendOutgoingMessage(Message message) override;
+  /** thread-safe */
+  int queuedMessagesCount() const override;
+  /** Number of threads shared by all handlers. */
+  static int threadsCount();
+  /** Enable binary encoding for connections established from now on, with
+   * peers that support it. Disabled by default. */
+  static void setBinaryEncodingEnabled(bool enabled);
+  static bool binaryEncodingEnabled();
 
 signals:
   void handlerReleased(TcpConnectionHandler *handler);
 
 private:
   Q_INVOKABLE void doProcessConnection(QTcpSocket *, const Session &);
+  Q_INVOKABLE void writeOutgoing();
+  void readIncoming();
+  /** @return false if input processing must stop */
+  bool dispatchIncoming(Message message);
+  void peerDisconnected();
+  void activityTimeout();
   void releaseHandler();
 };
 
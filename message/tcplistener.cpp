@@ -17,25 +17,15 @@
 #include <QTcpSocket>
 #include "tcpconnectionhandler.h"
 #include <QMetaObject>
-#include <unistd.h>
-
-#define HANDLERS_POOL_SIZE 20
 
 TcpListener::TcpListener(IncomingMessageDispatcher *dispatcher)
   : QObject(), _thread(new QThread), _server(new QTcpServer(this)),
-    _dispatcher(dispatcher) {
+    _dispatcher(dispatcher), _connectionsCount(0) {
   _thread->setObjectName("TcpListener");
   connect(this, &TcpConnectionHandler::destroyed, _thread, &QThread::quit);
   connect(_thread, &QThread::finished, _thread, &QThread::deleteLater);
   _thread->start();
   moveToThread(_thread);
-  for (int i = 0; i < HANDLERS_POOL_SIZE; ++i) {
-    TcpConnectionHandler *handler = new TcpConnectionHandler(dispatcher);
-    _idleHandlers.append(handler);
-    _allHandlers.append(handler);
-    connect(handler, &TcpConnectionHandler::handlerReleased,
-            this, &TcpListener::handlerReleased);
-  }
   connect(_server, &QTcpServer::newConnection,
           this, &TcpListener::newConnection);
 }
@@ -66,19 +56,18 @@ void TcpListener::newConnection() {
   QString clientaddr = "["+socket->peerAddress().toString()
       +"]:"+QString::number(socket->peerPort());
   session.setParam("clientaddr", clientaddr);
-  if (_idleHandlers.size() == 0) {
-    Log::warning(session.id()) << "cannot handle connection: no idle handler"
-                               << clientaddr;
-    // LATER leave a reply to client
-    delete socket;
-  } else {
-    TcpConnectionHandler *handler = _idleHandlers.takeFirst();
-    socket->setParent(0);
-    socket->moveToThread(handler->thread());
-    handler->processConnection(socket, session);
-  }
+  TcpConnectionHandler *handler = new TcpConnectionHandler(_dispatcher);
+  connect(handler, &TcpConnectionHandler::handlerReleased,
+          this, &TcpListener::handlerReleased);
+  ++_connectionsCount;
+  Log::debug(session.id()) << "accepted connection " << clientaddr << ", "
+                           << _connectionsCount << " connections";
+  socket->setParent(0);
+  socket->moveToThread(handler->thread());
+  handler->processConnection(socket, session);
 }
 
 void TcpListener::handlerReleased(TcpConnectionHandler *handler) {
-  _idleHandlers.append(handler);
+  --_connectionsCount;
+  handler->deleteLater();
 }
@@ -20,14 +20,16 @@
 class TcpConnectionHandler;
 
 /** Object responsible for listening and accepting new TCP connections.
- * Manage a pool of TcpConnectionHandlers that process established connections
- * and call IncomingMessageDispatcher when needed. */
+ * Create a TcpConnectionHandler per established connection, that processes
+ * it and calls IncomingMessageDispatcher when needed. Handlers are
+ * event-driven and share a few threads, hence there is no limit on the
+ * number of concurrent connections apart from system ones. */
 class LIBPUMPKINSHARED_EXPORT TcpListener : public QObject {
   Q_OBJECT
   QThread *_thread;
   QTcpServer *_server;
   IncomingMessageDispatcher *_dispatcher;
-  QList<TcpConnectionHandler*> _idleHandlers, _allHandlers;
+  int _connectionsCount;
 
 public:
   explicit TcpListener(IncomingMessageDispatcher *dispatcher);
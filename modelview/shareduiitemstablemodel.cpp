@@ -82,6 +82,24 @@ void SharedUiItemsTableModel::insertItemAt(SharedUiItem newItem,
   //emit itemChanged(item, SharedUiItem());
 }
 
+void SharedUiItemsTableModel::insertItemsAt(QList<SharedUiItem> newItems,
+                                            int row) {
+  if (row < 0 || row > rowCount() || newItems.isEmpty())
+    return;
+  beginInsertRows(QModelIndex(), row, row+newItems.size()-1);
+  _items = _items.mid(0, row) + newItems + _items.mid(row);
+  endInsertRows();
+  int toBeRemoved = _items.size() - _maxrows;
+  if (toBeRemoved > 0) {
+    int deletionPoint = (_defaultInsertionPoint == FirstItem) ? _maxrows : 0;
+    beginRemoveRows(QModelIndex(), deletionPoint,
+                    deletionPoint+toBeRemoved-1);
+    _items.erase(_items.begin()+deletionPoint,
+                 _items.begin()+deletionPoint+toBeRemoved);
+    endRemoveRows();
+  }
+}
+
 bool SharedUiItemsTableModel::removeItems(int first, int last) {
   int rowCount = _items.size();
   if (first < 0 || last < first || first >= rowCount)
@@ -59,7 +59,7 @@ public:
    * changeItem() at the time a new item is inserted.
    * "Older" rows are determined as opposite sides from defaultInsertionPoint().
    * Default: INT_MAX */
-  void setMaxrows(int maxrows) { _maxrows = maxrows; }
+  virtual void setMaxrows(int maxrows) { _maxrows = maxrows; }
   void sortAndSetItems(QList<SharedUiItem> items) {
     std::sort(items.begin(), items.end());
     setItems(items);
@@ -81,8 +81,19 @@ public:
   }
   void insertItemAt(SharedUiItem newItem, int row,
                     QModelIndex parent = QModelIndex()) override;
-  // LATER add insertItemsAt(int row, QList<SharedUiItem> newItems)
-  // or even template<class T> insertItemsAt(int row, QList<T> newItems)
+  /** Insert several items at once, with only one rows insertion and at most
+   * one rows removal (if maxrows() is reached), which is far cheaper for
+   * views than inserting them one by one.
+   * Unlike changeItem(), does not check whether items with same ids already
+   * exist. */
+  void insertItemsAt(QList<SharedUiItem> newItems, int row);
+  template <class T> void insertItemsAt(QList<T> newItems, int row) {
+    QList<SharedUiItem> castedItems;
+    castedItems.reserve(newItems.size());
+    foreach (const SharedUiItem &i, newItems)
+      castedItems.append(i);
+    insertItemsAt(castedItems, row);
+  }
   virtual bool removeItems(int first, int last);
   using SharedUiItemsModel::itemAt;
   SharedUiItem itemAt(const QModelIndex &index) const override;
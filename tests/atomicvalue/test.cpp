@@ -0,0 +1,127 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread/atomicvalue.h"
+#include "thread/readmostlyatomicvalue.h"
+#include <QThread>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QtDebug>
+#include <QElapsedTimer>
+#include <QString>
+#include "tests/testcheck.h"
+
+static const long readsPerThread = 2000000;
+
+template <class V>
+class ReaderThread : public QThread {
+  V *_value;
+
+public:
+  long _totalSize = 0;
+  ReaderThread(V *value) : _value(value) { }
+
+protected:
+  void run() {
+    for (long i = 0; i < readsPerThread; ++i)
+      _totalSize += _value->data().size();
+  }
+};
+
+template <class V>
+class WriterThread : public QThread {
+  V *_value;
+
+public:
+  WriterThread(V *value) : _value(value) { }
+
+protected:
+  void run() {
+    // a new version every ms, which is already far more than a configuration
+    for (int i = 0; !isInterruptionRequested(); ++i) {
+      *_value = QString("version %1").arg(i);
+      QThread::msleep(1);
+    }
+  }
+};
+
+template <class V>
+static double benchmark(int readersCount) {
+  V value(QString("initial version"));
+  WriterThread<V> writer(&value);
+  QList<ReaderThread<V>*> readers;
+  for (int i = 0; i < readersCount; ++i)
+    readers.append(new ReaderThread<V>(&value));
+  writer.start();
+  QElapsedTimer timer;
+  timer.start();
+  foreach (ReaderThread<V> *reader, readers)
+    reader->start();
+  foreach (ReaderThread<V> *reader, readers)
+    reader->wait();
+  qint64 elapsed = qMax(1LL, timer.elapsed());
+  writer.requestInterruption();
+  writer.wait();
+  qDeleteAll(readers);
+  return 1000.0*readsPerThread*readersCount/elapsed;
+}
+
+/** Thread that reads once, then stays idle until asked to finish. */
+class IdleReaderThread : public QThread {
+  ReadMostlyAtomicValue<QSharedPointer<int>> *_value;
+
+public:
+  QSemaphore _hasRead, _finish;
+  IdleReaderThread(ReadMostlyAtomicValue<QSharedPointer<int>> *value)
+    : _value(value) { }
+
+protected:
+  void run() {
+    _value->data();
+    _hasRead.release();
+    _finish.acquire();
+  }
+};
+
+static void checkReclamation() {
+  ReadMostlyAtomicValue<QSharedPointer<int>> value;
+  QSharedPointer<int> first(new int(1));
+  QWeakPointer<int> firstRef = first;
+  value = first;
+  first.clear();
+  IdleReaderThread reader(&value);
+  reader.start();
+  reader._hasRead.acquire();
+  auto snapshot = value.snapshot();
+  value = QSharedPointer<int>(new int(2));
+  check(!firstRef.isNull() && **snapshot == 1,
+        "snapshot keeps its version alive and unchanged");
+  snapshot.reset();
+  check(firstRef.isNull(), "replaced version freed by its last reader, "
+                           "regardless of idle reader threads");
+  reader._finish.release();
+  reader.wait();
+}
+
+int main(int, char **) {
+  checkReclamation();
+  for (int readers = 1; readers <= 32; readers *= 2) {
+    double mutex = benchmark<AtomicValue<QString>>(readers);
+    double readMostly = benchmark<ReadMostlyAtomicValue<QString>>(readers);
+    qDebug() << readers << "readers:" << mutex << "reads/s with AtomicValue,"
+             << readMostly << "reads/s with ReadMostlyAtomicValue, ratio"
+             << readMostly/mutex;
+  }
+  return testExitCode();
+}
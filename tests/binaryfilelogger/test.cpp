@@ -0,0 +1,134 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "log/binaryfilelogger.h"
+#include <QTemporaryDir>
+#include <QFile>
+#include <QTextStream>
+#include "tests/testcheck.h"
+
+static const int entriesCount = 5000;
+static const qint64 start = 1500000000000LL;
+static int warnings = 0;
+
+/** BinaryFileLogger written to synchronously by the test thread. */
+class SyncBinaryFileLogger : public BinaryFileLogger {
+public:
+  SyncBinaryFileLogger(QString path) : BinaryFileLogger(path, Log::Debug, -1) {}
+  void write(const LogEntry &entry) { doLog(entry); }
+  void flush() { doFlush(); }
+};
+
+static Logger::LogEntry entry(int i) {
+  return Logger::LogEntry(start+i, QString::fromUtf8("entry %1 é").arg(i),
+                          Log::Severity(i%5), QString("task%1").arg(i%7),
+                          QString::number(i), "source");
+}
+
+static bool sameEntry(const BinaryLogReader::Entry &read,
+                      const Logger::LogEntry &expected) {
+  return read.timestamp() == expected.timestampMsecs()
+      && read.severity() == expected.severity()
+      && read.task() == expected.task()
+      && read.execId() == expected.execId()
+      && read.sourceCode() == expected.sourceCode()
+      && read.message() == expected.message();
+}
+
+static void checkRoundTrip(QString path) {
+  SyncBinaryFileLogger *logger = new SyncBinaryFileLogger(path);
+  for (int i = 0; i < entriesCount; ++i)
+    logger->write(entry(i));
+  logger->flush();
+  // truncated record, e.g. still being written
+  QFile file(path);
+  if (file.open(QIODevice::WriteOnly|QIODevice::Append))
+    file.write("\x40\x00\x00\x00\x01\x02", 6);
+  file.close();
+  BinaryLogReader reader(path);
+  check(reader.isValid(), "reader is valid");
+  BinaryLogReader::Entry read;
+  int count = 0;
+  bool same = true;
+  while (reader.next(&read)) {
+    same = same && count < entriesCount && sameEntry(read, entry(count));
+    ++count;
+  }
+  check(count == entriesCount, "all entries read, truncated one ignored");
+  check(same, "entries read as written");
+  reader.rewind();
+  count = 0;
+  same = true;
+  while (reader.next(&read, start+1000, start+2000)) {
+    same = same && read.timestamp() >= start+1000
+        && read.timestamp() < start+2000;
+    ++count;
+  }
+  check(count == 1000 && same, "time filtering");
+  reader.rewind();
+  count = 0;
+  same = true;
+  while (reader.next(&read, LLONG_MIN, LLONG_MAX, Log::Error)) {
+    same = same && read.severity() >= Log::Error
+        && sameEntry(read, entry(int(read.timestamp()-start)));
+    ++count;
+  }
+  check(count == entriesCount*2/5 && same, "severity filtering");
+  reader.rewind();
+  count = 0;
+  while (reader.next(&read, start+1000, start+2000, Log::Fatal))
+    ++count;
+  check(count == 200, "time and severity filtering");
+}
+
+static void checkConvertToText(QString binaryPath, QString textPath) {
+  check(BinaryLogReader::convertToText(binaryPath, textPath, start,
+                                       start+100, Log::Warning),
+        "conversion to text");
+  QFile file(textPath);
+  QStringList lines;
+  if (file.open(QIODevice::ReadOnly))
+    lines = QString::fromUtf8(file.readAll()).split('\n',
+                                                     QString::SkipEmptyParts);
+  check(lines.size() == 60 && lines.first() == entry(2).asLogLine(),
+        "converted text");
+}
+
+static void countWarnings(QtMsgType type, const QMessageLogContext &,
+                          const QString &) {
+  if (type == QtWarningMsg)
+    ++warnings;
+}
+
+static void checkLossWarning(QString path) {
+  SyncBinaryFileLogger *logger = new SyncBinaryFileLogger(path);
+  qInstallMessageHandler(countWarnings);
+  logger->write(entry(0));
+  logger->flush();
+  logger->write(entry(1));
+  logger->flush();
+  qInstallMessageHandler(0);
+  check(warnings == 1, "lost entries are warned about, once");
+}
+
+int main(int, char **) {
+  QTemporaryDir dir;
+  check(dir.isValid(), "temporary directory");
+  checkRoundTrip(dir.path()+"/test.bin");
+  checkConvertToText(dir.path()+"/test.bin", dir.path()+"/test.log");
+  check(!BinaryLogReader(dir.path()+"/test.log").isValid(),
+        "text file is not a binary log");
+  checkLossWarning(dir.path()+"/nosuchdir/test.bin");
+  // loggers are neither deleted nor registered, to keep the test simple
+  return testExitCode();
+}
@@ -0,0 +1,86 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread/circularbuffer.h"
+#include <QThread>
+#include <QtDebug>
+#include <QElapsedTimer>
+
+static const long itemsCount = 4000000;
+static const int batchSize = 64;
+
+class ProducerThread : public QThread {
+  CircularBuffer<int> *_buffer;
+  long _count;
+  bool _batched;
+
+public:
+  ProducerThread(CircularBuffer<int> *buffer, long count, bool batched)
+    : _buffer(buffer), _count(count), _batched(batched) { }
+
+protected:
+  void run() {
+    if (_batched) {
+      QList<int> batch;
+      for (long i = 0; i < _count; ++i) {
+        batch.append(i);
+        if (batch.size() == batchSize) {
+          _buffer->putAll(batch);
+          batch.clear();
+        }
+      }
+      _buffer->putAll(batch);
+    } else {
+      for (long i = 0; i < _count; ++i)
+        _buffer->put(i);
+    }
+  }
+};
+
+static double benchmark(int producersCount, bool batched) {
+  CircularBuffer<int> buffer(10);
+  QList<ProducerThread*> producers;
+  long perProducer = itemsCount/producersCount, total = 0;
+  for (int i = 0; i < producersCount; ++i)
+    producers.append(new ProducerThread(&buffer, perProducer, batched));
+  QElapsedTimer timer;
+  timer.start();
+  foreach (ProducerThread *producer, producers)
+    producer->start();
+  // single consumer in main thread
+  while (total < perProducer*producersCount) {
+    if (batched)
+      total += buffer.getAll().size();
+    else {
+      buffer.get();
+      ++total;
+    }
+  }
+  qint64 elapsed = qMax(1LL, timer.elapsed());
+  foreach (ProducerThread *producer, producers) {
+    producer->wait();
+    delete producer;
+  }
+  return 1000.0*total/elapsed;
+}
+
+int main(int, char **) {
+  for (int producers = 1; producers <= 32; producers *= 2) {
+    double single = benchmark(producers, false);
+    double batched = benchmark(producers, true);
+    qDebug() << producers << "producers:" << single << "items/s single,"
+             << batched << "items/s batched, ratio" << batched/single;
+  }
+  return 0;
+}
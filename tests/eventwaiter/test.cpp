@@ -0,0 +1,125 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread/eventwaiter.h"
+#include "io/readonlyresourcescache.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <QtDebug>
+#include "tests/testcheck.h"
+
+class Waker : public QThread {
+  EventWaiter *_waiter;
+
+public:
+  Waker(EventWaiter *waiter) : _waiter(waiter) { }
+
+protected:
+  void run() {
+    QThread::msleep(100);
+    _waiter->wake();
+  }
+};
+
+/** Fetches a resource from a thread which is not the cache's one, and has
+ * no event loop. */
+class Fetcher : public QThread {
+  ReadOnlyResourcesCache *_cache;
+  QString _path;
+
+public:
+  QByteArray _resource;
+  bool _reentered = false;
+  Fetcher(ReadOnlyResourcesCache *cache, QString path)
+    : _cache(cache), _path(path) { }
+
+protected:
+  void run() {
+    QObject context;
+    // only runs if this thread processes its events during the fetch
+    QTimer::singleShot(0, &context, [this]() { _reentered = true; });
+    _resource = _cache->fetchResource(_path, 5000);
+  }
+};
+
+static void checkWaiter() {
+  {
+    // waiting in the event loop thread processes events meanwhile
+    EventWaiter waiter;
+    bool fired = false;
+    QTimer::singleShot(50, [&]() { fired = true; waiter.wake(); });
+    check(waiter.wait(5000), "local event loop wait timed out");
+    check(fired, "local event loop wait did not process events");
+  }
+  {
+    // waiting in another thread blocks without processing events
+    EventWaiter waiter;
+    waiter.setEventLoopThread(0);
+    bool reentered = false;
+    QTimer::singleShot(0, [&]() { reentered = true; });
+    Waker waker(&waiter);
+    waker.start();
+    check(waiter.wait(5000), "blocking wait timed out");
+    check(!reentered, "blocking wait processed events");
+    waker.wait();
+    QCoreApplication::processEvents();
+  }
+  {
+    // condition and timeout
+    int calls = 0;
+    EventWaiter waiter([&calls]() { return ++calls > 1000000; });
+    QElapsedTimer timer;
+    timer.start();
+    check(!waiter.wait(100), "wait with false condition did not time out");
+    check(timer.elapsed() >= 100, "wait returned before timeout");
+    check(calls < 100, "condition polled rather than evaluated on wake up");
+  }
+}
+
+static void checkCache(const QString &path) {
+  {
+    // owner thread: must process QNetworkAccessManager events while waiting
+    ReadOnlyResourcesCache cache;
+    check(cache.fetchResource(path, 5000) == "content",
+          "cache fetch from owner thread");
+  }
+  {
+    // other thread: blocks while owner thread processes network events
+    ReadOnlyResourcesCache cache;
+    Fetcher fetcher(&cache, path);
+    QObject::connect(&fetcher, &QThread::finished,
+                     QCoreApplication::instance(), &QCoreApplication::quit);
+    fetcher.start();
+    QCoreApplication::exec();
+    fetcher.wait();
+    check(fetcher._resource == "content", "cache fetch from other thread");
+    check(!fetcher._reentered, "cache fetch from other thread processed its "
+                               "own events");
+  }
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QTemporaryFile file;
+  if (!file.open() || file.write("content") != 7 || !file.flush()) {
+    qDebug() << "cannot write temporary file";
+    return 1;
+  }
+  checkWaiter();
+  checkCache(file.fileName());
+  return testExitCode();
+}
@@ -0,0 +1,317 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd/httpcompression.h"
+#include "httpd/httpencodingsocket.h"
+#include "httpd/httpresponse.h"
+#include "httpd/filesystemhttphandler.h"
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QtDebug>
+#include <zlib.h>
+#include "tests/testcheck.h"
+
+/** Socket that keeps everything written to it. */
+class CapturingSocket : public DummySocket {
+public:
+  QByteArray _written;
+
+protected:
+  qint64 writeData(const char *data, qint64 len) override {
+    _written.append(data, int(len));
+    return len;
+  }
+};
+
+static QByteArray gunzip(const QByteArray &data, bool *ok) {
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  *ok = false;
+  if (inflateInit2(&zs, 16+MAX_WBITS) != Z_OK)
+    return QByteArray();
+  QByteArray output;
+  char buffer[16384];
+  zs.next_in = (Bytef*)data.constData();
+  zs.avail_in = uInt(data.size());
+  int result;
+  do {
+    zs.next_out = (Bytef*)buffer;
+    zs.avail_out = sizeof buffer;
+    result = inflate(&zs, Z_NO_FLUSH);
+    output.append(buffer, int(sizeof buffer - zs.avail_out));
+  } while (result == Z_OK);
+  *ok = result == Z_STREAM_END && zs.avail_in == 0;
+  inflateEnd(&zs);
+  return output;
+}
+
+/** @return decoded body, or null QByteArray if framing is wrong */
+static QByteArray dechunk(QByteArray data, QByteArray *trailers) {
+  QByteArray body("");
+  forever {
+    int eol = data.indexOf("\r\n");
+    if (eol < 0)
+      return QByteArray();
+    bool ok;
+    int size = data.left(eol).toInt(&ok, 16);
+    if (!ok)
+      return QByteArray();
+    data.remove(0, eol+2);
+    if (!size) {
+      if (!data.endsWith("\r\n"))
+        return QByteArray();
+      *trailers = data.left(data.size()-2);
+      return body;
+    }
+    if (data.size() < size+2 || data.mid(size, 2) != "\r\n")
+      return QByteArray();
+    body.append(data.left(size));
+    data.remove(0, size+2);
+  }
+}
+
+class Response {
+public:
+  QList<QByteArray> _headers;
+  QByteArray _body;
+  bool hasHeader(const QByteArray &line) const {
+    return _headers.contains(line); }
+  bool hasHeaderNamed(const QByteArray &name) const {
+    foreach (const QByteArray &line, _headers)
+      if (line.toLower().startsWith(name.toLower()+":"))
+        return true;
+    return false;
+  }
+};
+
+static Response parseResponse(const QByteArray &written) {
+  Response response;
+  int end = written.indexOf("\r\n\r\n");
+  if (end < 0)
+    return response;
+  response._headers = written.left(end).split('\n');
+  for (int i = 0; i < response._headers.size(); ++i)
+    response._headers[i] = response._headers[i].trimmed();
+  response._body = written.mid(end+4);
+  return response;
+}
+
+static Response respond(QString acceptEncoding, bool chunkedAllowed,
+                        QByteArray body, QString vary = QString(),
+                        bool setLength = false) {
+  CapturingSocket socket;
+  {
+    HttpResponse res(&socket);
+    res.setAcceptedEncodings(acceptEncoding);
+    res.setChunkedEncodingAllowed(chunkedAllowed);
+    res.setContentType("text/html");
+    if (!vary.isNull())
+      res.setHeader("Vary", vary);
+    if (setLength)
+      res.setContentLength(body.size());
+    // several writes, so that encoding is done incrementally
+    for (int i = 0; i < body.size(); i += 1000)
+      res.output()->write(body.mid(i, 1000));
+    res.finish();
+  }
+  return parseResponse(socket._written);
+}
+
+/** Serve a file the way HttpWorker does, with Vary: Origin already set, e.g.
+ * by a CORS-aware step of a pipeline. */
+static Response serve(
+    FilesystemHttpHandler *handler, QString path, QString acceptEncoding,
+    HttpRequest::HttpRequestMethod method = HttpRequest::GET) {
+  CapturingSocket input, socket;
+  {
+    HttpRequest req(&input);
+    req.setMethod(method);
+    req.overrideUrl(QUrl(path));
+    req.parseAndAddHeader("Accept-Encoding: "+acceptEncoding);
+    HttpResponse res(&socket);
+    res.setAcceptedEncodings(acceptEncoding);
+    res.setChunkedEncodingAllowed(true);
+    if (method == HttpRequest::HEAD)
+      res.disableBodyOutput();
+    res.setHeader("Vary", "Origin");
+    ParamsProviderMerger context;
+    handler->handleRequest(req, res, &context);
+    res.finish();
+  }
+  return parseResponse(socket._written);
+}
+
+static bool writeFile(QString path, QByteArray data) {
+  QFile file(path);
+  return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+static void checkNegotiation() {
+  check(HttpCompression::acceptsGzip("gzip"), "gzip");
+  check(HttpCompression::acceptsGzip("deflate, gzip;q=0.5"), "gzip;q=0.5");
+  check(HttpCompression::acceptsGzip("*"), "*");
+  check(HttpCompression::acceptsGzip("GZIP"), "case insensitive");
+  check(!HttpCompression::acceptsGzip(""), "empty");
+  check(!HttpCompression::acceptsGzip("identity"), "identity");
+  check(!HttpCompression::acceptsGzip("gzip;q=0"), "gzip;q=0");
+  check(!HttpCompression::acceptsGzip("*;q=0"), "*;q=0");
+  check(HttpCompression::isCompressibleContentType("text/html;charset=UTF-8"),
+        "text/html is compressible");
+  check(!HttpCompression::isCompressibleContentType("image/png"),
+        "image/png is not compressible");
+}
+
+static void checkResponses() {
+  QByteArray body;
+  for (int i = 0; i < 2000; ++i)
+    body.append(QByteArray::number(i)).append(" compressible text\n");
+  bool ok;
+  {
+    // gzip without chunks, body ends with connection
+    Response r = respond("gzip", false, body, "Origin");
+    check(r.hasHeader("Content-Encoding: gzip"), "gzip: Content-Encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"),
+          "gzip: Accept-Encoding appended to existing Vary");
+    check(!r.hasHeaderNamed("Transfer-Encoding"), "gzip: not chunked");
+    check(gunzip(r._body, &ok) == body && ok, "gzip: body");
+  }
+  {
+    // gzip with chunks
+    Response r = respond("gzip, deflate", true, body);
+    check(r.hasHeader("Content-Encoding: gzip"),
+          "gzip+chunked: Content-Encoding");
+    check(r.hasHeader("Transfer-Encoding: chunked"),
+          "gzip+chunked: Transfer-Encoding");
+    check(r.hasHeader("Vary: Accept-Encoding"), "gzip+chunked: Vary");
+    QByteArray trailers;
+    QByteArray compressed = dechunk(r._body, &trailers);
+    check(!compressed.isNull(), "gzip+chunked: chunk framing");
+    check(gunzip(compressed, &ok) == body && ok, "gzip+chunked: body");
+  }
+  {
+    // chunks without gzip
+    Response r = respond("identity", true, body, "Accept-Encoding");
+    check(!r.hasHeaderNamed("Content-Encoding"),
+          "chunked: no Content-Encoding");
+    check(r.hasHeader("Vary: Accept-Encoding"), "chunked: Vary not doubled");
+    QByteArray trailers;
+    check(dechunk(r._body, &trailers) == body, "chunked: body");
+  }
+  {
+    // small body with known length is sent as is
+    QByteArray small("small");
+    Response r = respond("gzip", true, small, QString(), true);
+    check(!r.hasHeaderNamed("Content-Encoding"), "small: not compressed");
+    check(r.hasHeader("Content-Length: 5"), "small: Content-Length kept");
+    check(r._body == small, "small: body");
+  }
+}
+
+static void checkFilesystemHandler() {
+  QByteArray body;
+  for (int i = 0; i < 2000; ++i)
+    body.append(QByteArray::number(i)).append(" static text\n");
+  QByteArray sibling = HttpCompression::gzip("from sibling\n"+body);
+  QTemporaryDir dir;
+  // .gz written after the file, hence not older
+  check(writeFile(dir.path()+"/page.html", body)
+        && writeFile(dir.path()+"/page.html.gz", sibling)
+        && writeFile(dir.path()+"/image.png", body)
+        && writeFile(dir.path()+"/image.png.gz", sibling)
+        && writeFile(dir.path()+"/plain.html", body), "docroot");
+  FilesystemHttpHandler handler(0, "/static", dir.path());
+  bool ok;
+  {
+    Response r = serve(&handler, "/static/page.html", "gzip");
+    check(r.hasHeader("Content-Encoding: gzip"), "sibling: Content-Encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"),
+          "sibling: Vary keeps Origin");
+    check(r.hasHeader("Content-Length: "+QByteArray::number(sibling.size())),
+          "sibling: Content-Length");
+    check(!r.hasHeaderNamed("Transfer-Encoding"), "sibling: not chunked");
+    check(r._body == sibling, "sibling: body sent as is");
+  }
+  {
+    Response r = serve(&handler, "/static/page.html", "gzip",
+                       HttpRequest::HEAD);
+    check(r.hasHeader("Content-Encoding: gzip"), "sibling HEAD: encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"), "sibling HEAD: Vary");
+    check(r._body.isEmpty(), "sibling HEAD: no body");
+  }
+  {
+    // sibling .gz is used regardless of content type
+    Response r = serve(&handler, "/static/image.png", "gzip");
+    check(r.hasHeader("Content-Encoding: gzip"), "png sibling: encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"), "png sibling: Vary");
+    check(r._body == sibling, "png sibling: body");
+  }
+  {
+    // body still depends on Accept-Encoding when client does not accept gzip
+    Response r = serve(&handler, "/static/image.png", "identity");
+    check(!r.hasHeaderNamed("Content-Encoding"), "png identity: encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"), "png identity: Vary");
+    check(r._body == body, "png identity: body");
+  }
+  {
+    HttpCompression::clearCache();
+    for (int i = 0; i < 2; ++i) { // compressed, then from cache
+      QString what = i ? "cached: " : "compressed: ";
+      Response r = serve(&handler, "/static/plain.html", "gzip");
+      check(r.hasHeader("Content-Encoding: gzip"), what+"Content-Encoding");
+      check(r.hasHeader("Vary: Origin, Accept-Encoding"), what+"Vary");
+      check(r.hasHeaderNamed("Content-Length"), what+"Content-Length");
+      check(!r.hasHeaderNamed("Transfer-Encoding"), what+"not chunked");
+      check(gunzip(r._body, &ok) == body && ok, what+"body");
+    }
+  }
+  {
+    Response r = serve(&handler, "/static/plain.html", "identity");
+    check(!r.hasHeaderNamed("Content-Encoding"), "identity: encoding");
+    check(r.hasHeader("Vary: Origin, Accept-Encoding"), "identity: Vary");
+    check(r._body == body, "identity: body");
+  }
+}
+
+static void checkEncodingSocket() {
+  QByteArray body(100000, 'x');
+  CapturingSocket socket;
+  {
+    HttpEncodingSocket encoder(&socket);
+    encoder.enableChunking();
+    encoder.write(body.left(10));
+    encoder.flushPending(); // small chunk sent at once
+    check(socket._written == "a\r\nxxxxxxxxxx\r\n", "flushPending chunk");
+    encoder.write(body.mid(10));
+    encoder.finish("X-Test: 1\r\n");
+    check(encoder.write("more") < 0, "write after finish");
+  }
+  QByteArray trailers;
+  check(dechunk(socket._written, &trailers) == body, "chunks: body");
+  check(trailers == "X-Test: 1\r\n", "chunks: trailers");
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  checkNegotiation();
+  checkResponses();
+  checkFilesystemHandler();
+  checkEncodingSocket();
+  bool ok;
+  QByteArray data(50000, 'y');
+  check(HttpCompression::gzip(data).size() < data.size()/10,
+        "gzip compresses");
+  check(gunzip(HttpCompression::gzip(data), &ok) == data && ok,
+        "gzip roundtrip");
+  return testExitCode();
+}
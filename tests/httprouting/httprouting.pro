@@ -0,0 +1,45 @@
+# Copyright 2018 Hallowyn, Gregoire Barbier and others.
+# This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+# Libpumpkin is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+# Libpumpkin is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+# You should have received a copy of the GNU Affero General Public License
+# along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+
+QT -= gui
+QT += core network
+
+TARGET = test
+CONFIG += console largefile c++11
+CONFIG -= app_bundle
+
+TARGET_OS=default
+unix: TARGET_OS=unix
+linux: TARGET_OS=linux
+android: TARGET_OS=android
+macx: TARGET_OS=macx
+win32: TARGET_OS=win32
+BUILD_TYPE=unknown
+CONFIG(debug,debug|release): BUILD_TYPE=debug
+CONFIG(release,debug|release): BUILD_TYPE=release
+
+# dependency libs
+INCLUDEPATH += ../..
+LIBS += \
+    -L../../../build-qtpf-$$TARGET_OS/$$BUILD_TYPE \
+    -L../../../build-p6core-$$TARGET_OS/$$BUILD_TYPE
+LIBS += -lp6core -lqtpf
+
+exists(/usr/bin/ccache):QMAKE_CXX = ccache g++
+exists(/usr/bin/ccache):QMAKE_CXXFLAGS += -fdiagnostics-color=always
+QMAKE_CXXFLAGS += -Wextra
+
+SOURCES += test.cpp
+
+HEADERS +=
+
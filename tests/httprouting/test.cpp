@@ -0,0 +1,132 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd/httpserver.h"
+#include "httpd/httphandler.h"
+#include "io/dummysocket.h"
+#include <QCoreApplication>
+#include <QtDebug>
+#include "tests/testcheck.h"
+
+/** Handler accepting requests either through its static routes or, if it
+ * has none, through a path prefix checked by acceptRequest(), so that a
+ * linear walk over handlers is the reference routing. */
+class RoutingHandler : public HttpHandler {
+  QString _dynamicPrefix;
+  int _dynamicMethods;
+
+public:
+  RoutingHandler(QString name, QString dynamicPrefix = QString(),
+                 int dynamicMethods = HttpRequest::ANY)
+    : HttpHandler(name), _dynamicPrefix(dynamicPrefix),
+      _dynamicMethods(dynamicMethods) { }
+  bool acceptRequest(HttpRequest req) override {
+    QString path = req.url().path();
+    QList<StaticRoute> routes = staticRoutes();
+    if (routes.isEmpty())
+      return !_dynamicPrefix.isNull() && path.startsWith(_dynamicPrefix)
+          && (_dynamicMethods & req.method());
+    foreach (const StaticRoute &route, routes)
+      if (path.startsWith(route._pathPrefix)
+          && (route._methods & req.method()))
+        return true;
+    return false;
+  }
+  bool handleRequest(HttpRequest, HttpResponse,
+                     ParamsProviderMerger *) override {
+    return true;
+  }
+};
+
+static HttpHandler *linearWalk(const QList<HttpHandler*> &handlers,
+                               HttpRequest req) {
+  foreach (HttpHandler *handler, handlers)
+    if (handler->acceptRequest(req))
+      return handler;
+  return 0;
+}
+
+static void checkRouting(HttpServer *server,
+                         const QList<HttpHandler*> &handlers,
+                         QString when) {
+  static const QStringList paths {
+    "/", "/other", "/api", "/apix", "/api/", "/api/v2", "/api/v2/x",
+    "/api/v2/xy", "/api/v2/special/a", "/api/v2/admin/z", "/static/f",
+    "/dyn", "/dyn/api" };
+  static const QList<HttpRequest::HttpRequestMethod> methods {
+    HttpRequest::HEAD, HttpRequest::GET, HttpRequest::POST, HttpRequest::PUT,
+    HttpRequest::DELETE, HttpRequest::OPTIONS };
+  DummySocket socket;
+  foreach (const QString &path, paths) {
+    foreach (HttpRequest::HttpRequestMethod method, methods) {
+      HttpRequest req(&socket);
+      req.setMethod(method);
+      req.overrideUrl(QUrl(path));
+      HttpHandler *expected = linearWalk(handlers, req);
+      HttpHandler *chosen = server->chooseHandler(req);
+      // when no handler accepts the request, the server's default is used
+      bool ok = expected ? chosen == expected
+                         : chosen && !handlers.contains(chosen);
+      check(ok, when+": "+HttpRequest::methodName(method)+" "+path
+            +" expected "+(expected ? expected->name() : QString("default"))
+            +" got "+(chosen ? chosen->name() : QString("null")));
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  HttpServer *server = new HttpServer(1);
+  QList<HttpHandler*> handlers;
+  // dynamic handler registered before a static match on a shorter prefix
+  RoutingHandler *special = new RoutingHandler("special", "/api/v2/special");
+  // static prefix and its own prefix, with different method masks
+  RoutingHandler *api = new RoutingHandler("api");
+  api->addStaticRoute("/api", HttpRequest::GET|HttpRequest::HEAD);
+  RoutingHandler *apiV2 = new RoutingHandler("apiv2");
+  apiV2->addStaticRoute("/api/v2");
+  // dynamic handler between static ones, filtering on method
+  RoutingHandler *posts = new RoutingHandler("posts", "/",
+                                             HttpRequest::POST);
+  // catch-all for a single method
+  RoutingHandler *options = new RoutingHandler("options");
+  options->addStaticRoute("", HttpRequest::OPTIONS);
+  // several routes, one of them longer than an existing prefix
+  RoutingHandler *multi = new RoutingHandler("multi");
+  multi->addStaticRoute("/static");
+  multi->addStaticRoute("/api/v2/admin", HttpRequest::DELETE);
+  RoutingHandler *dyn = new RoutingHandler("dyn", "/dyn");
+  // catch-all for any method, after everything else
+  RoutingHandler *fallback = new RoutingHandler("fallback");
+  fallback->addStaticRoute("", HttpRequest::PUT|HttpRequest::DELETE);
+  foreach (RoutingHandler *handler, QList<RoutingHandler*> {
+           special, api, apiV2, posts, options, multi, dyn, fallback }) {
+    server->appendHandler(handler);
+    handlers.append(handler);
+  }
+  checkRouting(server, handlers, "appended");
+  // prepended handler with a prefix longer than existing ones
+  RoutingHandler *first = new RoutingHandler("first");
+  first->addStaticRoute("/api/v2/x", HttpRequest::PUT|HttpRequest::POST);
+  server->prependHandler(first);
+  handlers.prepend(first);
+  checkRouting(server, handlers, "prepended");
+  // routes changed after registration, including static becoming dynamic
+  multi->setStaticRoutes({ HttpHandler::StaticRoute(
+                             "/api/v2/special", HttpRequest::GET) });
+  apiV2->clearStaticRoutes();
+  checkRouting(server, handlers, "routes changed");
+  delete server;
+  return testExitCode();
+}
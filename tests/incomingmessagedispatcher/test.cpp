@@ -0,0 +1,162 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message/incomingmessagedispatcher.h"
+#include "thread/workerpool.h"
+#include <QThread>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <QtDebug>
+#include "tests/testcheck.h"
+
+static const int sessionsCount = 20;
+static const int messagesPerSession = 200;
+static const int maxQueued = 4;
+static const int dispatchingThreads = 8;
+static const int messagesPerThread = 100;
+
+static IncomingMessageDispatcher::RouteStats routeStats(
+    const IncomingMessageDispatcher &dispatcher, QString key) {
+  foreach (const IncomingMessageDispatcher::RouteStats &stats,
+           dispatcher.routesStats())
+    if (stats._key == key)
+      return stats;
+  return IncomingMessageDispatcher::RouteStats();
+}
+
+static bool waitFor(std::function<bool()> condition) {
+  QElapsedTimer timer;
+  timer.start();
+  while (!condition()) {
+    if (timer.elapsed() > 10000)
+      return false;
+    QThread::msleep(1);
+  }
+  return true;
+}
+
+static Message message(qint64 sessionid, QString name, int sequence = 0) {
+  return Message(Session(sessionid), PfNode(name, QString::number(sequence)));
+}
+
+class Dispatching : public QThread {
+  IncomingMessageDispatcher *_dispatcher;
+
+public:
+  Dispatching(IncomingMessageDispatcher *dispatcher)
+    : _dispatcher(dispatcher) { }
+
+protected:
+  void run() {
+    for (int i = 0; i < messagesPerThread; ++i)
+      _dispatcher->dispatch(message(1, "bounded"));
+  }
+};
+
+int main(int, char **) {
+  WorkerPool orderedPool("ordered", 4), boundedPool("bounded", 1),
+      stoppedPool("stopped", 1);
+  stoppedPool.shutdown();
+  QAtomicInt running[sessionsCount], handled, inlineHandled, boundedHandled;
+  int lastSequence[sessionsCount];
+  for (int i = 0; i < sessionsCount; ++i)
+    lastSequence[i] = -1;
+  QAtomicInt outOfOrder, concurrent;
+  QSemaphore started, gate;
+  Qt::HANDLE mainThread = QThread::currentThreadId();
+  RadixTree<IncomingMessageDispatcher::MessageHandler> handlers;
+  handlers.insert("ordered", [&](Message message) {
+    int s = int(message.session().id());
+    if (running[s].fetchAndAddOrdered(1))
+      concurrent.storeRelease(1);
+    int sequence = message.node().contentAsString().toInt();
+    // lastSequence[s] is only accessed by handlers of session s
+    if (sequence != lastSequence[s]+1)
+      outOfOrder.storeRelease(1);
+    lastSequence[s] = sequence;
+    if (sequence % 7 == 0)
+      QThread::yieldCurrentThread(); // let other sessions' handlers overlap
+    running[s].fetchAndSubOrdered(1);
+    handled.fetchAndAddOrdered(1);
+  });
+  handlers.insert("bounded", [&](Message) {
+    if (WorkerPool::currentPool() == &boundedPool) {
+      started.release();
+      gate.acquire(); // keep the only worker busy so that the queue fills
+      boundedHandled.fetchAndAddOrdered(1);
+    } else {
+      inlineHandled.fetchAndAddOrdered(1);
+    }
+  });
+  handlers.insert("stopped", [&](Message) {
+    if (QThread::currentThreadId() == mainThread)
+      inlineHandled.fetchAndAddOrdered(1);
+  });
+  IncomingMessageDispatcher dispatcher;
+  dispatcher.setHandlers(handlers);
+  IncomingMessageDispatcher::RouteOptions options;
+  options._mode = IncomingMessageDispatcher::OrderedPerSession;
+  options._pool = &orderedPool;
+  options._maxQueuedMessages = 64; // small enough to make dispatch wait
+  dispatcher.setRouteOptions("ordered", options);
+  options._mode = IncomingMessageDispatcher::Pool;
+  options._pool = &boundedPool;
+  options._maxQueuedMessages = maxQueued;
+  dispatcher.setRouteOptions("bounded", options);
+  options._pool = &stoppedPool;
+  dispatcher.setRouteOptions("stopped", options);
+
+  // per-session ordering, in parallel across sessions
+  for (int i = 0; i < messagesPerSession; ++i)
+    for (int s = 0; s < sessionsCount; ++s)
+      dispatcher.dispatch(message(s, "ordered", i));
+  check(waitFor([&]() {
+    return handled.loadAcquire() == sessionsCount*messagesPerSession; }),
+        "not every ordered message was handled");
+  check(!outOfOrder.loadAcquire(),
+        "messages of a session were handled out of order");
+  check(!concurrent.loadAcquire(),
+        "messages of a session were handled concurrently");
+
+  // queue bound with concurrent connection threads, then inline fallback
+  dispatcher.dispatch(message(1, "bounded"));
+  started.acquire();
+  QList<Dispatching*> threads;
+  for (int i = 0; i < dispatchingThreads; ++i) {
+    threads.append(new Dispatching(&dispatcher));
+    threads.last()->start();
+  }
+  foreach (Dispatching *thread, threads)
+    thread->wait();
+  qDeleteAll(threads);
+  IncomingMessageDispatcher::RouteStats stats =
+      routeStats(dispatcher, "bounded");
+  check(stats._queued == quint64(maxQueued), "queue bound not respected");
+  check(inlineHandled.loadAcquire()
+        == dispatchingThreads*messagesPerThread-maxQueued,
+        "messages beyond queue bound were not handled inline");
+  gate.release(dispatchingThreads*messagesPerThread+1);
+  check(waitFor([&]() {
+    return boundedHandled.loadAcquire() == maxQueued+1; }),
+        "queued messages were not handled by the pool");
+
+  // a stopped pool rejects tasks, which are then handled inline
+  inlineHandled.storeRelease(0);
+  dispatcher.dispatch(message(1, "stopped"));
+  check(inlineHandled.loadAcquire() == 1,
+        "message not handled inline when pool is stopped");
+  check(routeStats(dispatcher, "stopped")._handledInline == 1,
+        "inline fallback not counted");
+  return testExitCode();
+}
@@ -0,0 +1,92 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "log/filelogger.h"
+#include "log/logfileindex.h"
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include "tests/testcheck.h"
+
+static const int entriesCount = 300;
+
+/** FileLogger written to synchronously by the test thread. */
+class SyncFileLogger : public FileLogger {
+public:
+  SyncFileLogger(QString path) : FileLogger(path, Log::Debug, -1, false) { }
+  void write(const LogEntry &entry) { doLog(entry); }
+};
+
+static QStringList archives(QString dir) {
+  return QDir(dir).entryList(QStringList("test.log.*"), QDir::Files,
+                             QDir::Name);
+}
+
+/** Wait for the background archiver to leave exactly 3 compressed files. */
+static bool waitForArchiver(QString dir) {
+  QElapsedTimer timer;
+  timer.start();
+  while (!timer.hasExpired(30000)) {
+    QStringList files = archives(dir);
+    QRegularExpression compressed("\\.[0-9]{17}\\.gz$");
+    if (files.size() == 3 && files.filter(compressed).size() == 3)
+      return true;
+    QThread::msleep(50);
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QTemporaryDir dir;
+  check(dir.isValid(), "temporary directory");
+  QString path = dir.path()+"/test.log";
+  // leftover of a previous run, e.g. rotated just before a crash
+  QFile leftover(path+".20000101000000000");
+  check(leftover.open(QIODevice::WriteOnly), "create leftover");
+  leftover.write("2000-01-01T00:00:00,000 old/1 source INFO old entry\n");
+  leftover.close();
+  SyncFileLogger *logger = new SyncFileLogger(path);
+  logger->setRotation(1000, 0);
+  logger->setArchiving(true, 3, 0);
+  qint64 start = QDateTime::currentMSecsSinceEpoch();
+  // about 10 entries per file, therefore more rotations than the archiver
+  // queue can hold if it is late
+  for (int i = 0; i < entriesCount; ++i)
+    logger->write(Logger::LogEntry(
+                    start+i*1000, QString("entry %1 ").arg(i)
+                    +QString(80, 'x'), Log::Info, "task", QString::number(i),
+                    "source"));
+  check(QFile::exists(path), "current file");
+  check(waitForArchiver(dir.path()),
+        "only the 3 most recent archives are kept, all compressed");
+  QStringList files = archives(dir.path());
+  check(!files.contains("test.log.20000101000000000"),
+        "leftover removed by retention");
+  if (!files.isEmpty()) {
+    QStringList entries = LogFileIndex::search(
+          dir.path()+"/"+files.last(), "task", QString());
+    check(!entries.isEmpty() && entries.last().contains("entry "),
+          "most recent archive can be read");
+  }
+  QStringList current = LogFileIndex::search(path, "task", QString());
+  check(!current.isEmpty()
+        && current.last().contains(QString("entry %1 ").arg(entriesCount-1)),
+        "last entry is in current file");
+  // the logger is neither deleted nor registered, to keep the test simple
+  return testExitCode();
+}
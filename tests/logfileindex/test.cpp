@@ -0,0 +1,105 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "log/logfileindex.h"
+#include "log/logfilearchiver.h"
+#include "log/logger.h"
+#include <QTemporaryDir>
+#include <QFile>
+#include "tests/testcheck.h"
+
+static const int entriesCount = 2000;
+static const int entriesPerTask = 200;
+
+/** Write a log file along with its index, 10 tasks one after the other. */
+static bool writeLog(QString path) {
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+  LogFileIndexWriter index(4096);
+  index.open(path, 0);
+  qint64 start = QDateTime::currentMSecsSinceEpoch();
+  for (int i = 0; i < entriesCount; ++i) {
+    QString task = QString("task%1").arg(i/entriesPerTask);
+    Log::Severity severity = i%100 ? Log::Info : Log::Warning;
+    Logger::LogEntry entry(start+i, QString("entry %1").arg(i), severity,
+                           task, QString::number(i), "source");
+    QByteArray line = entry.asLogLine().append('\n').toUtf8();
+    if (file.write(line) != line.size())
+      return false;
+    index.add(line.size(), severity, task, QString::number(i));
+  }
+  index.close();
+  return true;
+}
+
+static void checkSearches(QString path, QString what) {
+  QStringList entries = LogFileIndex::search(path, "task3", QString());
+  check(entries.size() == entriesPerTask
+        && entries.first().endsWith("entry 600")
+        && entries.last().endsWith("entry 799"), what+": search by task");
+  entries = LogFileIndex::search(path, QString(), "1234");
+  check(entries.size() == 1 && entries.first().endsWith("entry 1234"),
+        what+": search by execid");
+  entries = LogFileIndex::search(path, QString(), QString(), Log::Warning);
+  check(entries.size() == entriesCount/100, what+": search by severity");
+}
+
+/** Overwrite compressed data of blocks that cannot contain task, so that
+ * searching it fails if these blocks are inflated anyway. */
+static int corruptOtherBlocks(QString gzPath, QString task) {
+  QFile file(gzPath);
+  if (!file.open(QIODevice::ReadWrite))
+    return 0;
+  int corrupted = 0;
+  foreach (const LogFileIndex::Block &block, LogFileIndex::blocks(gzPath)) {
+    if (block.mayMatch(task, QString(), Log::Debug))
+      continue;
+    // keep gzip header, which is 10 bytes long
+    qint64 size = block._gzEnd-block._gzBegin-10;
+    if (size <= 0 || !file.seek(block._gzBegin+10))
+      continue;
+    file.write(QByteArray(int(size), '\xff'));
+    ++corrupted;
+  }
+  return corrupted;
+}
+
+int main(int, char **) {
+  QTemporaryDir dir;
+  check(dir.isValid(), "temporary directory");
+  QString path = dir.path()+"/test.log", gzPath = path+".gz";
+  check(writeLog(path), "write log file");
+  check(LogFileIndex::blocks(path).size() > 10, "log file is indexed");
+  checkSearches(path, "plain");
+  check(LogFileArchiver::gzipFile(path), "compression");
+  check(!QFile::exists(path) && !QFile::exists(LogFileIndex::indexPath(path)),
+        "plain file and index removed");
+  check(QFile::exists(LogFileIndex::indexPath(gzPath)),
+        "index kept for compressed file");
+  QList<LogFileIndex::Block> blocks = LogFileIndex::blocks(gzPath);
+  bool offsetsOk = blocks.size() > 10;
+  qint64 previousEnd = 0;
+  foreach (const LogFileIndex::Block &block, blocks) {
+    offsetsOk = offsetsOk && block._gzBegin >= previousEnd
+        && block._gzEnd > block._gzBegin;
+    previousEnd = block._gzEnd;
+  }
+  check(offsetsOk, "compressed blocks offsets");
+  checkSearches(gzPath, "compressed");
+  check(corruptOtherBlocks(gzPath, "task3") > 5, "corrupt other blocks");
+  QStringList entries = LogFileIndex::search(gzPath, "task3", QString());
+  check(entries.size() == entriesPerTask,
+        "indexed search only inflates matching blocks");
+  return testExitCode();
+}
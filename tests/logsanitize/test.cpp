@@ -0,0 +1,52 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log/log.h"
+#include <QtDebug>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+
+static const int iterations = 1000000;
+
+// former implementation, kept as a reference
+static QString regexpSanitizeField(QString string) {
+  static const QRegularExpression whitespace { "\\s+" };
+  QString s(string);
+  s.replace(whitespace, "_");
+  return s;
+}
+
+int main(int, char **) {
+  QStringList fields { "", "?", "0", "taskgroup.task", "1234567890",
+                       "some source code with spaces", "tab\tand\nnewline",
+                       "  leading and trailing  ", "nothing_to_replace_here",
+                       "é non-ascii" };
+  bool ok = true;
+  foreach (const QString &field, fields) {
+    QString expected = regexpSanitizeField(field), actual = Log::sanitizeField(field);
+    qDebug() << field << "->" << actual << (expected == actual ? "ok" : "KO");
+    ok = ok && expected == actual;
+  }
+  QElapsedTimer timer;
+  int total = 0;
+  timer.start();
+  for (int i = 0; i < iterations; ++i)
+    total += regexpSanitizeField(fields[i%fields.size()]).size();
+  qDebug() << "regexp:" << timer.restart() << "ms" << total;
+  total = 0;
+  for (int i = 0; i < iterations; ++i)
+    total += Log::sanitizeField(fields[i%fields.size()]).size();
+  qDebug() << "single pass:" << timer.restart() << "ms" << total;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "log/logstore.h"
+#include "log/logmodel.h"
+#include "log/memorylogger.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include "tests/testcheck.h"
+
+static Logger::LogEntry entry(int i) {
+  return Logger::LogEntry(1500000000000LL+i, QString("entry %1").arg(i),
+                          i%10 ? Log::Info : Log::Error,
+                          QString("task%1").arg(i%3), QString::number(i),
+                          "source");
+}
+
+static QStringList messages(QList<Logger::LogEntry> entries) {
+  QStringList messages;
+  foreach (const Logger::LogEntry &entry, entries)
+    messages.append(entry.message());
+  return messages;
+}
+
+static QStringList expected(QList<int> numbers) {
+  QStringList messages;
+  foreach (int i, numbers)
+    messages.append(entry(i).message());
+  return messages;
+}
+
+static void checkStore() {
+  LogStore store(10);
+  check(store.append(entry(0)), "first append notifies");
+  check(!store.append(entry(1)), "next appends do not notify");
+  check(messages(store.takePending()) == expected({ 0, 1 }), "pending");
+  check(store.append(entry(2)), "append after take notifies");
+  store.takePending();
+  for (int i = 3; i < 25; ++i)
+    store.append(entry(i));
+  // ring keeps the 10 last entries, 15..24
+  QList<int> last;
+  for (int i = 15; i < 25; ++i)
+    last.append(i);
+  check(messages(store.entries()) == expected(last), "ring");
+  check(messages(store.entries(Log::Error)) == expected({ 20 }),
+        "severity index");
+  check(messages(store.entries(Log::Debug)) == expected(last),
+        "severity index, every severity");
+  check(messages(store.entriesByTask("task1")) == expected({ 16, 19, 22 }),
+        "task index");
+  check(store.entriesByTask("task9").isEmpty(), "unknown task");
+  // 22 entries appended since last take, only 10 are kept pending
+  check(store.droppedCount() == 12, "dropped count");
+  check(messages(store.takePending()) == expected(last), "pending is bounded");
+  store.setCapacity(4);
+  check(store.capacity() == 4, "capacity shrunk");
+  check(messages(store.entries()) == expected({ 21, 22, 23, 24 }),
+        "most recent entries kept when shrinking");
+  check(messages(store.entriesByTask("task0")) == expected({ 21, 24 }),
+        "task index rebuilt");
+  check(store.entries(Log::Error).isEmpty(), "severity index rebuilt");
+  store.append(entry(25));
+  check(messages(store.entries()) == expected({ 22, 23, 24, 25 }),
+        "ring after shrinking");
+  store.setCapacity(6);
+  store.append(entry(26));
+  store.append(entry(27));
+  check(messages(store.entries()) == expected({ 22, 23, 24, 25, 26, 27 }),
+        "ring after growing");
+  store.clear();
+  check(store.entries().isEmpty() && store.entriesByTask("task0").isEmpty()
+        && store.takePending().isEmpty(), "clear");
+}
+
+static void checkModel() {
+  LogModel model(0, Log::Info, 100);
+  model.setMinRefreshInterval(0);
+  QStringList changed;
+  QObject::connect(&model, &SharedUiItemsModel::itemChanged,
+                   [&changed](SharedUiItem newItem, SharedUiItem) {
+    changed.append(newItem.uiString(5));
+  });
+  for (int i = 0; i < 20; ++i)
+    Log::log(QString("model entry %1").arg(i), Log::Info, "modeltest");
+  QElapsedTimer timer;
+  timer.start();
+  while (changed.size() < 20 && !timer.hasExpired(10000)) {
+    QCoreApplication::processEvents();
+    QThread::msleep(10);
+  }
+  check(changed.size() == 20 && changed.first() == "model entry 0"
+        && changed.last() == "model entry 19",
+        "itemChanged emitted for every entry, oldest first");
+  check(model.rowCount() == 20, "rows inserted");
+  model.setMaxrows(5);
+  check(model.logger()->store()->capacity() == 5,
+        "setMaxrows() bounds the store");
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  checkStore();
+  checkModel();
+  return testExitCode();
+}
@@ -0,0 +1,120 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd/multipartparser.h"
+#include <QtDebug>
+#include <QElapsedTimer>
+#include <QList>
+
+class Collected {
+public:
+  QString _name, _fileName, _contentType;
+  QByteArray _data;
+};
+
+static QByteArray sampleBody(const QByteArray &boundary, int fileSize) {
+  QByteArray file;
+  for (int i = 0; i < fileSize; ++i)
+    file.append(char(i*31+7));
+  // make the file contain delimiter prefixes, which must not be mistaken for
+  // delimiters
+  file.append("\r\n--"+boundary.left(boundary.size()/2)+"\r\n-");
+  QByteArray body = "preamble to be ignored\r\n--"+boundary+"\r\n"
+      "Content-Disposition: form-data; name=\"field\"\r\n\r\n"
+      "value\r\n--"+boundary+"\r\n"
+      "Content-Disposition: form-data; name=\"file\"; "
+      "filename=\"a \\\"quoted\\\" name.bin\"\r\n"
+      "Content-Type: application/octet-stream\r\n\r\n"
+      +file+"\r\n--"+boundary+"\r\n\r\n"
+      "no headers\r\n--"+boundary+"--\r\nepilogue";
+  return body;
+}
+
+static bool parse(const QByteArray &boundary, const QByteArray &body,
+                  int step, QList<Collected> *parts) {
+  MultipartParser parser(boundary);
+  parser.setPartBeginHandler([parts](const MultipartParser::Part &part) {
+    parts->append(Collected{ part._name, part._fileName, part._contentType,
+                             QByteArray() });
+    return true;
+  });
+  parser.setPartDataHandler([parts](const char *data, int len) {
+    parts->last()._data.append(data, len);
+    return true;
+  });
+  for (int i = 0; i < body.size(); i += step)
+    if (!parser.feed(body.constData()+i, qMin(step, body.size()-i))) {
+      qDebug() << "parse error:" << parser.errorString();
+      return false;
+    }
+  return parser.isFinished();
+}
+
+int main(int, char **) {
+  QByteArray boundary = MultipartParser::boundaryFromContentType(
+        "multipart/form-data; charset=utf-8; boundary=\"----xyz42\"");
+  int errors = 0;
+  if (boundary != "----xyz42") {
+    qDebug() << "wrong boundary:" << boundary;
+    ++errors;
+  }
+  QByteArray body = sampleBody(boundary, 100000);
+  QList<Collected> reference;
+  if (!parse(boundary, body, body.size(), &reference)
+      || reference.size() != 3 || reference[0]._name != "field"
+      || reference[0]._data != "value" || !reference[0]._fileName.isNull()
+      || reference[1]._fileName != "a \"quoted\" name.bin"
+      || reference[1]._contentType != "application/octet-stream"
+      || reference[1]._data.size() != 100000+boundary.size()/2+7
+      || reference[2]._data != "no headers"
+      || reference[2]._contentType != "text/plain") {
+    qDebug() << "whole body parsing failed";
+    ++errors;
+  }
+  // same result whatever the feeding steps, including delimiters split
+  // accross feeds
+  for (int step : { 1, 2, 3, 7, 13, 100, 4096, 65536 }) {
+    QList<Collected> parts;
+    bool ok = parse(boundary, body, step, &parts)
+        && parts.size() == reference.size();
+    for (int i = 0; ok && i < parts.size(); ++i)
+      ok = parts[i]._data == reference[i]._data
+          && parts[i]._name == reference[i]._name;
+    if (!ok) {
+      qDebug() << "parsing by steps of" << step << "failed";
+      ++errors;
+    }
+  }
+  // truncated body is not finished, garbage is an error
+  QList<Collected> parts;
+  if (parse(boundary, body.left(body.size()/2), 4096, &parts)) {
+    qDebug() << "truncated body not detected";
+    ++errors;
+  }
+  parts.clear();
+  if (parse(boundary, "--"+boundary+"garbage", 4096, &parts)) {
+    qDebug() << "garbage not detected";
+    ++errors;
+  }
+  qDebug() << "errors:" << errors;
+  // benchmark
+  QByteArray big = sampleBody(boundary, 64*1024*1024);
+  QElapsedTimer timer;
+  timer.start();
+  parts.clear();
+  parse(boundary, big, 65536, &parts);
+  qint64 ms = qMax(1LL, timer.elapsed());
+  qDebug() << "parsing:" << big.size()*1000.0/ms/(1024*1024) << "MiB/s";
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message/outgoingmessagedispatcher.h"
+#include "message/messagesender.h"
+#include <QtDebug>
+#include <QHash>
+#include <QSet>
+
+class CountingSender : public MessageSender {
+public:
+  int _received = 0, _queued = 0;
+  qint64 _removeOnSend = 0;
+  bool _full = false; // drop messages as a full queue would
+  QSet<QString> _keys;
+  bool sendOutgoingMessage(Message message) {
+    if (_full)
+      return false;
+    ++_received;
+    _keys.insert(message.node().name());
+    if (_removeOnSend) // removal from within a dispatch must not wait for it
+      OutgoingMessageDispatcher::removeSessionSender(_removeOnSend);
+    return true;
+  }
+  int queuedMessagesCount() const { return _queued; }
+};
+
+static Message message(qint64 sessionid, QString key = "msg") {
+  return Message(Session(sessionid), PfNode(key));
+}
+
+static int checkDispatchAmongSessions() {
+  int errors = 0;
+  OutgoingMessageDispatcher dispatcher(
+        OutgoingMessageDispatcher::DispatchAmongSessions);
+  CountingSender a, b;
+  OutgoingMessageDispatcher::setSessionSender(1, &a);
+  OutgoingMessageDispatcher::setSessionSender(2, &b);
+  bool sent = OutgoingMessageDispatcher::dispatch(message(1));
+  sent = OutgoingMessageDispatcher::dispatch(message(2)) && sent;
+  sent = OutgoingMessageDispatcher::dispatch(message(2)) && sent;
+  if (a._received != 1 || b._received != 2 || !sent) {
+    qDebug() << "DispatchAmongSessions: wrong senders:" << a._received
+             << b._received << sent;
+    ++errors;
+  }
+  if (OutgoingMessageDispatcher::dispatch(message(3))) {
+    qDebug() << "DispatchAmongSessions: message without sender not reported "
+                "as dropped";
+    ++errors;
+  }
+  a._full = true;
+  if (OutgoingMessageDispatcher::dispatch(message(1)) || a._received != 1) {
+    qDebug() << "DispatchAmongSessions: message dropped by sender not "
+                "reported as dropped";
+    ++errors;
+  }
+  b._removeOnSend = 2;
+  OutgoingMessageDispatcher::dispatch(message(2));
+  OutgoingMessageDispatcher::dispatch(message(2));
+  if (b._received != 3) {
+    qDebug() << "DispatchAmongSessions: sender still used after removal:"
+             << b._received;
+    ++errors;
+  }
+  return errors;
+}
+
+static int checkRoundRobin() {
+  int errors = 0;
+  OutgoingMessageDispatcher dispatcher(OutgoingMessageDispatcher::RoundRobin);
+  CountingSender a, b, c;
+  OutgoingMessageDispatcher::setSessionSender(1, &a);
+  OutgoingMessageDispatcher::setSessionSender(2, &b);
+  OutgoingMessageDispatcher::setSessionSender(3, &c);
+  for (int i = 0; i < 300; ++i) // message's session is ignored
+    OutgoingMessageDispatcher::dispatch(message(1));
+  if (a._received != 100 || b._received != 100 || c._received != 100) {
+    qDebug() << "RoundRobin: unbalanced:" << a._received << b._received
+             << c._received;
+    ++errors;
+  }
+  OutgoingMessageDispatcher::removeSessionSender(2);
+  for (int i = 0; i < 100; ++i)
+    OutgoingMessageDispatcher::dispatch(message(1));
+  if (b._received != 100 || a._received+c._received != 300) {
+    qDebug() << "RoundRobin: removed sender still used:" << b._received;
+    ++errors;
+  }
+  return errors;
+}
+
+static int checkLeastQueued() {
+  int errors = 0;
+  OutgoingMessageDispatcher dispatcher(OutgoingMessageDispatcher::LeastQueued);
+  CountingSender busy, a, b;
+  busy._queued = 1000;
+  OutgoingMessageDispatcher::setSessionSender(1, &busy);
+  OutgoingMessageDispatcher::setSessionSender(2, &a);
+  OutgoingMessageDispatcher::setSessionSender(3, &b);
+  for (int i = 0; i < 900; ++i)
+    OutgoingMessageDispatcher::dispatch(message(1));
+  // busy sender is only chosen when it is drawn twice, i.e. ~1/9 of the time
+  if (busy._received > 900/4 || a._received < 900/4 || b._received < 900/4) {
+    qDebug() << "LeastQueued: busy sender not avoided:" << busy._received
+             << a._received << b._received;
+    ++errors;
+  }
+  return errors;
+}
+
+static int checkConsistentHash() {
+  int errors = 0;
+  OutgoingMessageDispatcher dispatcher(
+        OutgoingMessageDispatcher::ConsistentHash);
+  CountingSender senders[4];
+  for (int i = 0; i < 4; ++i)
+    OutgoingMessageDispatcher::setSessionSender(i+1, &senders[i]);
+  for (int round = 0; round < 3; ++round)
+    for (int key = 0; key < 400; ++key)
+      OutgoingMessageDispatcher::dispatch(message(1, QString("k%1").arg(key)));
+  int keys = 0;
+  for (int i = 0; i < 4; ++i) {
+    keys += senders[i]._keys.size();
+    if (senders[i]._keys.isEmpty()) {
+      qDebug() << "ConsistentHash: sender" << i << "never chosen";
+      ++errors;
+    }
+  }
+  if (keys != 400) { // a key sent to several senders is counted twice
+    qDebug() << "ConsistentHash: same key sent to several senders:" << keys;
+    ++errors;
+  }
+  // removing a sender only moves its own keys
+  QHash<QString,int> before;
+  for (int i = 0; i < 4; ++i) {
+    foreach (const QString &key, senders[i]._keys)
+      before.insert(key, i);
+    senders[i]._keys.clear();
+  }
+  OutgoingMessageDispatcher::removeSessionSender(4);
+  for (int key = 0; key < 400; ++key)
+    OutgoingMessageDispatcher::dispatch(message(1, QString("k%1").arg(key)));
+  for (int i = 0; i < 3; ++i)
+    foreach (const QString &key, senders[i]._keys)
+      if (before.value(key) != i && before.value(key) != 3) {
+        qDebug() << "ConsistentHash: key moved between remaining senders:"
+                 << key;
+        ++errors;
+        break;
+      }
+  return errors;
+}
+
+int main(int, char **) {
+  int errors = 0;
+  errors += checkDispatchAmongSessions();
+  errors += checkRoundRobin();
+  errors += checkLeastQueued();
+  errors += checkConsistentHash();
+  return errors ? 1 : 0;
+}
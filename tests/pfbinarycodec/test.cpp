@@ -0,0 +1,118 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message/pfbinarycodec.h"
+#include "pf/pfparser.h"
+#include "pf/pfdomhandler.h"
+#include <QBuffer>
+#include <QtDebug>
+#include <QElapsedTimer>
+
+static PfNode sampleNode(int i) {
+  PfNode root("task");
+  root.appendChild(PfNode("id", QString("app.group.task%1").arg(i)));
+  root.appendChild(PfNode("label", "with (parenthesis), \\ and # specials"));
+  root.appendChild(PfNode("unicode", QString::fromUtf8("\xc3\xa9t\xc3\xa9")));
+  PfNode params("params");
+  for (int j = 0; j < 10; ++j)
+    params.appendChild(PfNode("param", QString("key%1 value%1").arg(j)));
+  root.appendChild(params);
+  PfNode data("data");
+  QByteArray bytes;
+  for (int j = 0; j < 4096; ++j)
+    bytes.append(char(j*7+i));
+  data.appendContent(bytes);
+  root.appendChild(data);
+  return root;
+}
+
+static PfNode parseText(const QByteArray &pf) {
+  PfDomHandler handler;
+  PfParser parser(&handler);
+  QByteArray copy = pf;
+  QBuffer buffer(&copy);
+  buffer.open(QIODevice::ReadOnly);
+  if (!parser.parse(&buffer, PfOptions().stopAfterFirstRootNode())
+      || handler.roots().isEmpty())
+    return PfNode();
+  return handler.roots().first();
+}
+
+int main(int, char **) {
+  static const int count = 10000;
+  QList<PfNode> nodes;
+  for (int i = 0; i < count; ++i)
+    nodes.append(sampleNode(i));
+  // round trips: same encoder and decoder for the whole stream, like a
+  // connection, so that interned names are exercised
+  PfBinaryEncoder encoder;
+  PfBinaryDecoder decoder;
+  int textErrors = 0, binaryErrors = 0;
+  for (int i = 0; i < count; ++i) {
+    QByteArray reference = nodes[i].toPf();
+    if (parseText(reference).toPf() != reference)
+      ++textErrors;
+    QByteArray frame;
+    encoder.encodeFrame(nodes[i], &frame);
+    PfNode decoded;
+    if (PfBinaryDecoder::frameSize(frame) != frame.size()
+        || !decoder.decodeFrame(frame, &decoded)
+        || decoded.toPf() != reference) {
+      if (!binaryErrors)
+        qDebug() << "binary round trip failed:" << decoder.errorString()
+                 << reference.left(200) << decoded.toPf().left(200);
+      ++binaryErrors;
+    }
+  }
+  qDebug() << "round trip errors: text" << textErrors
+           << "binary" << binaryErrors;
+  // truncated frames must be rejected, not crash
+  QByteArray frame;
+  PfBinaryEncoder().encodeFrame(nodes[0], &frame);
+  int rejected = 0;
+  for (int size = 0; size < frame.size(); size += 7) {
+    PfNode node;
+    if (!PfBinaryDecoder().decodeFrame(frame.left(size), &node))
+      ++rejected;
+  }
+  qDebug() << "truncated frames rejected:" << rejected << "/"
+           << (frame.size()+6)/7;
+  // benchmark
+  QElapsedTimer timer;
+  qint64 textBytes = 0, binaryBytes = 0;
+  timer.start();
+  for (int i = 0; i < count; ++i) {
+    QByteArray pf = nodes[i].toPf();
+    textBytes += pf.size();
+    parseText(pf);
+  }
+  qint64 textMs = qMax(1LL, timer.restart());
+  PfBinaryEncoder benchEncoder;
+  PfBinaryDecoder benchDecoder;
+  QByteArray buffer;
+  for (int i = 0; i < count; ++i) {
+    buffer.resize(0);
+    benchEncoder.encodeFrame(nodes[i], &buffer);
+    binaryBytes += buffer.size();
+    PfNode node;
+    benchDecoder.decodeFrame(buffer, &node);
+  }
+  qint64 binaryMs = qMax(1LL, timer.elapsed());
+  qDebug() << "text:  " << 1000.0*count/textMs << "messages/s"
+           << textBytes/count << "bytes/message";
+  qDebug() << "binary:" << 1000.0*count/binaryMs << "messages/s"
+           << binaryBytes/count << "bytes/message";
+  return (textErrors || binaryErrors
+          || rejected != (frame.size()+6)/7) ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread/snapshotreaders.h"
+#include <QThread>
+#include <QtDebug>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+
+class Snapshot {
+public:
+  int _value;
+  Snapshot(int value) : _value(value) { }
+};
+
+static std::shared_ptr<Snapshot> _current = std::make_shared<Snapshot>(0);
+static SnapshotReaders _readers;
+static QMutex _writersMutex;
+
+static void replace(int value, bool waitForReaders) {
+  QMutexLocker ml(&_writersMutex);
+  _readers.retire(std::atomic_load(&_current));
+  std::atomic_store(&_current, std::make_shared<Snapshot>(value));
+  ml.unlock();
+  if (waitForReaders)
+    _readers.waitForReaders();
+}
+
+class SlowReader : public QThread {
+public:
+  QAtomicInt _reading, _done;
+
+protected:
+  void run() {
+    SnapshotReaders::Reader<Snapshot> snapshot(&_readers, &_current);
+    _reading.storeRelease(1);
+    QThread::msleep(300);
+    _done.storeRelease(1);
+  }
+};
+
+int main(int, char **) {
+  int errors = 0;
+  {
+    // a writer that is itself reading must not wait for itself
+    SnapshotReaders::Reader<Snapshot> outer(&_readers, &_current);
+    SnapshotReaders::Reader<Snapshot> inner(&_readers, &_current);
+    QElapsedTimer timer;
+    timer.start();
+    replace(1, true);
+    if (timer.elapsed() > 50) {
+      qDebug() << "reentrant writer waited for itself:" << timer.elapsed();
+      ++errors;
+    }
+    if (outer->_value != 0) {
+      qDebug() << "reader snapshot changed while reading";
+      ++errors;
+    }
+  }
+  {
+    // a writer must wait for readers of retired snapshots, even older ones
+    SlowReader reader;
+    reader.start();
+    while (!reader._reading.loadAcquire())
+      QThread::yieldCurrentThread();
+    replace(2, false);
+    replace(3, true);
+    if (!reader._done.loadAcquire()) {
+      qDebug() << "writer did not wait for readers of retired snapshots";
+      ++errors;
+    }
+    reader.wait();
+  }
+  {
+    // new readers see the last snapshot and do not delay writers
+    SnapshotReaders::Reader<Snapshot> snapshot(&_readers, &_current);
+    if (snapshot->_value != 3) {
+      qDebug() << "reader does not see last snapshot:" << snapshot->_value;
+      ++errors;
+    }
+  }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <QString>
+#include <QtDebug>
+
+/** Minimal pass/fail helpers shared by tests, which are plain programs run
+ * by run_test: check() reports each failed condition and main() returns
+ * testExitCode(), i.e. 1 if any check failed. */
+
+inline int &testErrorsCount() {
+  static int errors = 0;
+  return errors;
+}
+
+inline void check(bool condition, const QString &what) {
+  if (!condition) {
+    qDebug() << "FAILED:" << what;
+    ++testErrorsCount();
+  }
+}
+
+inline int testExitCode() {
+  return testErrorsCount() ? 1 : 0;
+}
+
+#endif // TESTCHECK_H
@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS = circularbuffer csvfile directorywatcher radixtree
+SUBDIRS = atomicvalue binaryfilelogger circularbuffer circularbufferbatch csvfile directorywatcher eventwaiter httpcompression httprouting incomingmessagedispatcher logarchiving logfileindex logsanitize logstore multipartparser outgoingmessagedispatcher pfbinarycodec radixtree snapshotreaders workerpool
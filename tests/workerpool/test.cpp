@@ -0,0 +1,141 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread/workerpool.h"
+#include <QThread>
+#include <QtDebug>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QMutex>
+#include "tests/testcheck.h"
+
+static const int tasksCount = 200000;
+static const int fanOut = 100;
+
+static QAtomicInt _done;
+
+static void spin(int n) {
+  volatile int x = 0;
+  for (int i = 0; i < n; ++i)
+    x = x + i;
+}
+
+/** @return false on timeout, i.e. if some tasks were lost */
+static bool waitForDone(int expected) {
+  QElapsedTimer timer;
+  timer.start();
+  while (_done.loadAcquire() < expected) {
+    if (timer.hasExpired(60000))
+      return false;
+    QThread::usleep(100);
+  }
+  return true;
+}
+
+static QSemaphore _started;
+
+/** Keep single worker pool busy until gate is released, so that tasks
+ * submitted meanwhile are all queued.
+ * Gate must outlive the pool. */
+static void blockWorker(WorkerPool *pool, QSemaphore *gate) {
+  pool->submit([gate]() { _started.release(); gate->acquire(); });
+  _started.acquire();
+}
+
+static void checkPriorities() {
+  QMutex mutex;
+  QList<int> order;
+  QSemaphore gate;
+  {
+    WorkerPool pool("priorities", 1);
+    blockWorker(&pool, &gate);
+    for (int priority = WorkerPool::Low; priority <= WorkerPool::High;
+         ++priority)
+      pool.submit([&mutex, &order, priority]() {
+        QMutexLocker ml(&mutex);
+        order.append(priority);
+      }, WorkerPool::Priority(priority));
+    gate.release();
+  }
+  check(order == QList<int>() << WorkerPool::High << WorkerPool::Normal
+        << WorkerPool::Low, "higher priorities run first");
+}
+
+static void checkShutdown() {
+  _done.storeRelease(0);
+  QSemaphore gate;
+  {
+    WorkerPool pool("shutdown", 1);
+    blockWorker(&pool, &gate);
+    for (int i = 0; i < 100; ++i)
+      pool.submit([]() { _done.fetchAndAddRelaxed(1); });
+    pool.shutdown();
+    check(!pool.submit([]() { _done.fetchAndAddRelaxed(1000); }),
+          "submit() is rejected after shutdown()");
+    check(pool.stats()._rejected == 1, "rejected task is counted");
+    check(pool.queueDepth() == 100, "tasks are still queued");
+    gate.release();
+  } // destructor runs remaining tasks
+  check(_done.loadAcquire() == 100, "queued tasks are drained on destruction");
+}
+
+static void printStats(WorkerPool *pool, qint64 elapsed) {
+  WorkerPool::Stats s = pool->stats();
+  qDebug() << "  " << 1000.0*s._completed/qMax(1LL, elapsed) << "tasks/s"
+           << "stolen:" << s._stolen
+           << "avg wait:" << s.averageWaitUsecs() << "us"
+           << "max wait:" << s._maxWaitUsecs << "us"
+           << "avg run:" << s.averageRunUsecs() << "us"
+           << "max run:" << s._maxRunUsecs << "us";
+}
+
+int main(int, char **) {
+  checkPriorities();
+  checkShutdown();
+  for (int workers = 1; workers <= QThread::idealThreadCount()*2;
+       workers *= 2) {
+    {
+      // every task is submitted from outside the pool
+      WorkerPool pool("external", workers);
+      _done.storeRelease(0);
+      QElapsedTimer timer;
+      timer.start();
+      for (int i = 0; i < tasksCount; ++i)
+        pool.submit([]() { spin(100); _done.fetchAndAddRelaxed(1); });
+      check(waitForDone(tasksCount), "all externally submitted tasks run");
+      qDebug() << "external submission with" << workers << "workers";
+      printStats(&pool, timer.elapsed());
+    }
+    {
+      // tasks are submitted by tasks, all on the same worker queue at first,
+      // which is the case where work stealing matters
+      WorkerPool pool("fanout", workers);
+      _done.storeRelease(0);
+      QElapsedTimer timer;
+      timer.start();
+      WorkerPool *p = &pool;
+      for (int i = 0; i < tasksCount/fanOut; ++i)
+        pool.submit([p]() {
+          for (int j = 0; j < fanOut; ++j)
+            p->submit([]() { spin(100); _done.fetchAndAddRelaxed(1); },
+                      WorkerPool::High);
+        }, WorkerPool::Low);
+      check(waitForDone(tasksCount), "all fanned out tasks run");
+      qDebug() << "fan-out submission with" << workers << "workers";
+      printStats(&pool, timer.elapsed());
+    }
+  }
+  return testExitCode();
+}
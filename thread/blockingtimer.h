@@ -25,6 +25,9 @@
   * choice as compared to true asynchronous processing.
   * In other words: if you are about to use this class, please consider other
   * options first and know why you use this one despite other options.
+  * Especially, to wait for something to happen rather than for a given time,
+  * EventWaiter wakes up as soon as it happens instead of polling.
+  * @see EventWaiter
   */
 class LIBPUMPKINSHARED_EXPORT BlockingTimer {
 public:
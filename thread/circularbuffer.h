@@ -18,17 +18,8 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QtDebug>
-
-// MAYDO add method for puting or geting several data items at a time
-// QList<T> tryGetAll() : get all data currently available, or an empty list
-// QList<T> tryGetAll(int timeout) : get all data as soon as there is at less 1 available within timeout ms
-// QList<T> getAll() : get all data currently available, or wait until there is at less 1
-// QList<T> waitAndGetAll(int interval) : get all data received within interval ms, maybe more than the buffer size, maybe an empty list
-// bool tryPutAll(QList<T>) : put all data if there is enough room for the whole list
-// bool tryPutAll(QList<T>, int timeout) : put all data as a whole if there is enough room within timeout ms
-// void putAll(QList<T>) : put data for which there are enough room, then wait and do it again until all data has been put
-// int putAsManyAsPossible(QList<T>) : put as many items as possible and return their count
-// int putAsManyAsPossible(QList<T>, int timeout) : same but wait timeout ms if needed to put more data if possible
+#include <QList>
+#include <QElapsedTimer>
 
 /** Thread-safe circular buffer.
  *
@@ -40,11 +31,16 @@
  * Therefore Qt's implicitly shared data classes can be sent through a
  * CircularBuffer exactly as then can through an queued signal/slot connection
  * or a queued QMetaObject::invokeMethod() call.
+ *
+ * Batch methods (*All() and putAsManyAsPossible()) lock the buffer only once
+ * per batch rather than once per item, and waiting threads are counted so
+ * that they are only woken up when there are some.
  */
 template <class T>
 class LIBPUMPKINSHARED_EXPORT CircularBuffer {
 public:
   long _sizeMinusOne, _putCounter, _getCounter, _free, _used;
+  int _putWaiters, _getWaiters;
   QMutex _mutex;
   QWaitCondition _notEmpty, _notFull;
   T *_buffer;
@@ -53,7 +49,8 @@ public:
   /** @param sizePowerOf2 size of buffer (e.g. 10 means 1024 slots) */
   inline CircularBuffer(unsigned sizePowerOf2)
     : _sizeMinusOne((1 << sizePowerOf2) - 1), _putCounter(0), _getCounter(0),
-      _free(_sizeMinusOne+1), _used(0), _buffer(new T[_sizeMinusOne+1]) {
+      _free(_sizeMinusOne+1), _used(0), _putWaiters(0), _getWaiters(0),
+      _buffer(new T[_sizeMinusOne+1]) {
     if (sizePowerOf2 >= sizeof(_sizeMinusOne)*8)
       qWarning() << "CircularBuffer cannot hold buffer as large as 2 ^ "
                  << sizePowerOf2;
@@ -64,14 +61,9 @@ public:
   /** Put data. If needed, wait until there are enough room in the buffer. */
   inline void put(T data) {
     QMutexLocker locker(&_mutex);
-    if (_free == 0)
-      _notFull.wait(&_mutex);
-    // since size is a power of 2, % size === &(size-1)
-    _buffer[_putCounter & (_sizeMinusOne)] = data;
-    ++_putCounter;
-    --_free;
-    ++_used;
-    _notEmpty.wakeAll();
+    waitForFree(1, -1);
+    doPut(data);
+    wakeGetters();
   }
   /** Put data only if there are enough room for it.
    * @return true on success */
@@ -79,40 +71,76 @@ public:
     QMutexLocker locker(&_mutex);
     if (_free == 0)
       return false;
-    // since size is a power of 2, % size === &(size-1)
-    _buffer[_putCounter & (_sizeMinusOne)] = data;
-    ++_putCounter;
-    --_free;
-    ++_used;
-    _notEmpty.wakeAll();
+    doPut(data);
+    wakeGetters();
     return true;
   }
   /** Put data only if there are enough room for it within timeout milliseconds.
    * @return true on success */
   inline bool tryPut(T data, int timeout) {
     QMutexLocker locker(&_mutex);
-    if (_free == 0 && !_notFull.wait(&_mutex, timeout))
+    if (!waitForFree(1, timeout))
       return false;
-    // since size is a power of 2, % size === &(size-1)
-    _buffer[_putCounter & (_sizeMinusOne)] = data;
-    ++_putCounter;
-    --_free;
-    ++_used;
-    _notEmpty.wakeAll();
+    doPut(data);
+    wakeGetters();
+    return true;
+  }
+  /** Put all data if there is enough room for the whole list.
+   * @return true on success */
+  inline bool tryPutAll(QList<T> data) {
+    return tryPutAll(data, 0);
+  }
+  /** Put all data as a whole if there is enough room within timeout ms.
+   * @return true on success */
+  inline bool tryPutAll(QList<T> data, int timeout) {
+    QMutexLocker locker(&_mutex);
+    if (!waitForFree(data.size(), timeout))
+      return false;
+    foreach (const T &t, data)
+      doPut(t);
+    wakeGetters();
     return true;
   }
+  /** Put data for which there is enough room, then wait and do it again until
+   * all data has been put. */
+  inline void putAll(QList<T> data) {
+    QMutexLocker locker(&_mutex);
+    int i = 0, n = data.size();
+    while (i < n) {
+      waitForFree(1, -1);
+      for (; i < n && _free; ++i)
+        doPut(data[i]);
+      wakeGetters();
+    }
+  }
+  /** Put as many items as possible without waiting.
+   * @return number of items put, the first ones of the list */
+  inline int putAsManyAsPossible(QList<T> data) {
+    return putAsManyAsPossible(data, 0);
+  }
+  /** Put as many items as possible, waiting up to timeout ms if needed to
+   * put more.
+   * @return number of items put, the first ones of the list */
+  inline int putAsManyAsPossible(QList<T> data, int timeout) {
+    QMutexLocker locker(&_mutex);
+    QElapsedTimer timer;
+    timer.start();
+    int i = 0, n = data.size();
+    while (i < n) {
+      for (; i < n && _free; ++i)
+        doPut(data[i]);
+      wakeGetters();
+      if (i == n || !waitForFree(1, qMax(0LL, timeout-timer.elapsed())))
+        break;
+    }
+    return i;
+  }
   /** Get data. If needed, wait until it become available. */
   inline T get() {
     QMutexLocker locker(&_mutex);
-    if (_used == 0)
-      _notEmpty.wait(&_mutex);
-    // since size is a power of 2, % size === &(size-1)
-    T t = _buffer[_getCounter & (_sizeMinusOne)];
-    _buffer[_getCounter & (_sizeMinusOne)] = T();
-    ++_getCounter;
-    --_used;
-    ++_free;
-    _notFull.wakeAll();
+    waitForUsed(-1);
+    T t = doGet();
+    wakePutters();
     return t;
   }
   /** Get data only if it is available.
@@ -121,37 +149,58 @@ public:
     QMutexLocker locker(&_mutex);
     if (!data || _used == 0)
       return false;
-    // since size is a power of 2, % size === &(size-1)
-    *data = _buffer[_getCounter & (_sizeMinusOne)];
-    _buffer[_getCounter & (_sizeMinusOne)] = T();
-    ++_getCounter;
-    --_used;
-    ++_free;
-    _notFull.wakeAll();
+    *data = doGet();
+    wakePutters();
     return true;
   }
   /** Get data only if it is available within timeout milliseconds.
    * @return true on success */
   inline bool tryGet(T *data, int timeout) {
     QMutexLocker locker(&_mutex);
-    if (!data || (_used == 0 && !_notEmpty.wait(&_mutex, timeout)))
+    if (!data || !waitForUsed(timeout))
       return false;
-    // since size is a power of 2, % size === &(size-1)
-    *data = _buffer[_getCounter & (_sizeMinusOne)];
-    _buffer[_getCounter & (_sizeMinusOne)] = T();
-    ++_getCounter;
-    --_used;
-    ++_free;
-    _notFull.wakeAll();
+    *data = doGet();
+    wakePutters();
     return true;
   }
+  /** Get all data currently available, or an empty list. */
+  inline QList<T> tryGetAll() {
+    return tryGetAll(0);
+  }
+  /** Get all data as soon as there is at less 1 available within timeout ms,
+   * or an empty list. */
+  inline QList<T> tryGetAll(int timeout) {
+    QMutexLocker locker(&_mutex);
+    QList<T> data;
+    if (waitForUsed(timeout))
+      doGetAll(&data);
+    return data;
+  }
+  /** Get all data currently available, or wait until there is at less 1. */
+  inline QList<T> getAll() {
+    return tryGetAll(-1);
+  }
+  /** Get all data received within interval ms, maybe more than the buffer
+   * size, maybe an empty list. */
+  inline QList<T> waitAndGetAll(int interval) {
+    QMutexLocker locker(&_mutex);
+    QElapsedTimer timer;
+    timer.start();
+    QList<T> data;
+    forever {
+      doGetAll(&data);
+      qint64 remaining = interval-timer.elapsed();
+      if (remaining <= 0 || !waitForUsed(remaining))
+        break;
+    }
+    return data;
+  }
   /** Discard all data. If needed, wait until it become available. */
   void clear() {
     QMutexLocker locker(&_mutex);
-    _getCounter = _putCounter;
-    _used = 0;
-    _free = _sizeMinusOne+1;
-    _notFull.wakeAll();
+    while (_used)
+      doGet(); // release data
+    wakePutters();
   }
   /** Total size of buffer. */
   inline long size() const { return _sizeMinusOne+1; }
@@ -167,6 +216,78 @@ public:
   /** Number of successful get so far.
    * This method is only usefull for testing or benchmarking this class. */
   inline long getCounter() const { return _getCounter; }
+
+private:
+  // following methods must be called with _mutex locked
+  inline void doPut(const T &data) {
+    // since size is a power of 2, % size === &(size-1)
+    _buffer[_putCounter & (_sizeMinusOne)] = data;
+    ++_putCounter;
+    --_free;
+    ++_used;
+  }
+  inline T doGet() {
+    // since size is a power of 2, % size === &(size-1)
+    T t = _buffer[_getCounter & (_sizeMinusOne)];
+    _buffer[_getCounter & (_sizeMinusOne)] = T();
+    ++_getCounter;
+    --_used;
+    ++_free;
+    return t;
+  }
+  inline void doGetAll(QList<T> *data) {
+    data->reserve(data->size()+_used);
+    while (_used)
+      data->append(doGet());
+    wakePutters();
+  }
+  inline void wakeGetters() {
+    if (_getWaiters && _used)
+      _notEmpty.wakeAll();
+  }
+  inline void wakePutters() {
+    if (_putWaiters && _free)
+      _notFull.wakeAll();
+  }
+  /** Wait until at less needed slots are free, timeout < 0 meaning forever.
+   * @return false on timeout */
+  inline bool waitForFree(long needed, qint64 timeout) {
+    if (_free >= needed)
+      return true;
+    if (needed > _sizeMinusOne+1 || timeout == 0)
+      return false;
+    return waitFor(&_notFull, &_putWaiters, timeout,
+                   [this,needed]() { return _free >= needed; });
+  }
+  /** Wait until at less one item is available, timeout < 0 meaning forever.
+   * @return false on timeout */
+  inline bool waitForUsed(qint64 timeout) {
+    if (_used)
+      return true;
+    if (timeout == 0)
+      return false;
+    return waitFor(&_notEmpty, &_getWaiters, timeout,
+                   [this]() { return _used > 0; });
+  }
+  template<class Predicate>
+  inline bool waitFor(QWaitCondition *condition, int *waiters, qint64 timeout,
+                      Predicate predicate) {
+    QElapsedTimer timer;
+    timer.start();
+    ++*waiters;
+    while (!predicate()) {
+      if (timeout < 0) {
+        condition->wait(&_mutex);
+      } else {
+        qint64 remaining = timeout-timer.elapsed();
+        if (remaining <= 0)
+          break;
+        condition->wait(&_mutex, (unsigned long)remaining);
+      }
+    }
+    --*waiters;
+    return predicate();
+  }
 };
 
 #endif // CIRCULARBUFFER_H
@@ -0,0 +1,80 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "eventwaiter.h"
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include <climits>
+
+EventWaiter::EventWaiter(Condition condition, QObject *parent)
+  : QObject(parent), _condition(condition), _loop(0),
+    _eventLoopThread(QThread::currentThread()), _woken(false) {
+}
+
+void EventWaiter::addSignal(const QObject *sender, const char *signal) {
+  connect(sender, signal, this, SLOT(wake()), Qt::DirectConnection);
+}
+
+void EventWaiter::wake() {
+  QMutexLocker ml(&_mutex);
+  _woken = true;
+  _waitCondition.wakeAll();
+  if (_loop) // queued since wake() may be called by any thread
+    QMetaObject::invokeMethod(_loop, "quit", Qt::QueuedConnection);
+}
+
+bool EventWaiter::isSatisfied(bool woken) {
+  if (_condition)
+    return _condition();
+  if (woken)
+    return true;
+  QMutexLocker ml(&_mutex);
+  foreach (const Condition &finished, _futuresFinished)
+    if (finished())
+      return true;
+  return false;
+}
+
+bool EventWaiter::wait(int timeout) {
+  QElapsedTimer timer;
+  timer.start();
+  QMutexLocker ml(&_mutex);
+  forever {
+    bool woken = _woken;
+    _woken = false;
+    ml.unlock();
+    if (isSatisfied(woken))
+      return true;
+    qint64 remaining = timeout < 0 ? -1 : timeout-timer.elapsed();
+    if (timeout >= 0 && remaining <= 0)
+      return false;
+    ml.relock();
+    if (_woken)
+      continue; // woken while evaluating condition
+    if (QThread::currentThread() == _eventLoopThread) {
+      QEventLoop loop;
+      _loop = &loop;
+      ml.unlock();
+      if (remaining >= 0)
+        QTimer::singleShot((int)remaining, &loop, SLOT(quit()));
+      loop.exec();
+      ml.relock();
+      _loop = 0;
+    } else {
+      _waitCondition.wait(&_mutex, remaining < 0 ? ULONG_MAX
+                                                 : (unsigned long)remaining);
+    }
+  }
+}
@@ -0,0 +1,113 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EVENTWAITER_H
+#define EVENTWAITER_H
+
+#include "libp6core_global.h"
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <functional>
+
+class QEventLoop;
+class QThread;
+
+/** Wait for something to happen, without polling: a condition to become true,
+ * a signal to be emitted, a future to finish, or a deadline.
+ *
+ * When wait() is called by the event loop thread (see setEventLoopThread(),
+ * by default the thread that created the waiter), it runs a local QEventLoop,
+ * which lets the thread go on processing its events (e.g.
+ * QNetworkAccessManager replies) meanwhile. Like with any local event loop,
+ * this requires the calling code to be reentrant.
+ * When wait() is called by another thread, it blocks on a QWaitCondition,
+ * which does not require the calling code to be reentrant.
+ * In both cases it wakes up as soon as one of the watched signals is emitted
+ * or wake() is called, whatever the thread that emits or calls it.
+ *
+ * Usage example:
+ * EventWaiter waiter([&]() { return cache.contains(key); });
+ * waiter.addSignal(&cache, &Cache::entryAdded);
+ * if (!waiter.wait(1000))
+ *   ; // timeout
+ *
+ * @see BlockingTimer */
+class LIBPUMPKINSHARED_EXPORT EventWaiter : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY(EventWaiter)
+
+public:
+  using Condition = std::function<bool()>;
+
+private:
+  Condition _condition;
+  QList<Condition> _futuresFinished;
+  QMutex _mutex;
+  QWaitCondition _waitCondition;
+  QEventLoop *_loop;
+  QThread *_eventLoopThread;
+  bool _woken;
+
+public:
+  /** @param condition if set, wait() returns only when it is true (it is
+   * evaluated on every wake up) otherwise wait() returns on first signal
+   * received or future finished */
+  explicit EventWaiter(Condition condition = 0, QObject *parent = 0);
+  /** Wake up waiting thread whenever sender emits signal.
+   * Can be called several times to watch several signals. */
+  template <typename Func>
+  void addSignal(const typename QtPrivate::FunctionPointer<Func>::Object
+                 *sender, Func signal) {
+    connect(sender, signal, this, &EventWaiter::wake, Qt::DirectConnection);
+  }
+  /** Old syntax version of addSignal, e.g.
+   * addSignal(reply, SIGNAL(finished())) */
+  void addSignal(const QObject *sender, const char *signal);
+  /** Wake up waiting thread when future finishes.
+   * Notification relies on a QFutureWatcher living in the thread that
+   * created the waiter, therefore if another thread waits, the creating
+   * thread must run an event loop. */
+  template <typename T>
+  void addFuture(QFuture<T> future) {
+    QFutureWatcher<T> *watcher = new QFutureWatcher<T>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, &EventWaiter::wake,
+            Qt::DirectConnection);
+    watcher->setFuture(future);
+    QMutexLocker ml(&_mutex);
+    _futuresFinished.append([future]() { return future.isFinished(); });
+  }
+  /** Set the thread for which wait() runs a local event loop rather than
+   * blocking, e.g. the thread of an object that needs its events to be
+   * processed for the condition to become true. 0 means always blocking.
+   * Default: the thread that created the waiter, which is the calling thread
+   * when the waiter is a local variable. */
+  void setEventLoopThread(QThread *thread) { _eventLoopThread = thread; }
+  /** Wait until the condition is true or, if there is no condition, until
+   * a watched signal is emitted or a watched future is finished.
+   * @param timeout in ms, < 0 means forever
+   * @return false on timeout */
+  bool wait(int timeout = -1);
+
+public slots:
+  /** Wake up waiting thread, e.g. to evaluate the condition again.
+   * This method is thread-safe. */
+  void wake();
+
+private:
+  inline bool isSatisfied(bool woken);
+};
+
+#endif // EVENTWAITER_H
@@ -0,0 +1,119 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef READMOSTLYATOMICVALUE_H
+#define READMOSTLYATOMICVALUE_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <memory>
+#include "libp6core_global.h"
+
+/** Variant of AtomicValue for data that are read far more often than they
+ * are written, e.g. configuration snapshots read on every request.
+ *
+ * Data is published as an immutable snapshot (std::shared_ptr<const T>)
+ * which readers get with std::atomic_load() without taking the writers
+ * mutex, and which writers replace with std::atomic_store(). A version is
+ * freed as soon as the last reader holding it releases it: readers that
+ * only call data() hold it just the time to copy it (which is cheap with
+ * implicitly shared objects, one atomic reference count increment), and
+ * readers that need a consistent view over several reads can hold
+ * snapshot() as long as they need.
+ *
+ * Writers use the same API than AtomicValue, including lockData(),
+ * tryLockData() and unlockData(), unlockData() publishing a new version.
+ *
+ * Usage example:
+ * ReadMostlyAtomicValue<ParamSet> config;
+ * ...
+ * ParamSet params = config; // no lock
+ * ...
+ * config = newParams; // publish a new version
+ *
+ * @see AtomicValue */
+template <class T>
+class LIBPUMPKINSHARED_EXPORT ReadMostlyAtomicValue {
+  std::shared_ptr<const T> _snapshot;
+  mutable QMutex _mutex; // serializes writers
+  T _locked; // data being modified between lockData() and unlockData()
+
+public:
+  ReadMostlyAtomicValue() : _snapshot(std::make_shared<const T>()) { }
+  explicit ReadMostlyAtomicValue(T data)
+    : _snapshot(std::make_shared<const T>(data)) { }
+  explicit ReadMostlyAtomicValue(const ReadMostlyAtomicValue<T> &other)
+    : _snapshot(other.snapshot()) { }
+  /** Current version of holded data, which stays alive and unchanged as long
+   * as the returned pointer (or a copy of it) exists.
+   * This method is thread-safe and does not lock the writers mutex. */
+  std::shared_ptr<const T> snapshot() const {
+    return std::atomic_load(&_snapshot); }
+  /** Get (take a copy of) holded data.
+   * This method is thread-safe and does not lock the writers mutex. */
+  T data() const { return *snapshot(); }
+  /** Convenience operator for data() */
+  T operator*() const { return this->data(); }
+  /** Convenience operator for data() */
+  operator T() const { return this->data(); }
+  /** Set (overwrite) holded data.
+   * This method is thread-safe. */
+  void setData(T other) {
+    QMutexLocker ml(&_mutex);
+    std::atomic_store(&_snapshot, std::make_shared<const T>(other));
+  }
+  /** Convenience operator for setData() */
+  ReadMostlyAtomicValue<T> &operator=(T other) {
+    setData(other);
+    return *this;
+  }
+  /** Convenience method for setData(other.data()) */
+  void setData(const ReadMostlyAtomicValue<T> &other) {
+    setData(other.data());
+  }
+  /** Convenience operator for setData() */
+  ReadMostlyAtomicValue<T> &operator=(const ReadMostlyAtomicValue<T> &other) {
+    setData(other);
+    return *this;
+  }
+  /** Lock and get a modifiable copy of holded data, which disable any write
+   * access until unlocked with unlockData().
+   * Readers go on reading the current version meanwhile. */
+  T &lockData() {
+    _mutex.lock();
+    _locked = *_snapshot; // writers mutex protects _snapshot from writers
+    return _locked;
+  }
+  /** Same as lockData() but with a timeout.
+   * Never try to access data through returned reference on failure.
+   * @param success *success is set to true on succes */
+  T &tryLockData(bool *success, int timeout = 0) {
+    if (success) {
+      *success = _mutex.tryLock(timeout);
+      if (*success) {
+        _locked = *_snapshot;
+        return _locked;
+      }
+    }
+    return *(T*)0;
+  }
+  /** Unlock when previously locked by lockData() or tryLockData(), and
+   * publish data as a new version. */
+  void unlockData() {
+    std::atomic_store(&_snapshot, std::make_shared<const T>(_locked));
+    _locked = T(); // don't keep a reference to published data
+    _mutex.unlock();
+  }
+};
+
+#endif // READMOSTLYATOMICVALUE_H
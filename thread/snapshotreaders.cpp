@@ -0,0 +1,82 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "snapshotreaders.h"
+
+SnapshotReaders::Frame *&SnapshotReaders::innermostFrame() {
+  // stack of snapshots read by current thread, linked through Reader objects
+  static thread_local Frame *innermost = 0;
+  return innermost;
+}
+
+void SnapshotReaders::pushFrame(Frame *frame, const void *snapshot) {
+  Frame *&innermost = innermostFrame();
+  frame->_readers = this;
+  frame->_snapshot = snapshot;
+  frame->_parent = innermost;
+  innermost = frame;
+}
+
+void SnapshotReaders::popFrame(Frame *frame) {
+  innermostFrame() = frame->_parent;
+  if (_waitingWriters.loadAcquire()) {
+    QMutexLocker ml(&_mutex);
+    _readerDone.wakeAll();
+  }
+}
+
+int SnapshotReaders::ownReferences(const void *snapshot) {
+  int count = 0;
+  for (Frame *frame = innermostFrame(); frame; frame = frame->_parent)
+    if (frame->_snapshot == snapshot)
+      ++count;
+  return count;
+}
+
+void SnapshotReaders::retire(std::shared_ptr<const void> previous) {
+  if (!previous)
+    return;
+  QMutexLocker ml(&_mutex);
+  for (int i = 0; i < _retired.size(); )
+    if (_retired[i].second.expired())
+      _retired.removeAt(i);
+    else
+      ++i;
+  _retired.append(qMakePair(previous.get(),
+                            std::weak_ptr<const void>(previous)));
+}
+
+void SnapshotReaders::waitForReaders() {
+  _waitingWriters.ref();
+  QMutexLocker ml(&_mutex);
+  forever {
+    bool busy = false;
+    for (int i = 0; i < _retired.size(); ) {
+      long count = _retired[i].second.use_count();
+      if (!count) {
+        _retired.removeAt(i);
+        continue;
+      }
+      if (count > ownReferences(_retired[i].first))
+        busy = true;
+      ++i;
+    }
+    if (!busy)
+      break;
+    // the timeout only matters if a reader checked _waitingWriters just
+    // before it was incremented, which is rare
+    _readerDone.wait(&_mutex, 100);
+  }
+  ml.unlock();
+  _waitingWriters.deref();
+}
@@ -0,0 +1,104 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPSHOTREADERS_H
+#define SNAPSHOTREADERS_H
+
+#include "libp6core_global.h"
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QList>
+#include <QPair>
+#include <memory>
+
+/** Keep track of readers of immutable snapshots published with
+ * std::atomic_store(), so that a writer can wait for every reader of the
+ * snapshots it replaced to be done before e.g. letting its caller delete an
+ * object referenced by them.
+ *
+ * Readers access the current snapshot through a Reader, which neither locks
+ * nor waits. Writers call retire() with the previous snapshot, under their own
+ * mutex, then waitForReaders() once this mutex is released, so that readers
+ * never wait for writers and writers do not spin.
+ * A thread that replaces a snapshot while it is itself reading it (e.g.
+ * removing a logger from within a log call) does not wait for itself.
+ *
+ * Usage example:
+ * std::shared_ptr<Routes> _routes;
+ * SnapshotReaders _readers;
+ * ...
+ * SnapshotReaders::Reader<Routes> routes(&_readers, &_routes); // reader
+ * routes->...
+ * ...
+ * QMutexLocker ml(&_mutex); // writer
+ * _readers.retire(std::atomic_load(&_routes));
+ * std::atomic_store(&_routes, newRoutes);
+ * ml.unlock();
+ * _readers.waitForReaders();
+ */
+class LIBPUMPKINSHARED_EXPORT SnapshotReaders {
+  Q_DISABLE_COPY(SnapshotReaders)
+  class Frame {
+  public:
+    SnapshotReaders *_readers;
+    const void *_snapshot;
+    Frame *_parent;
+  };
+  QMutex _mutex;
+  QWaitCondition _readerDone;
+  QAtomicInt _waitingWriters;
+  // retired snapshots that may still have readers, protected by _mutex
+  QList<QPair<const void*,std::weak_ptr<const void>>> _retired;
+
+public:
+  /** Read-only access to the current snapshot for the lifetime of the
+   * Reader object, which is intended to be a local variable. */
+  template <class T>
+  class Reader {
+    Q_DISABLE_COPY(Reader)
+    std::shared_ptr<T> _snapshot;
+    Frame _frame;
+
+  public:
+    Reader(SnapshotReaders *readers, const std::shared_ptr<T> *current)
+      : _snapshot(std::atomic_load(current)) {
+      readers->pushFrame(&_frame, _snapshot.get());
+    }
+    ~Reader() {
+      // release the snapshot before telling writers it may be unused
+      _snapshot.reset();
+      _frame._readers->popFrame(&_frame);
+    }
+    T *operator->() const { return _snapshot.get(); }
+    T &operator*() const { return *_snapshot; }
+    const std::shared_ptr<T> &snapshot() const { return _snapshot; }
+  };
+
+  SnapshotReaders() { }
+  /** Record a snapshot that has just been (or is being) replaced.
+   * Can be called with writers' mutex locked. */
+  void retire(std::shared_ptr<const void> previous);
+  /** Wait until no other thread reads any of the retired snapshots.
+   * Must not be called with writers' mutex locked, since a reader may need it
+   * to be done (e.g. a logger that logs through the multiplexer). */
+  void waitForReaders();
+
+private:
+  void pushFrame(Frame *frame, const void *snapshot);
+  void popFrame(Frame *frame);
+  static Frame *&innermostFrame();
+  static int ownReferences(const void *snapshot);
+};
+
+#endif // SNAPSHOTREADERS_H
@@ -0,0 +1,227 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "workerpool.h"
+#include <QThread>
+#include <QHash>
+#include <QMutexLocker>
+#include <QtDebug>
+
+class WorkerPoolThread : public QThread {
+public:
+  class Item {
+  public:
+    WorkerPool::Task _task;
+    qint64 _enqueuedNsecs;
+  };
+  WorkerPool *_pool;
+  int _rank;
+  QMutex _mutex;
+  QList<Item> _queues[WorkerPool::PrioritiesCount];
+
+  WorkerPoolThread(WorkerPool *pool, int rank)
+    : _pool(pool), _rank(rank) {
+    setObjectName(QStringLiteral("%1-%2").arg(pool->name()).arg(rank));
+  }
+
+protected:
+  void run();
+};
+
+static thread_local WorkerPoolThread *_currentWorker = 0;
+
+namespace {
+
+class Registry {
+public:
+  QMutex _mutex;
+  QHash<QString,WorkerPool*> _pools;
+  ~Registry() { qDeleteAll(_pools); }
+};
+
+} // unnamed namespace
+
+Q_GLOBAL_STATIC(Registry, _registry)
+
+WorkerPool::WorkerPool(QString name, int size) : _name(name) {
+  if (size <= 0)
+    size = qMax(1, QThread::idealThreadCount());
+  _clock.start();
+  for (int i = 0; i < size; ++i)
+    _workers.append(new WorkerPoolThread(this, i));
+  foreach (WorkerPoolThread *worker, _workers)
+    worker->start();
+}
+
+WorkerPool::~WorkerPool() {
+  shutdown();
+  foreach (WorkerPoolThread *worker, _workers)
+    worker->wait();
+  quint64 lost = _pending.loadAcquire();
+  if (lost)
+    qWarning() << "WorkerPool" << _name << "dropped" << lost
+               << "tasks submitted during shutdown";
+  qDeleteAll(_workers);
+}
+
+WorkerPool *WorkerPool::pool(QString name) {
+  Registry *registry = _registry();
+  if (!registry)
+    return 0;
+  QMutexLocker ml(&registry->_mutex);
+  WorkerPool *&pool = registry->_pools[name];
+  if (!pool)
+    pool = new WorkerPool(name);
+  return pool;
+}
+
+bool WorkerPool::registerPool(WorkerPool *pool) {
+  Registry *registry = _registry();
+  if (!pool || !registry)
+    return false;
+  QMutexLocker ml(&registry->_mutex);
+  if (registry->_pools.contains(pool->name()))
+    return false;
+  registry->_pools.insert(pool->name(), pool);
+  return true;
+}
+
+QList<WorkerPool::Stats> WorkerPool::allStats() {
+  QList<Stats> stats;
+  Registry *registry = _registry();
+  if (!registry)
+    return stats;
+  QMutexLocker ml(&registry->_mutex);
+  foreach (WorkerPool *pool, registry->_pools)
+    stats.append(pool->stats());
+  return stats;
+}
+
+WorkerPool *WorkerPool::currentPool() {
+  return _currentWorker ? _currentWorker->_pool : 0;
+}
+
+bool WorkerPool::submit(Task task, Priority priority) {
+  if (!task)
+    return false;
+  if (_stopping.loadAcquire()) {
+    _rejected.fetchAndAddRelaxed(1);
+    return false;
+  }
+  WorkerPoolThread *worker =
+      (_currentWorker && _currentWorker->_pool == this)
+      ? _currentWorker
+      : _workers[_nextWorker.fetchAndAddRelaxed(1) % _workers.size()];
+  {
+    QMutexLocker ml(&worker->_mutex);
+    worker->_queues[priority].append({ task, _clock.nsecsElapsed() });
+    // incrementing under worker mutex so that _pending is never lower than
+    // queued tasks count, see takeTask()
+    _pending.fetchAndAddOrdered(1);
+  }
+  _submitted.fetchAndAddRelaxed(1);
+  // _pending then _sleepers here, _sleepers then _pending in takeTask(), both
+  // with ordered RMW operations: either the sleeper sees the task or we see
+  // the sleeper, therefore no wakeup can be lost
+  if (_sleepers.fetchAndAddOrdered(0) > 0) {
+    QMutexLocker ml(&_sleepMutex);
+    _sleepCondition.wakeOne();
+  }
+  return true;
+}
+
+void WorkerPool::shutdown() {
+  _stopping.storeRelease(1);
+  QMutexLocker ml(&_sleepMutex);
+  _sleepCondition.wakeAll();
+}
+
+bool WorkerPool::takeTask(WorkerPoolThread *self, Task *task,
+                          qint64 *enqueuedNsecs) {
+  int n = _workers.size();
+  forever {
+    for (int priority = High; priority >= Low; --priority) {
+      for (int i = 0; i < n; ++i) {
+        WorkerPoolThread *worker = _workers[(self->_rank+i)%n];
+        QMutexLocker ml(&worker->_mutex);
+        QList<WorkerPoolThread::Item> &queue = worker->_queues[priority];
+        if (queue.isEmpty())
+          continue;
+        // own queue head is the oldest task, other queues tail is the one
+        // their owner would have run last
+        WorkerPoolThread::Item item = i ? queue.takeLast() : queue.takeFirst();
+        _pending.fetchAndSubOrdered(1);
+        ml.unlock();
+        if (i)
+          _stolen.fetchAndAddRelaxed(1);
+        *task = item._task;
+        *enqueuedNsecs = item._enqueuedNsecs;
+        return true;
+      }
+    }
+    QMutexLocker ml(&_sleepMutex);
+    _sleepers.fetchAndAddOrdered(1);
+    if (_pending.fetchAndAddOrdered(0) == 0) {
+      if (_stopping.loadAcquire()) {
+        _sleepers.fetchAndSubOrdered(1);
+        return false;
+      }
+      _sleepCondition.wait(&_sleepMutex);
+    }
+    _sleepers.fetchAndSubOrdered(1);
+  }
+}
+
+void WorkerPool::recordMax(QAtomicInteger<quint64> *max, quint64 value) {
+  quint64 current = max->loadAcquire();
+  while (value > current && !max->testAndSetOrdered(current, value))
+    current = max->loadAcquire();
+}
+
+WorkerPool::Stats WorkerPool::stats() const {
+  Stats stats;
+  stats._name = _name;
+  stats._workers = _workers.size();
+  stats._queueDepth = _pending.loadAcquire();
+  stats._running = _running.loadAcquire();
+  stats._submitted = _submitted.loadAcquire();
+  stats._rejected = _rejected.loadAcquire();
+  stats._completed = _completed.loadAcquire();
+  stats._stolen = _stolen.loadAcquire();
+  stats._totalWaitUsecs = _totalWaitUsecs.loadAcquire();
+  stats._maxWaitUsecs = _maxWaitUsecs.loadAcquire();
+  stats._totalRunUsecs = _totalRunUsecs.loadAcquire();
+  stats._maxRunUsecs = _maxRunUsecs.loadAcquire();
+  return stats;
+}
+
+void WorkerPoolThread::run() {
+  _currentWorker = this;
+  WorkerPool::Task task;
+  qint64 enqueuedNsecs;
+  while (_pool->takeTask(this, &task, &enqueuedNsecs)) {
+    qint64 start = _pool->_clock.nsecsElapsed();
+    quint64 waitUsecs = quint64(qMax(0LL, start-enqueuedNsecs)/1000);
+    _pool->_totalWaitUsecs.fetchAndAddRelaxed(waitUsecs);
+    _pool->recordMax(&_pool->_maxWaitUsecs, waitUsecs);
+    _pool->_running.fetchAndAddRelaxed(1);
+    task();
+    task = WorkerPool::Task(); // release captured data before sleeping
+    _pool->_running.fetchAndSubRelaxed(1);
+    quint64 runUsecs = quint64((_pool->_clock.nsecsElapsed()-start)/1000);
+    _pool->_totalRunUsecs.fetchAndAddRelaxed(runUsecs);
+    _pool->recordMax(&_pool->_maxRunUsecs, runUsecs);
+    _pool->_completed.fetchAndAddRelaxed(1);
+  }
+  _currentWorker = 0;
+}
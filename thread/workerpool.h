@@ -0,0 +1,120 @@
+/* Copyright 2018 Hallowyn, Gregoire Barbier and others.
+ * This file is part of libpumpkin, see <http://libpumpkin.g76r.eu/>.
+ * Libpumpkin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Libpumpkin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with libpumpkin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QString>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <functional>
+#include "libp6core_global.h"
+
+class WorkerPoolThread;
+
+/** Library-wide executor for short background tasks, to be shared by
+ * components instead of each of them creating its own dedicated threads.
+ *
+ * Each worker thread owns one queue per priority. Tasks submitted from
+ * outside the pool are spread round-robin among workers, tasks submitted
+ * from within a worker go to its own queue (for cache locality). A worker
+ * takes tasks from the head of its own queues and, when they are empty,
+ * steals from the tail of other workers' queues, higher priorities first.
+ * There is no global lock on the hot path: a worker queue mutex is only
+ * contended by its owner and thieves, and the pool-wide mutex is only used
+ * to put idle workers to sleep and wake them up.
+ *
+ * Pools are named and registered: pool(name) returns the same pool to any
+ * component, creating it on first call, so that components opt in simply by
+ * using a pool instead of their own threads. Tasks must not block for long
+ * (e.g. waiting for network input without timeout) since this would starve
+ * other components sharing the pool; use a dedicated pool for such tasks.
+ *
+ * Metrics (queue depth, wait and run times) are kept with atomic counters
+ * and can be read at any time with stats().
+ *
+ * This class is thread-safe. */
+class LIBPUMPKINSHARED_EXPORT WorkerPool {
+  Q_DISABLE_COPY(WorkerPool)
+  friend class WorkerPoolThread;
+
+public:
+  enum Priority { Low = 0, Normal, High };
+  static const int PrioritiesCount = High+1;
+  using Task = std::function<void()>;
+  class Stats {
+  public:
+    QString _name;
+    int _workers = 0;
+    quint64 _queueDepth = 0, _running = 0, _submitted = 0, _rejected = 0,
+    _completed = 0, _stolen = 0;
+    quint64 _totalWaitUsecs = 0, _maxWaitUsecs = 0;
+    quint64 _totalRunUsecs = 0, _maxRunUsecs = 0;
+    quint64 averageWaitUsecs() const {
+      return _completed ? _totalWaitUsecs/_completed : 0; }
+    quint64 averageRunUsecs() const {
+      return _completed ? _totalRunUsecs/_completed : 0; }
+  };
+
+private:
+  QString _name;
+  QList<WorkerPoolThread*> _workers;
+  QAtomicInteger<quint32> _nextWorker;
+  QAtomicInteger<quint64> _pending, _running, _submitted, _rejected,
+  _completed, _stolen, _totalWaitUsecs, _maxWaitUsecs, _totalRunUsecs,
+  _maxRunUsecs;
+  QAtomicInt _stopping;
+  QMutex _sleepMutex;
+  QWaitCondition _sleepCondition;
+  QAtomicInt _sleepers;
+  QElapsedTimer _clock;
+
+public:
+  /** @param size number of worker threads, <= 0 means
+   * QThread::idealThreadCount() */
+  explicit WorkerPool(QString name, int size = 0);
+  /** Run remaining queued tasks then stop and join worker threads. */
+  ~WorkerPool();
+  /** Registered pool of that name, created with default size on first call.
+   * Registered pools are deleted at process exit.
+   * @return 0 during process exit */
+  static WorkerPool *pool(QString name);
+  /** Shortcut for pool("default") */
+  static WorkerPool *defaultPool() { return pool(QStringLiteral("default")); }
+  /** Register a pool created by caller, e.g. to choose its size, before any
+   * component calls pool(name). Takes ownership.
+   * @return false if a pool is already registered with this name */
+  static bool registerPool(WorkerPool *pool);
+  static QList<Stats> allStats();
+  /** Queue a task. Never blocks.
+   * @return false if the pool is stopping and the task was rejected */
+  bool submit(Task task, Priority priority = Normal);
+  /** Stop accepting tasks. Queued tasks will still be run, but tasks
+   * submitted concurrently with shutdown() may be dropped. */
+  void shutdown();
+  QString name() const { return _name; }
+  int size() const { return _workers.size(); }
+  quint64 queueDepth() const { return _pending.loadAcquire(); }
+  Stats stats() const;
+  /** Pool the calling thread belongs to, if any. */
+  static WorkerPool *currentPool();
+
+private:
+  bool takeTask(WorkerPoolThread *self, Task *task, qint64 *enqueuedNsecs);
+  void recordMax(QAtomicInteger<quint64> *max, quint64 value);
+};
+
+#endif // WORKERPOOL_H